@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include "raycast.h"
+#include "bvh.h"
+#include "scene.h"
+#include "animate.h"
+
+
+// A keyframe object while the tracks are being sorted out
+typedef struct KeyRef {
+   int target;
+   int order;   // Position in the file, breaks ties between keys on the same frame
+   Keyframe key;
+} KeyRef;
+
+
+static int compareKeyRefs(const void *a, const void *b) {
+
+   const KeyRef *keyA = a;
+   const KeyRef *keyB = b;
+
+   if(keyA->target != keyB->target) return keyA->target < keyB->target ? -1 : 1;
+   if(keyA->key.frame != keyB->key.frame) return keyA->key.frame < keyB->key.frame ? -1 : 1;
+   return keyA->order - keyB->order;
+}
+
+// Position along a track at frame, holding still before the first and after the last key
+static void interpolateTrack(Animation *anim, Track *track, float frame, float *position) {
+
+   Keyframe *keys = &anim->keys[track->firstKey];
+   int last = track->numKeys - 1;
+
+   if(frame <= keys[0].frame || last == 0) {
+      for(int axis = 0; axis < 3; axis++) position[axis] = keys[0].position[axis];
+      return;
+   }
+   if(frame >= keys[last].frame) {
+      for(int axis = 0; axis < 3; axis++) position[axis] = keys[last].position[axis];
+      return;
+   }
+
+   int key = 0;
+   while(keys[key + 1].frame <= frame) key++;
+
+   float s = (frame - keys[key].frame) / (keys[key + 1].frame - keys[key].frame);
+   for(int axis = 0; axis < 3; axis++) {
+      position[axis] = keys[key].position[axis] + s * (keys[key + 1].position[axis] - keys[key].position[axis]);
+   }
+}
+
+// Gathers the keyframe objects of store into per object tracks on scene's primitives and lights
+// Returns 0 on success; on failure returns -1 with a description in error, or -2 when out of memory,
+// leaving what was allocated to freeAnimation()
+int buildAnimation(Animation *anim, SceneStore *store, CompiledScene *scene, char *error, size_t errorSize) {
+
+   int numObjects = store->numObjects;
+   int numKeys = 0;
+   int firstCamera = -1;
+
+   anim->numTracks = 0;
+   anim->tracks = NULL;
+   anim->keys = NULL;
+   anim->lastFrame = 0;
+   anim->movesSpheres = false;
+   anim->centers = NULL;
+   anim->radii = NULL;
+
+   for(int axis = 0; axis < 3; axis++) anim->basePosition[axis] = 0;
+
+   for(int objIndex = 0; objIndex < numObjects; objIndex++) {
+      Object *obj = sceneObject(store, objIndex);
+      if(obj->kind == KEYFRAME) numKeys += 1;
+      if(obj->kind == CAMERA && firstCamera < 0) {
+         firstCamera = objIndex;
+         for(int axis = 0; axis < 3; axis++) anim->basePosition[axis] = obj->position[axis];
+      }
+   }
+
+   if(numKeys == 0) return 0;
+
+   KeyRef *refs = malloc(sizeof(KeyRef) * numKeys);
+   int numRefs = 0;
+   if(!refs) return -2;
+
+   for(int objIndex = 0; objIndex < numObjects; objIndex++) {
+
+      Object *obj = sceneObject(store, objIndex);
+      if(obj->kind != KEYFRAME) continue;
+
+      int target = (int)obj->target - 1;
+      int kind = target >= 0 && target < numObjects && target + 1 == obj->target ? sceneObject(store, target)->kind : NONE;
+
+      if(kind != CAMERA && kind != SPHERE && kind != PLANE && kind != LIGHT) {
+         snprintf(error, errorSize, "keyframe %d: object %g is not a camera, sphere, plane or light", objIndex + 1, obj->target);
+         free(refs);
+         return -1;
+      }
+      if(kind == CAMERA && target != firstCamera) {
+         snprintf(error, errorSize, "keyframe %d: only the first camera can be animated", objIndex + 1);
+         free(refs);
+         return -1;
+      }
+
+      KeyRef *ref = &refs[numRefs++];
+      ref->target = target;
+      ref->order = objIndex;
+      ref->key.frame = obj->frame;
+      for(int axis = 0; axis < 3; axis++) ref->key.position[axis] = obj->position[axis];
+      if(obj->frame > anim->lastFrame) anim->lastFrame = obj->frame;
+   }
+
+   qsort(refs, numRefs, sizeof(KeyRef), compareKeyRefs);
+
+   // Primitive id and light slot of every object the tracks may refer to
+   int *objectIndex = malloc(sizeof(int) * numObjects);
+   anim->keys = malloc(sizeof(Keyframe) * numRefs);
+   anim->tracks = malloc(sizeof(Track) * numRefs);
+   if(!objectIndex || !anim->keys || !anim->tracks) {
+      free(objectIndex);
+      free(refs);
+      return -2;
+   }
+
+   int lightInd = 0;
+   for(int objIndex = 0; objIndex < numObjects; objIndex++) {
+      objectIndex[objIndex] = sceneObject(store, objIndex)->kind == LIGHT ? lightInd++ : -1;
+   }
+   for(int prim = 0; prim < scene->numPrims; prim++) {
+      objectIndex[scene->primObject[prim]] = prim;
+   }
+
+   for(int key = 0; key < numRefs; key++) {
+
+      anim->keys[key] = refs[key].key;
+
+      if(key > 0 && refs[key].target == refs[key - 1].target) {
+         anim->tracks[anim->numTracks - 1].numKeys += 1;
+         continue;
+      }
+
+      Track *track = &anim->tracks[anim->numTracks++];
+      track->object = refs[key].target;
+      track->kind = sceneObject(store, track->object)->kind;
+      track->index = objectIndex[track->object];
+      track->firstKey = key;
+      track->numKeys = 1;
+
+      if(track->kind == SPHERE) anim->movesSpheres = true;
+   }
+
+   free(objectIndex);
+   free(refs);
+
+   // Refits need every sphere, moving or not, in build order
+   if(anim->movesSpheres) {
+      anim->centers = malloc(sizeof(float[3]) * (scene->numSpheres + 1));
+      anim->radii = malloc(sizeof(float) * (scene->numSpheres + 1));
+      if(!anim->centers || !anim->radii) return -2;
+      for(int prim = 0; prim < scene->numSpheres; prim++) {
+         int sphere = scene->bvh.primIndices[prim];
+         anim->centers[sphere][0] = scene->sphereX[prim];
+         anim->centers[sphere][1] = scene->sphereY[prim];
+         anim->centers[sphere][2] = scene->sphereZ[prim];
+         anim->radii[sphere] = sceneObject(store, scene->primObject[prim])->radius;
+      }
+   }
+
+   return 0;
+}
+
+// Moves every keyframed object of scene to where it is at frame; cameraPosition receives the camera's
+void poseScene(Animation *anim, CompiledScene *scene, float frame, float *cameraPosition) {
+
+   for(int axis = 0; axis < 3; axis++) cameraPosition[axis] = anim->basePosition[axis];
+   bool movedLights = false;
+
+   for(int trackInd = 0; trackInd < anim->numTracks; trackInd++) {
+
+      Track *track = &anim->tracks[trackInd];
+      float position[3];
+      interpolateTrack(anim, track, frame, position);
+
+      if(track->kind == SPHERE) {
+         int sphere = scene->bvh.primIndices[track->index];
+         scene->sphereX[track->index] = position[0];
+         scene->sphereY[track->index] = position[1];
+         scene->sphereZ[track->index] = position[2];
+         for(int axis = 0; axis < 3; axis++) anim->centers[sphere][axis] = position[axis];
+      }
+      else if(track->kind == PLANE) {
+         int planeInd = track->index - scene->numSpheres;
+         scene->planeOffset[planeInd] = scene->planeNX[planeInd] * position[0] + \
+                                        scene->planeNY[planeInd] * position[1] + \
+                                        scene->planeNZ[planeInd] * position[2];
+      }
+      else if(track->kind == LIGHT) {
+         for(int axis = 0; axis < 3; axis++) scene->lights[track->index].position[axis] = position[axis];
+         movedLights = true;
+      }
+      else {
+         for(int axis = 0; axis < 3; axis++) cameraPosition[axis] = position[axis];
+      }
+   }
+
+   if(anim->movesSpheres) {
+      refitBVH(&scene->bvh, anim->centers, anim->radii);
+   }
+
+   // Light radii don't change, but the tree is rebuilt rather than refit: there are few lights next to
+   // spheres, and a refit tree gets looser with every frame
+   // Out of memory the tree is left empty and culls nothing
+   if(movedLights && scene->lightTree.epsilon > 0) {
+      buildLightTree(&scene->lightTree, scene->lights, scene->numLights, scene->lightTree.epsilon, scene->reflectance);
+   }
+}
+
+void freeAnimation(Animation *anim) {
+   free(anim->tracks);
+   free(anim->keys);
+   free(anim->centers);
+   free(anim->radii);
+   anim->tracks = NULL;
+   anim->keys = NULL;
+   anim->centers = NULL;
+   anim->radii = NULL;
+   anim->numTracks = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef ANIMATE_H
+#define ANIMATE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "scene.h"
+
+// Keyframes of one object, sorted by frame
+typedef struct Track {
+   int object;       // Scene store index of the object being moved
+   int kind;
+   int index;        // Primitive id for spheres and planes, position in CompiledScene.lights for lights
+   int firstKey;
+   int numKeys;
+} Track;
+
+typedef struct Keyframe {
+   float frame;
+   float position[3];
+} Keyframe;
+
+/*
+Keyframed motion read from a scene's keyframe objects. poseScene() moves the
+compiled scene to a frame in place: sphere centers (followed by a BVH refit),
+plane offsets and light positions are rewritten, and the camera position is
+handed back for the render job. Objects without keyframes are never touched.
+*/
+typedef struct Animation {
+   int numTracks;
+   Track *tracks;
+   Keyframe *keys;
+   float lastFrame;           // Largest frame any keyframe names
+   bool movesSpheres;
+   float (*centers)[3];       // Sphere centers and radii in the order the BVH was built from, for refits
+   float *radii;
+   float basePosition[3];     // Camera position when the camera has no keyframes
+} Animation;
+
+int buildAnimation(Animation *anim, SceneStore *store, CompiledScene *scene, char *error, size_t errorSize);
+void poseScene(Animation *anim, CompiledScene *scene, float frame, float *cameraPosition);
+void freeAnimation(Animation *anim);
+
+#endif
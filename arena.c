@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "arena.h"
+
+// Every allocation is rounded up to this so any type can be stored
+#define ARENA_ALIGN 16
+
+
+static size_t alignUp(size_t size) {
+   return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// Returns NULL when malloc fails
+static ArenaBlock *newBlock(size_t size) {
+
+   ArenaBlock *block = malloc(alignUp(sizeof(ArenaBlock)) + size);
+   if(!block) return NULL;
+
+   block->next = NULL;
+   block->size = size;
+   block->used = 0;
+
+   return block;
+}
+
+// initialSize is how many bytes the first block can hand out, letting callers that know roughly
+// how much they need get it in one malloc; returns 0 on success and -1 when it can't be had, leaving
+// an empty arena that arenaRelease() accepts
+int initArena(Arena *arena, size_t initialSize) {
+   arena->blockSize = alignUp(initialSize > ARENA_MIN_BLOCK ? initialSize : ARENA_MIN_BLOCK);
+   arena->blocks = newBlock(arena->blockSize);
+   return arena->blocks ? 0 : -1;
+}
+
+// Returns NULL when a new block is needed and malloc fails
+void *arenaAlloc(Arena *arena, size_t size) {
+
+   size = alignUp(size);
+
+   ArenaBlock *block = arena->blocks;
+   if(!block || block->used + size > block->size) {
+      // Later blocks double so a badly underestimated arena still needs few mallocs
+      if(arena->blockSize < ((size_t)1 << 30)) arena->blockSize *= 2;
+      block = newBlock(size > arena->blockSize ? size : arena->blockSize);
+      if(!block) return NULL;
+      block->next = arena->blocks;
+      arena->blocks = block;
+   }
+
+   void *memory = (uint8_t *)block + alignUp(sizeof(ArenaBlock)) + block->used;
+   block->used += size;
+
+   return memory;
+}
+
+void arenaRelease(Arena *arena) {
+
+   ArenaBlock *block = arena->blocks;
+   while(block) {
+      ArenaBlock *next = block->next;
+      free(block);
+      block = next;
+   }
+
+   arena->blocks = NULL;
+}
@@ -0,0 +1,29 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Smallest block the arena asks malloc for
+#define ARENA_MIN_BLOCK (1 << 20)
+
+typedef struct ArenaBlock {
+   struct ArenaBlock *next;
+   size_t size;
+   size_t used;
+} ArenaBlock;
+
+/*
+Bump allocator: memory is carved out of large malloc'd blocks, individual
+allocations are never freed, and arenaRelease() returns every block at once.
+When malloc fails, initArena() returns -1 and arenaAlloc() NULL.
+*/
+typedef struct Arena {
+   ArenaBlock *blocks;   // Most recent block first, allocations come from it
+   size_t blockSize;
+} Arena;
+
+int initArena(Arena *arena, size_t initialSize);
+void *arenaAlloc(Arena *arena, size_t size);
+void arenaRelease(Arena *arena);
+
+#endif
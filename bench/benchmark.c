@@ -0,0 +1,313 @@
+/*
+Render benchmark over a fixed suite of generated scenes. Usage:
+
+   ./benchmark [--threads N] [--simd MODE] [--batch-shadows] [--repeats N] [--quick] [--dir DIR]
+               [--out results.json] [--baseline baseline.json] [--threshold PERCENT]
+
+Every case's scene is generated into DIR (bench by default), loaded through rclib and
+rendered to a P6 file there; the best of --repeats runs is kept for each timing. The
+results are written as JSON and, given a baseline written by an earlier run, each case
+is compared against it. A case regresses when its rays/sec drops or its parse time
+grows by more than the threshold (10% by default), and the exit status is then 1.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "../raycast.h"
+#include "../output.h"
+#include "../packet.h"
+#include "../render.h"
+#include "../rclib.h"
+#include "scenegen.h"
+
+// Parse times below this many seconds are too short to compare reliably
+#define MIN_COMPARED_PARSE 0.005
+
+
+typedef struct BenchCase {
+   const char *name;
+   SceneSpec spec;
+   int width;
+   int height;
+   float lightEpsilon;   // Passed to rc_scene_set_light_epsilon(), 0 culls no lights
+} BenchCase;
+
+typedef struct BenchResult {
+   long long primaryRays;
+   long long shadowRays;
+   double parseSeconds;
+   double renderSeconds;
+   double writeSeconds;
+   double raysPerSecond;
+} BenchResult;
+
+// Changing a case invalidates stored baselines for it, so add new ones rather than editing these
+static BenchCase cases[] = {
+   {.name = "simple", .width = 800, .height = 600,
+    .spec = {.numSpheres = 10, .numPlanes = 2, .numLights = 1, .distribution = DIST_UNIFORM, .seed = 1}},
+   {.name = "uniform-1k", .width = 800, .height = 600,
+    .spec = {.numSpheres = 1000, .numPlanes = 2, .numLights = 4, .distribution = DIST_UNIFORM, .seed = 2}},
+   {.name = "clustered-10k", .width = 800, .height = 600,
+    .spec = {.numSpheres = 10000, .numPlanes = 2, .numLights = 4, .distribution = DIST_CLUSTERED, .seed = 3}},
+   {.name = "grid-100k", .width = 640, .height = 480,
+    .spec = {.numSpheres = 100000, .numPlanes = 5, .numLights = 2, .distribution = DIST_GRID, .seed = 4}},
+   {.name = "many-lights", .width = 640, .height = 480,
+    .spec = {.numSpheres = 1000, .numPlanes = 2, .numLights = 32, .distribution = DIST_UNIFORM, .seed = 5}},
+   {.name = "many-planes", .width = 640, .height = 480,
+    .spec = {.numSpheres = 1000, .numPlanes = 32, .numLights = 4, .distribution = DIST_UNIFORM, .seed = 6}},
+   {.name = "small-lights", .width = 320, .height = 240, .lightEpsilon = 1 / 256.0f,
+    .spec = {.numSpheres = 1000, .numPlanes = 2, .numLights = 2000, .distribution = DIST_UNIFORM, .seed = 7,
+             .lightReach = 4}},
+   {.name = "highlights", .width = 640, .height = 480,
+    .spec = {.numSpheres = 1000, .numPlanes = 2, .numLights = 32, .distribution = DIST_UNIFORM, .seed = 5,
+             .shininess = 20}},
+};
+
+#define NUM_CASES ((int)(sizeof(cases) / sizeof(cases[0])))
+
+
+static double now(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(const char *name) {
+   fprintf(stderr, "usage: %s [--threads N] [--simd MODE] [--batch-shadows] [--repeats N] [--quick] [--dir DIR] [--out results.json] [--baseline baseline.json] [--threshold PERCENT]\n", name);
+   exit(1);
+}
+
+static char *readFile(const char *path) {
+
+   FILE *fh = fopen(path, "rb");
+   if(!fh) return NULL;
+
+   fseek(fh, 0, SEEK_END);
+   long size = ftell(fh);
+   fseek(fh, 0, SEEK_SET);
+
+   char *data = malloc(size + 1);
+   if(fread(data, 1, size, fh) != (size_t)size) size = 0;
+   data[size] = '\0';
+   fclose(fh);
+
+   return data;
+}
+
+// Finds "key": number within the object of case caseName in a results file written by writeResults()
+static bool baselineValue(const char *json, const char *caseName, const char *key, double *value) {
+
+   char pattern[128];
+   snprintf(pattern, sizeof(pattern), "\"name\": \"%s\"", caseName);
+   const char *entry = strstr(json, pattern);
+   if(!entry) return false;
+
+   // Stop at the next case
+   const char *end = strstr(entry + strlen(pattern), "\"name\":");
+   snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+   const char *field = strstr(entry, pattern);
+   if(!field || (end && field > end)) return false;
+
+   *value = strtod(field + strlen(pattern), NULL);
+   return true;
+}
+
+// Loads, renders and writes one case repeats times, keeping the best time of each phase
+static int runCase(rc_context *ctx, BenchCase *bench, const char *dir, int scale, int repeats, BenchResult *result) {
+
+   char scenePath[512], imagePath[512];
+   snprintf(scenePath, sizeof(scenePath), "%s/%s.csv", dir, bench->name);
+   snprintf(imagePath, sizeof(imagePath), "%s/%s.ppm", dir, bench->name);
+
+   if(writeBenchScene(scenePath, &bench->spec) != 0) {
+      fprintf(stderr, "cannot write %s\n", scenePath);
+      return -1;
+   }
+
+   for(int run = 0; run < repeats; run++) {
+
+      rc_scene *scene;
+      double start = now();
+      if(rc_scene_load(ctx, scenePath, 0, &scene) != RC_OK) {
+         fprintf(stderr, "%s\n", rc_error_message(ctx));
+         return -1;
+      }
+      double parseSeconds = now() - start;
+
+      if(rc_scene_set_light_epsilon(ctx, scene, bench->lightEpsilon) != RC_OK) {
+         fprintf(stderr, "%s\n", rc_error_message(ctx));
+         rc_scene_free(scene);
+         return -1;
+      }
+
+      int status = rc_render_file(ctx, scene, bench->width / scale, bench->height / scale, imagePath, FORMAT_P6, 0);
+      rc_scene_free(scene);
+      if(status != RC_OK) {
+         fprintf(stderr, "%s\n", rc_error_message(ctx));
+         return -1;
+      }
+
+      rc_stats stats;
+      rc_context_stats(ctx, &stats);
+
+      if(run == 0 || parseSeconds < result->parseSeconds) result->parseSeconds = parseSeconds;
+      if(run == 0 || stats.renderSeconds < result->renderSeconds) result->renderSeconds = stats.renderSeconds;
+      if(run == 0 || stats.writeSeconds < result->writeSeconds) result->writeSeconds = stats.writeSeconds;
+      result->primaryRays = stats.primaryRays;
+      result->shadowRays = stats.shadowRays;
+   }
+
+   result->raysPerSecond = (result->primaryRays + result->shadowRays) / result->renderSeconds;
+   return 0;
+}
+
+static int writeResults(const char *path, int numThreads, int simdMode, int scale, BenchResult *results) {
+
+   FILE *fh = fopen(path, "w");
+   if(!fh) return -1;
+
+   fprintf(fh, "{\n");
+   fprintf(fh, "  \"threads\": %d,\n", numThreads);
+   fprintf(fh, "  \"simd\": \"%s\",\n", simdModeName(simdMode));
+   fprintf(fh, "  \"scale\": %d,\n", scale);
+   fprintf(fh, "  \"cases\": [\n");
+   for(int i = 0; i < NUM_CASES; i++) {
+      BenchCase *bench = &cases[i];
+      BenchResult *result = &results[i];
+      fprintf(fh, "    {\n");
+      fprintf(fh, "      \"name\": \"%s\",\n", bench->name);
+      fprintf(fh, "      \"spheres\": %d,\n", bench->spec.numSpheres);
+      fprintf(fh, "      \"planes\": %d,\n", bench->spec.numPlanes);
+      fprintf(fh, "      \"lights\": %d,\n", bench->spec.numLights);
+      fprintf(fh, "      \"light_epsilon\": %g,\n", bench->lightEpsilon);
+      fprintf(fh, "      \"distribution\": \"%s\",\n", distributionName(bench->spec.distribution));
+      fprintf(fh, "      \"width\": %d,\n", bench->width / scale);
+      fprintf(fh, "      \"height\": %d,\n", bench->height / scale);
+      fprintf(fh, "      \"primary_rays\": %lld,\n", result->primaryRays);
+      fprintf(fh, "      \"shadow_rays\": %lld,\n", result->shadowRays);
+      fprintf(fh, "      \"parse_seconds\": %.6f,\n", result->parseSeconds);
+      fprintf(fh, "      \"render_seconds\": %.6f,\n", result->renderSeconds);
+      fprintf(fh, "      \"write_seconds\": %.6f,\n", result->writeSeconds);
+      fprintf(fh, "      \"rays_per_sec\": %.0f\n", result->raysPerSecond);
+      fprintf(fh, "    }%s\n", i + 1 < NUM_CASES ? "," : "");
+   }
+   fprintf(fh, "  ]\n}\n");
+
+   return fclose(fh) == 0 ? 0 : -1;
+}
+
+// Prints how each case compares with the baseline, returns the number of regressions
+static int compareBaseline(const char *baseline, BenchResult *results, int scale, double threshold) {
+
+   int regressions = 0;
+
+   printf("\nAgainst baseline (threshold %.1f%%):\n", threshold);
+   for(int i = 0; i < NUM_CASES; i++) {
+
+      BenchResult *result = &results[i];
+      double baseRays, baseParse, baseWidth;
+
+      if(!baselineValue(baseline, cases[i].name, "rays_per_sec", &baseRays) || baseRays <= 0 ||
+         !baselineValue(baseline, cases[i].name, "parse_seconds", &baseParse)) {
+         printf("   %-14s not in baseline\n", cases[i].name);
+         continue;
+      }
+      if(!baselineValue(baseline, cases[i].name, "width", &baseWidth) || (int)baseWidth != cases[i].width / scale) {
+         printf("   %-14s rendered at another size in the baseline\n", cases[i].name);
+         continue;
+      }
+
+      double rayChange = 100 * (result->raysPerSecond - baseRays) / baseRays;
+      double parseChange = baseParse > 0 ? 100 * (result->parseSeconds - baseParse) / baseParse : 0;
+
+      bool slowerRays = rayChange < -threshold;
+      bool slowerParse = result->parseSeconds > MIN_COMPARED_PARSE && parseChange > threshold;
+
+      printf("   %-14s rays/sec %+6.1f%%   parse %+6.1f%%%s\n", cases[i].name, rayChange, parseChange,
+             slowerRays || slowerParse ? "   REGRESSION" : "");
+      if(slowerRays || slowerParse) regressions += 1;
+   }
+
+   return regressions;
+}
+
+int main(int argc, char **argv) {
+
+   int numThreads = 0;
+   int simdMode = SIMD_AUTO;
+   int repeats = 3;
+   int scale = 1;
+   bool batchShadows = false;
+   double threshold = 10;
+   const char *dir = "bench";
+   const char *outPath = "bench/results.json";
+   const char *baselinePath = NULL;
+
+   for(int i = 1; i < argc; i++) {
+      bool hasValue = i + 1 < argc;
+      if(strcmp(argv[i], "--threads") == 0 && hasValue) numThreads = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--simd") == 0 && hasValue) {
+         simdMode = parseSimdMode(argv[++i]);
+         if(simdMode < SIMD_AUTO) usage(argv[0]);
+      }
+      else if(strcmp(argv[i], "--batch-shadows") == 0) batchShadows = true;
+      else if(strcmp(argv[i], "--repeats") == 0 && hasValue) repeats = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--quick") == 0) scale = 2;
+      else if(strcmp(argv[i], "--dir") == 0 && hasValue) dir = argv[++i];
+      else if(strcmp(argv[i], "--out") == 0 && hasValue) outPath = argv[++i];
+      else if(strcmp(argv[i], "--baseline") == 0 && hasValue) baselinePath = argv[++i];
+      else if(strcmp(argv[i], "--threshold") == 0 && hasValue) threshold = atof(argv[++i]);
+      else usage(argv[0]);
+   }
+   if(repeats < 1 || numThreads < 0 || threshold < 0) usage(argv[0]);
+
+   rc_context *ctx = rc_context_create();
+   if(!ctx) return 1;
+   if(numThreads == 0) numThreads = defaultThreadCount();
+   rc_context_set_threads(ctx, numThreads);
+   rc_context_set_batch_shadows(ctx, batchShadows);
+   if(rc_context_set_simd(ctx, simdMode) != RC_OK) {
+      fprintf(stderr, "%s\n", rc_error_message(ctx));
+      return 1;
+   }
+   simdMode = resolveSimdMode(simdMode);
+
+   BenchResult results[NUM_CASES];
+
+   printf("%-14s %9s %10s %10s %9s %10s %9s %9s\n", "case", "size", "primary", "shadow", "parse ms", "render ms", "write ms", "Mrays/s");
+   for(int i = 0; i < NUM_CASES; i++) {
+
+      if(runCase(ctx, &cases[i], dir, scale, repeats, &results[i]) != 0) return 1;
+
+      BenchResult *result = &results[i];
+      char size[32];
+      snprintf(size, sizeof(size), "%dx%d", cases[i].width / scale, cases[i].height / scale);
+      printf("%-14s %9s %10lld %10lld %9.1f %10.1f %9.1f %9.2f\n", cases[i].name, size, result->primaryRays, result->shadowRays,
+             result->parseSeconds * 1000, result->renderSeconds * 1000, result->writeSeconds * 1000, result->raysPerSecond / 1e6);
+      fflush(stdout);
+   }
+
+   if(writeResults(outPath, numThreads, simdMode, scale, results) != 0) {
+      fprintf(stderr, "cannot write %s\n", outPath);
+      return 1;
+   }
+   printf("\nWrote %s\n", outPath);
+
+   int regressions = 0;
+   if(baselinePath) {
+      char *baseline = readFile(baselinePath);
+      if(!baseline) {
+         fprintf(stderr, "cannot read %s\n", baselinePath);
+         return 1;
+      }
+      regressions = compareBaseline(baseline, results, scale, threshold);
+      free(baseline);
+   }
+
+   rc_context_free(ctx);
+
+   return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+/*
+Synthetic scene generator. Usage:
+
+   ./mkscene [--spheres N] [--planes N] [--lights N] [--light-reach D] [--shininess S]
+              [--distribution uniform|clustered|grid] [--seed N] output.csv
+
+Writes a scene of the given composition for ./raycast or ./benchmark; see scenegen.h for its layout.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "scenegen.h"
+
+
+static void usage(const char *name) {
+   fprintf(stderr, "usage: %s [--spheres N] [--planes N] [--lights N] [--light-reach D] [--shininess S] [--distribution uniform|clustered|grid] [--seed N] output.csv\n", name);
+   exit(1);
+}
+
+int main(int argc, char **argv) {
+
+   SceneSpec spec = {.numSpheres = 1000, .numPlanes = 2, .numLights = 4, .distribution = DIST_UNIFORM, .seed = 1};
+   const char *path = NULL;
+
+   for(int i = 1; i < argc; i++) {
+      bool hasValue = i + 1 < argc;
+      if(strcmp(argv[i], "--spheres") == 0 && hasValue) spec.numSpheres = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--planes") == 0 && hasValue) spec.numPlanes = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--lights") == 0 && hasValue) spec.numLights = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--light-reach") == 0 && hasValue) spec.lightReach = atof(argv[++i]);
+      else if(strcmp(argv[i], "--shininess") == 0 && hasValue) spec.shininess = atof(argv[++i]);
+      else if(strcmp(argv[i], "--seed") == 0 && hasValue) spec.seed = strtoull(argv[++i], NULL, 10);
+      else if(strcmp(argv[i], "--distribution") == 0 && hasValue) {
+         spec.distribution = parseDistribution(argv[++i]);
+         if(spec.distribution < 0) usage(argv[0]);
+      }
+      else if(argv[i][0] != '-' && !path) path = argv[i];
+      else usage(argv[0]);
+   }
+
+   if(!path || spec.numSpheres < 0 || spec.numPlanes < 0 || spec.numLights < 0 || spec.lightReach < 0 || spec.shininess < 0) usage(argv[0]);
+
+   if(writeBenchScene(path, &spec) != 0) {
+      fprintf(stderr, "cannot write %s\n", path);
+      return 1;
+   }
+
+   printf("Wrote %s: %d spheres (%s), %d planes, %d lights\n", path, spec.numSpheres,
+          distributionName(spec.distribution), spec.numPlanes, spec.numLights);
+   return 0;
+}
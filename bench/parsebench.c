@@ -0,0 +1,104 @@
+/*
+Scene parser throughput benchmark.
+
+Writes a scene file of random spheres, planes and lights, then times loadSceneFile()
+on it and reports MB/s and objects/s. Usage:
+
+   ./parsebench [objects] [repeats] [scene file]
+
+The scene file is left behind so it can be fed to ./raycast as well.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "../raycast.h"
+#include "../scene.h"
+#include "../parser.h"
+
+
+static double now(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float randomFloat(float lo, float hi) {
+   return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static void writeScene(const char *path, int numObjects) {
+
+   FILE *fh = fopen(path, "w");
+   if(!fh) {
+      fprintf(stderr, "cannot write %s\n", path);
+      exit(1);
+   }
+
+   fprintf(fh, "camera, width: 2.0, height: 2.0\n");
+   for(int i = 1; i < numObjects; i++) {
+      if(i % 1000 == 0) {
+         fprintf(fh, "light, color: [2, 2, 2], theta: 0, radial-a2: 0.125, radial-a1: 0.125, radial-a0: 0.125, position: [%.3f, %.3f, %.3f]\n",
+                 randomFloat(-10, 10), randomFloat(0, 10), randomFloat(-20, 0));
+      }
+      else if(i % 100 == 0) {
+         fprintf(fh, "plane, normal: [0, 1, 0], diffuse_color: [%.2f, %.2f, %.2f], position: [0, %.3f, 0]\n",
+                 randomFloat(0, 1), randomFloat(0, 1), randomFloat(0, 1), randomFloat(-5, -1));
+      }
+      else {
+         fprintf(fh, "sphere, radius: %.4f, diffuse_color: [%.3f, %.3f, %.3f], specular_color: [1, 1, 1], position: [%.4f, %.4f, %.4f]\n",
+                 randomFloat(0.01, 0.5), randomFloat(0, 1), randomFloat(0, 1), randomFloat(0, 1),
+                 randomFloat(-20, 20), randomFloat(-20, 20), randomFloat(-60, -5));
+      }
+   }
+
+   fclose(fh);
+}
+
+int main(int argc, char **argv) {
+
+   int numObjects = argc > 1 ? atoi(argv[1]) : 1000000;
+   int repeats = argc > 2 ? atoi(argv[2]) : 5;
+   const char *path = argc > 3 ? argv[3] : "parsebench.csv";
+
+   if(numObjects < 1 || repeats < 1) {
+      fprintf(stderr, "usage: %s [objects] [repeats] [scene file]\n", argv[0]);
+      return 1;
+   }
+
+   srand(1);
+   writeScene(path, numObjects);
+
+   struct stat fileStat;
+   stat(path, &fileStat);
+   double megabytes = fileStat.st_size / (1024.0 * 1024.0);
+
+   double best = 0;
+   for(int run = 0; run < repeats; run++) {
+
+      SceneStore store;
+      ParseError error;
+
+      double start = now();
+      int status = loadSceneFile(path, &store, &error);
+      double elapsed = now() - start;
+
+      if(status != 0) {
+         fprintf(stderr, "%s:%d: %s\n", path, error.line, error.message);
+         return 1;
+      }
+      if(store.numObjects != numObjects) {
+         fprintf(stderr, "parsed %d objects, expected %d\n", store.numObjects, numObjects);
+         return 1;
+      }
+      releaseSceneStore(&store);
+
+      if(run == 0 || elapsed < best) best = elapsed;
+   }
+
+   printf("%s: %d objects, %.1f MB\n", path, numObjects, megabytes);
+   printf("best of %d: %.3f s, %.1f MB/s, %.0f objects/s\n", repeats, best, megabytes / best, numObjects / best);
+
+   return 0;
+}
@@ -0,0 +1,104 @@
+/*
+Progressive render check.
+
+Renders a scene of random spheres progressively, once with a time budget that the
+first, coarsest level alone uses up and once without a budget, and checks how many
+pixels each traced: one level must trace exactly one pixel per PROGRESSIVE_FIRST_STEP
+square, ceil(width / step) * ceil(height / step), and the whole render every pixel
+once. Usage:
+
+   ./progcheck [width] [height]
+
+Odd sizes by default, so the lattice doesn't fit the image; the image has to be large
+enough that its first level takes longer than the budget. Exits with status 1 if a
+count is off, so it doubles as a test of the progressive levels.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../raycast.h"
+#include "../output.h"
+#include "../packet.h"
+#include "../render.h"
+#include "../rclib.h"
+
+#define CHECK_PATH "progcheck.ppm"
+
+
+static float randomFloat(float lo, float hi) {
+   return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static char *makeScene(int numSpheres, size_t *size) {
+
+   size_t capacity = 256 + (size_t)numSpheres * 160;
+   char *data = malloc(capacity);
+   if(!data) return NULL;
+
+   size_t used = snprintf(data, capacity, "camera, width: 2.0, height: 2.0\n"
+                          "light, color: [2, 2, 2], theta: 0, radial-a2: 0.125, radial-a1: 0.125, radial-a0: 0.125, position: [0, 10, 0]\n"
+                          "plane, normal: [0, 1, 0], diffuse_color: [0.5, 0.5, 0.5], position: [0, -3, 0]\n");
+   for(int i = 0; i < numSpheres; i++) {
+      used += snprintf(data + used, capacity - used,
+                       "sphere, radius: %.4f, diffuse_color: [%.3f, %.3f, %.3f], position: [%.4f, %.4f, %.4f]\n",
+                       randomFloat(0.1, 1), randomFloat(0, 1), randomFloat(0, 1), randomFloat(0, 1),
+                       randomFloat(-10, 10), randomFloat(-5, 5), randomFloat(-30, -5));
+   }
+
+   *size = used;
+   return data;
+}
+
+// Renders with budgetMs and checks that it traced expected pixels; with scalar tracing every one is a single primary ray
+static int checkRender(rc_context *ctx, rc_scene *scene, int width, int height, int budgetMs, long long expected, const char *what) {
+
+   if(rc_render_progressive(ctx, scene, width, height, CHECK_PATH, FORMAT_P6, budgetMs, NULL) != RC_OK) {
+      fprintf(stderr, "%s: %s\n", what, rc_error_message(ctx));
+      return 1;
+   }
+
+   rc_stats stats;
+   rc_context_stats(ctx, &stats);
+   bool passed = stats.pixelsTraced == expected && stats.primaryRays == expected;
+   printf("%-12s %10lld pixels traced %10lld primary rays in %7.1f ms, expected %lld: %s\n", what, stats.pixelsTraced,
+          stats.primaryRays, stats.renderSeconds * 1000, expected, passed ? "ok" : "FAILED");
+   return passed ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+
+   int width = argc > 1 ? atoi(argv[1]) : 2001;
+   int height = argc > 2 ? atoi(argv[2]) : 1999;
+   if(width < 1 || height < 1) {
+      fprintf(stderr, "usage: %s [width] [height]\n", argv[0]);
+      return 1;
+   }
+
+   size_t size;
+   char *data = makeScene(2000, &size);
+   rc_context *ctx = rc_context_create();
+   if(!data || !ctx) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+
+   rc_scene *scene;
+   if(rc_scene_load_memory(ctx, data, size, "progcheck", &scene) != RC_OK) {
+      fprintf(stderr, "%s\n", rc_error_message(ctx));
+      return 1;
+   }
+   rc_context_set_simd(ctx, SIMD_SCALAR);
+
+   // The first level ignores the budget, which is checked once it's done
+   int step = PROGRESSIVE_FIRST_STEP;
+   long long firstLevel = (long long)((width + step - 1) / step) * ((height + step - 1) / step);
+   int failed = checkRender(ctx, scene, width, height, 1, firstLevel, "first level");
+   failed |= checkRender(ctx, scene, width, height, 0, (long long)width * height, "all levels");
+
+   remove(CHECK_PATH);
+   rc_scene_free(scene);
+   rc_context_free(ctx);
+   free(data);
+
+   return failed;
+}
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "scenegen.h"
+
+// Depth of the closest sphere layer; the camera's image plane sits at depth 1
+#define SCENE_NEAR 4.0
+// Sphere radius as a fraction of the average spacing between sphere centers
+#define SCENE_RADIUS 0.2
+
+static const char *distributionNames[] = {"uniform", "clustered", "grid"};
+
+
+// splitmix64, so a seed gives the same scene with any C library
+static uint64_t nextRandom(uint64_t *state) {
+   uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+   z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+   return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static double randomUnit(uint64_t *state) {
+   return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double randomRange(uint64_t *state, double lo, double hi) {
+   return lo + (hi - lo) * randomUnit(state);
+}
+
+// Standard normal, Box-Muller
+static double randomGaussian(uint64_t *state) {
+   double u = 1 - randomUnit(state);
+   double v = randomUnit(state);
+   return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+// Maps (u, v, w) in the unit cube into the frustum between depths near and far above floorY
+// Depth goes with the cube root of w, so evenly spread w gives evenly spread points
+static void frustumPoint(double u, double v, double w, double near, double far, double floorY, double *point) {
+   double depth = cbrt(near * near * near + w * (far * far * far - near * near * near));
+   double top = 0.75 * depth * 0.95;
+   point[0] = (2 * u - 1) * depth * 0.95;
+   point[1] = floorY + v * (top - floorY);
+   point[2] = -depth;
+}
+
+// Returns the distribution named name, or -1
+int parseDistribution(const char *name) {
+   for(int i = 0; i < (int)(sizeof(distributionNames) / sizeof(distributionNames[0])); i++) {
+      if(strcmp(name, distributionNames[i]) == 0) return i;
+   }
+   return -1;
+}
+
+const char *distributionName(int distribution) {
+   if(distribution < 0 || distribution > DIST_GRID) return "unknown";
+   return distributionNames[distribution];
+}
+
+// Writes the scene described by spec to path, returns 0 on success
+int writeBenchScene(const char *path, SceneSpec *spec) {
+
+   FILE *fh = fopen(path, "w");
+   if(!fh) return -1;
+
+   uint64_t state = spec->seed;
+   int numSpheres = spec->numSpheres;
+
+   double near = SCENE_NEAR;
+   double far = near + 8 + 2 * cbrt(numSpheres);
+   double spacing = cbrt((far * far * far - near * near * near) / (numSpheres > 0 ? numSpheres : 1));
+   double radius = SCENE_RADIUS * spacing;
+   double floorY = -(0.75 * near + 1);
+
+   fprintf(fh, "camera, width: 2.0, height: 1.5\n");
+
+   // Clustered scenes draw their cluster centers first
+   int numClusters = (int)cbrt(numSpheres);
+   if(numClusters < 1) numClusters = 1;
+   double (*clusters)[3] = NULL;
+   double sigma = 0.5 * spacing * cbrt((double)numSpheres / numClusters);
+   if(spec->distribution == DIST_CLUSTERED) {
+      clusters = malloc(sizeof(double[3]) * numClusters);
+      for(int i = 0; i < numClusters; i++) {
+         frustumPoint(randomUnit(&state), randomUnit(&state), randomUnit(&state), near, far, floorY + radius, clusters[i]);
+      }
+   }
+
+   int gridSide = (int)ceil(cbrt(numSpheres));
+
+   for(int i = 0; i < numSpheres; i++) {
+
+      double center[3];
+      double r = radius;
+
+      if(spec->distribution == DIST_GRID) {
+         double u = (i % gridSide + 0.5) / gridSide;
+         double v = (i / gridSide % gridSide + 0.5) / gridSide;
+         double w = (i / gridSide / gridSide + 0.5) / gridSide;
+         frustumPoint(u, v, w, near, far, floorY + r, center);
+      }
+      else if(spec->distribution == DIST_CLUSTERED) {
+         double *cluster = clusters[nextRandom(&state) % numClusters];
+         r *= randomRange(&state, 0.7, 1.3);
+         for(int axis = 0; axis < 3; axis++) {
+            center[axis] = cluster[axis] + sigma * randomGaussian(&state);
+         }
+      }
+      else {
+         r *= randomRange(&state, 0.7, 1.3);
+         frustumPoint(randomUnit(&state), randomUnit(&state), randomUnit(&state), near, far, floorY + r, center);
+      }
+
+      fprintf(fh, "sphere, radius: %.4f, diffuse_color: [%.3f, %.3f, %.3f], specular_color: [1, 1, 1], position: [%.4f, %.4f, %.4f]",
+              r, randomRange(&state, 0.2, 1), randomRange(&state, 0.2, 1), randomRange(&state, 0.2, 1),
+              center[0], center[1], center[2]);
+      if(spec->shininess > 0) fprintf(fh, ", shininess: %g", spec->shininess);
+      fputc('\n', fh);
+   }
+
+   // Back wall and floor are what the camera sees, the rest box the scene in behind them
+   for(int i = 0; i < spec->numPlanes; i++) {
+
+      double normal[3] = {0, 0, 1};
+      double position[3] = {0, 0, -(far + 2)};
+
+      if(i == 1) {
+         normal[1] = 1;
+         normal[2] = 0;
+         position[1] = floorY;
+         position[2] = 0;
+      }
+      else if(i == 2 || i == 3) {
+         normal[0] = i == 2 ? 1 : -1;
+         normal[2] = 0;
+         position[0] = i == 2 ? -(far + 2) : far + 2;
+         position[2] = 0;
+      }
+      else if(i == 4) {
+         normal[1] = -1;
+         normal[2] = 0;
+         position[1] = 0.75 * far + 2;
+         position[2] = 0;
+      }
+      else if(i > 4) {
+         normal[0] = randomRange(&state, -0.2, 0.2);
+         normal[1] = randomRange(&state, -0.2, 0.2);
+         position[2] = -(far + 2 + i);
+      }
+
+      double shade = randomRange(&state, 0.3, 0.7);
+      fprintf(fh, "plane, normal: [%.4f, %.4f, %.4f], diffuse_color: [%.3f, %.3f, %.3f], position: [%.4f, %.4f, %.4f]\n",
+              normal[0], normal[1], normal[2], shade, shade, shade, position[0], position[1], position[2]);
+   }
+
+   // Small lights attenuate to 1% at their reach, 1 + (a2 * reach)^2 = 100
+   if(spec->lightReach > 0) {
+      double a2 = sqrt(99) / spec->lightReach;
+      for(int i = 0; i < spec->numLights; i++) {
+         double position[3];
+         frustumPoint(randomUnit(&state), randomUnit(&state), randomUnit(&state), near, far, floorY, position);
+         fprintf(fh, "light, color: [%.4f, %.4f, %.4f], theta: 0, radial-a2: %.4f, radial-a1: 0, radial-a0: 1, position: [%.4f, %.4f, %.4f]\n",
+                 randomRange(&state, 0.3, 1), randomRange(&state, 0.3, 1), randomRange(&state, 0.3, 1), a2,
+                 position[0], position[1], position[2]);
+      }
+   }
+
+   // Brightness is split between the lights so the image exposure does not depend on their number
+   double brightness = 1.5 / sqrt(spec->numLights > 0 ? spec->numLights : 1);
+   for(int i = 0; i < spec->numLights && spec->lightReach <= 0; i++) {
+      fprintf(fh, "light, color: [%.4f, %.4f, %.4f], theta: 0, radial-a2: %.4f, radial-a1: 0, radial-a0: 1, position: [%.4f, %.4f, %.4f]\n",
+              brightness, brightness, brightness, 1 / far,
+              randomRange(&state, -0.5 * far, 0.5 * far),
+              randomRange(&state, 0.5, 0.7) * 0.75 * far,
+              -randomRange(&state, near, far));
+   }
+
+   free(clusters);
+
+   if(ferror(fh)) {
+      fclose(fh);
+      return -1;
+   }
+   return fclose(fh) == 0 ? 0 : -1;
+}
@@ -0,0 +1,34 @@
+#ifndef SCENEGEN_H
+#define SCENEGEN_H
+
+#include <stdint.h>
+
+// How the spheres are spread through the view frustum
+#define DIST_UNIFORM 0     // Independently at random with even density
+#define DIST_CLUSTERED 1   // Gaussian clumps around random centers, leaving empty space between them
+#define DIST_GRID 2        // A regular lattice
+
+/*
+Parameters of a synthetic benchmark scene. The camera sits at the origin looking down
+-z with a 4:3 view; spheres fill a frustum in front of it that deepens with their
+number so the density stays about the same, planes close the frustum off starting with
+the back wall and the floor, and the lights hang above the spheres. With a light reach
+the lights are small ones scattered among the spheres instead, each falling off to 1%
+of its brightness at that distance. A shininess gives the spheres highlights with that
+exponent. The same spec and seed always produce the same file.
+*/
+typedef struct SceneSpec {
+   int numSpheres;
+   int numPlanes;
+   int numLights;
+   int distribution;
+   uint64_t seed;
+   double lightReach;   // 0 for lights that reach across the whole scene
+   double shininess;    // 0 for spheres without highlights
+} SceneSpec;
+
+int parseDistribution(const char *name);
+const char *distributionName(int distribution);
+int writeBenchScene(const char *path, SceneSpec *spec);
+
+#endif
@@ -0,0 +1,254 @@
+/*
+Vector math accuracy check and micro benchmark.
+
+Measures how far v3math.h's lengths, normalizations, reflections and reciprocal
+square roots are from the same math done in double precision, in ulps, next to the
+v3math.c functions they replaced, checks that the float[3], SSE and plain C versions
+give identical results, then times each operation both ways. Usage:
+
+   ./v3bench [vectors] [repeats]
+
+Exits with status 1 if an error bound is exceeded or two versions disagree, so it
+doubles as a test of the header.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "../v3math.h"
+#include "v3ref.h"
+
+// Largest errors accepted, in ulps of the result (of the input's length for reflections)
+#define MAX_LENGTH_ULPS 2
+#define MAX_NORMALIZE_ULPS 3
+#define MAX_REFLECT_ULPS 8
+#define MAX_RSQRT_REFINED_ULPS 4
+
+
+static double now(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Random coordinate in (-1, 1) times a random power of ten, so lengths span several orders of magnitude
+static float randomCoordinate(void) {
+   float scale = powf(10, (rand() % 7) - 3);
+   return scale * (2 * (rand() / (float)RAND_MAX) - 1);
+}
+
+// Distance between two floats in representable steps
+static int64_t ulpDistance(float a, float b) {
+   int32_t ia, ib;
+   memcpy(&ia, &a, sizeof(ia));
+   memcpy(&ib, &b, sizeof(ib));
+   if(ia < 0) ia = INT32_MIN - ia;
+   if(ib < 0) ib = INT32_MIN - ib;
+   return llabs((int64_t)ia - ib);
+}
+
+// Error of result against exact in ulps of scale, which is exact itself when scale is exact
+static double errorUlps(float result, double exact, double scale) {
+   return fabs(result - exact) / (nextafterf((float)scale, INFINITY) - (float)scale);
+}
+
+static bool sameBits(float *a, float *b) {
+   return memcmp(a, b, sizeof(float) * 3) == 0;
+}
+
+typedef struct Accuracy {
+   const char *name;
+   double maxUlps;
+   double limit;     // 0 when only reported
+} Accuracy;
+
+static int failures = 0;
+
+static void reportAccuracy(Accuracy *accuracy) {
+   bool failed = accuracy->limit > 0 && accuracy->maxUlps > accuracy->limit;
+   printf("  %-34s max %10.2f ulps%s\n", accuracy->name, accuracy->maxUlps, failed ? "  FAILED" : "");
+   failures += failed;
+}
+
+static void reportMismatch(const char *name, int mismatches, int count) {
+   printf("  %-34s %d of %d differ%s\n", name, mismatches, count, mismatches ? "  FAILED" : "");
+   failures += mismatches > 0;
+}
+
+static void checkAccuracy(float (*vectors)[3], float (*normals)[3], int count) {
+
+   Accuracy oldLength = {"v3math.c v3_length", 0, 0};
+   Accuracy length = {"v3_length", 0, MAX_LENGTH_ULPS};
+   Accuracy oldNormalize = {"v3math.c v3_normalize", 0, 0};
+   Accuracy normalize = {"v3_normalize", 0, MAX_NORMALIZE_ULPS};
+   Accuracy normalizeFast[3] = {{"v3_normalize_fast, no Newton step", 0, 0},
+                                {"v3_normalize_fast, 1 Newton step", 0, MAX_NORMALIZE_ULPS + MAX_RSQRT_REFINED_ULPS},
+                                {"v3_normalize_fast, 2 Newton steps", 0, MAX_NORMALIZE_ULPS + MAX_RSQRT_REFINED_ULPS}};
+   Accuracy reflect = {"v3_reflect", 0, MAX_REFLECT_ULPS};
+   Accuracy rsqrt[3] = {{"v3_rsqrt_fast, no Newton step", 0, 0},
+                        {"v3_rsqrt_fast, 1 Newton step", 0, MAX_RSQRT_REFINED_ULPS},
+                        {"v3_rsqrt_fast, 2 Newton steps", 0, MAX_RSQRT_REFINED_ULPS}};
+   Accuracy plainRsqrt[3] = {{"plain C v3_rsqrt_fast, no step", 0, MAX_RSQRT_REFINED_ULPS},
+                             {"plain C v3_rsqrt_fast, 1 step", 0, MAX_RSQRT_REFINED_ULPS},
+                             {"plain C v3_rsqrt_fast, 2 steps", 0, MAX_RSQRT_REFINED_ULPS}};
+   int vecMismatches = 0, scalarMismatches = 0, reflectMismatches = 0;
+
+   for(int i = 0; i < count; i++) {
+
+      float *a = vectors[i];
+      float *n = normals[i];
+      double exactLength = sqrt((double)a[0] * a[0] + (double)a[1] * a[1] + (double)a[2] * a[2]);
+      double sum = exactLength * exactLength;
+
+      #define TRACK(accuracy, ulps) { double u = (ulps); if(u > (accuracy).maxUlps) (accuracy).maxUlps = u; }
+
+      TRACK(oldLength, ulpDistance(refLength(a), exactLength));
+      TRACK(length, ulpDistance(v3_length(a), exactLength));
+
+      float result[3], other[3];
+      refNormalize(result, a);
+      for(int axis = 0; axis < 3; axis++) TRACK(oldNormalize, ulpDistance(result[axis], a[axis] / exactLength));
+      v3_normalize(result, a);
+      for(int axis = 0; axis < 3; axis++) TRACK(normalize, ulpDistance(result[axis], a[axis] / exactLength));
+
+      vec3_store(other, vec3_normalize(vec3_load(a)));
+      vecMismatches += !sameBits(result, other);
+      scalarNormalize(other, a);
+      scalarMismatches += !sameBits(result, other);
+
+      for(int steps = 0; steps < 3; steps++) {
+         v3_normalize_fast(result, a, steps);
+         for(int axis = 0; axis < 3; axis++) TRACK(normalizeFast[steps], ulpDistance(result[axis], a[axis] / exactLength));
+         TRACK(rsqrt[steps], ulpDistance(v3_rsqrt_fast((float)sum, steps), 1 / sqrt((float)sum)));
+         TRACK(plainRsqrt[steps], ulpDistance(scalarRsqrt((float)sum, steps), 1 / sqrt((float)sum)));
+      }
+
+      // Components of a reflection can cancel to near 0, so its error is measured against the input's length
+      double twice = 2 * ((double)a[0] * n[0] + (double)a[1] * n[1] + (double)a[2] * n[2]);
+      v3_reflect(result, a, n);
+      for(int axis = 0; axis < 3; axis++) TRACK(reflect, errorUlps(result[axis], a[axis] - n[axis] * twice, exactLength));
+
+      vec3_store(other, vec3_reflect(vec3_load(a), vec3_load(n)));
+      vecMismatches += !sameBits(result, other);
+      scalarReflect(other, a, n);
+      scalarMismatches += !sameBits(result, other);
+      float copy[3] = {n[0], n[1], n[2]};
+      refReflect(other, a, copy);
+      reflectMismatches += !sameBits(result, other);
+
+      v3_cross_product(result, a, n);
+      vec3_store(other, vec3_cross(vec3_load(a), vec3_load(n)));
+      vecMismatches += !sameBits(result, other);
+      scalarCross(other, a, n);
+      scalarMismatches += !sameBits(result, other);
+
+      #undef TRACK
+   }
+
+   printf("Accuracy over %d vectors (SSE vec3: %s)\n", count, V3MATH_SIMD ? "yes" : "no");
+   reportAccuracy(&oldLength);
+   reportAccuracy(&length);
+   reportAccuracy(&oldNormalize);
+   reportAccuracy(&normalize);
+   for(int steps = 0; steps < 3; steps++) reportAccuracy(&normalizeFast[steps]);
+   reportAccuracy(&reflect);
+   for(int steps = 0; steps < 3; steps++) reportAccuracy(&rsqrt[steps]);
+   for(int steps = 0; steps < 3; steps++) reportAccuracy(&plainRsqrt[steps]);
+   reportMismatch("vec3 against v3_*", vecMismatches, count * 3);
+   reportMismatch("plain C vec3 against v3_*", scalarMismatches, count * 3);
+   reportMismatch("v3_reflect against v3math.c", reflectMismatches, count);
+}
+
+// Times body over every vector repeats times and prints nanoseconds per vector
+#define TIME(name, ...) { \
+   double start = now(); \
+   for(int rep = 0; rep < repeats; rep++) { \
+      for(int i = 0; i < count; i++) { \
+         float *a = vectors[i]; \
+         float *n = normals[i]; \
+         (void)n; \
+         __VA_ARGS__ \
+      } \
+   } \
+   printf("  %-34s %8.2f ns\n", name, (now() - start) * 1e9 / ((double)repeats * count)); \
+}
+
+static void timeOperations(float (*vectors)[3], float (*normals)[3], int count, int repeats) {
+
+   volatile float sink = 0;
+   float total = 0;
+
+   printf("Time per vector, %d vectors x %d\n", count, repeats);
+
+   TIME("v3math.c v3_length", total += refLength(a);)
+   TIME("v3_length", total += v3_length(a);)
+   TIME("vec3_length", total += vec3_length(vec3_load(a));)
+
+   TIME("v3math.c v3_normalize", float r[3]; refNormalize(r, a); total += r[0];)
+   TIME("v3_normalize", float r[3]; v3_normalize(r, a); total += r[0];)
+   TIME("vec3_normalize", total += V3_LANE(vec3_normalize(vec3_load(a)), 0);)
+   TIME("v3_normalize_fast, 1 Newton step", float r[3]; v3_normalize_fast(r, a, 1); total += r[0];)
+   TIME("vec3_normalize_fast, 1 Newton step", total += V3_LANE(vec3_normalize_fast(vec3_load(a), 1), 0);)
+
+   TIME("v3math.c v3_reflect", float copy[3] = {n[0], n[1], n[2]}; float r[3]; refReflect(r, a, copy); total += r[0];)
+   TIME("v3_reflect", float r[3]; v3_reflect(r, a, n); total += r[0];)
+   TIME("vec3_reflect", total += V3_LANE(vec3_reflect(vec3_load(a), vec3_load(n)), 0);)
+
+   // What illuminate() does per light: direction and distance to the light, N.L, and R.V
+   TIME("v3math.c light vector", \
+        float L[3]; refSubtract(L, n, a); float distance = refLength(L); refNormalize(L, L); \
+        float nDotL = refDotProduct(n, L); float copy[3] = {n[0], n[1], n[2]}; float R[3]; refReflect(R, L, copy); \
+        total += distance + nDotL + refDotProduct(a, R);)
+   TIME("v3_* light vector", \
+        float L[3]; v3_subtract(L, n, a); float distance = v3_normalize_length(L, L); \
+        float nDotL = v3_dot_product(n, L); float R[3]; v3_reflect(R, L, n); \
+        total += distance + nDotL + v3_dot_product(a, R);)
+   TIME("vec3 light vector", \
+        vec3 point = vec3_load(a); vec3 normal = vec3_load(n); float distance; \
+        vec3 L = vec3_normalize_length(vec3_sub(normal, point), &distance); \
+        total += distance + vec3_dot(normal, L) + vec3_dot(point, vec3_reflect(L, normal));)
+
+   sink = total;
+   (void)sink;
+}
+
+int main(int argc, char **argv) {
+
+   int count = argc > 1 ? atoi(argv[1]) : 4096;
+   int repeats = argc > 2 ? atoi(argv[2]) : 20000;
+
+   if(count < 1 || repeats < 1) {
+      fprintf(stderr, "usage: %s [vectors] [repeats]\n", argv[0]);
+      return 1;
+   }
+
+   float (*vectors)[3] = malloc(sizeof(float[3]) * count);
+   float (*normals)[3] = malloc(sizeof(float[3]) * count);
+
+   srand(1);
+   for(int i = 0; i < count; i++) {
+      do {
+         for(int axis = 0; axis < 3; axis++) vectors[i][axis] = randomCoordinate();
+      } while(v3_length(vectors[i]) == 0);
+      float normal[3];
+      do {
+         for(int axis = 0; axis < 3; axis++) normal[axis] = 2 * (rand() / (float)RAND_MAX) - 1;
+      } while(v3_length(normal) < 0.01f);
+      v3_normalize(normals[i], normal);
+   }
+
+   checkAccuracy(vectors, normals, count);
+   timeOperations(vectors, normals, count, repeats);
+
+   free(vectors);
+   free(normals);
+
+   if(failures) {
+      printf("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+      return 1;
+   }
+   return 0;
+}
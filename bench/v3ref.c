@@ -0,0 +1,70 @@
+/*
+Reference side of v3bench, compiled on its own with -DV3MATH_SCALAR.
+
+Holds the out of line v3math.c functions the header replaced, kept as they were
+(minus the debug printing) so the benchmark can time and check against them, and
+wrappers around the plain C vec3 functions so they can be compared bit for bit with
+the SSE ones v3bench.c is compiled with.
+*/
+
+#include <math.h>
+#include "../v3math.h"
+#include "v3ref.h"
+
+#if V3MATH_SIMD
+#error "bench/v3ref.c has to be compiled with -DV3MATH_SCALAR"
+#endif
+
+
+float refDotProduct(float *a, float *b) {
+   float product = (a[0] * b[0]) + (a[1] * b[1]) + (a[2] * b[2]);
+   return product;
+}
+
+float refLength(float *a) {
+   float length = sqrt(pow(a[0], 2) + pow(a[1], 2) + pow(a[2], 2));
+   return length;
+}
+
+void refNormalize(float *dst, float *a) {
+   float length = refLength(a);
+   dst[0] = a[0] / length;
+   dst[1] = a[1] / length;
+   dst[2] = a[2] / length;
+}
+
+void refScale(float *dst, float s) {
+   dst[0] = dst[0] * s;
+   dst[1] = dst[1] * s;
+   dst[2] = dst[2] * s;
+}
+
+void refSubtract(float *dst, float *a, float *b) {
+   dst[0] = a[0] - b[0];
+   dst[1] = a[1] - b[1];
+   dst[2] = a[2] - b[2];
+}
+
+// Scales n in place, which is why callers used to hand it a copy
+void refReflect(float *dst, float *v, float *n) {
+   float temp = 2 * refDotProduct(v, n);
+   float *temp2 = n;
+   refScale(temp2, temp);
+   refSubtract(dst, v, temp2);
+}
+
+void scalarNormalize(float *dst, float *a) {
+   vec3_store(dst, vec3_normalize(vec3_load(a)));
+}
+
+void scalarReflect(float *dst, float *v, float *n) {
+   vec3_store(dst, vec3_reflect(vec3_load(v), vec3_load(n)));
+}
+
+void scalarCross(float *dst, float *a, float *b) {
+   vec3_store(dst, vec3_cross(vec3_load(a), vec3_load(b)));
+}
+
+float scalarRsqrt(float x, int newtonSteps) {
+   return v3_rsqrt_fast(x, newtonSteps);
+}
@@ -0,0 +1,18 @@
+#ifndef V3REF_H
+#define V3REF_H
+
+// The former out of line v3math.c functions
+float refDotProduct(float *a, float *b);
+float refLength(float *a);
+void refNormalize(float *dst, float *a);
+void refScale(float *dst, float s);
+void refSubtract(float *dst, float *a, float *b);
+void refReflect(float *dst, float *v, float *n);
+
+// The vec3 functions built without SSE
+void scalarNormalize(float *dst, float *a);
+void scalarReflect(float *dst, float *v, float *n);
+void scalarCross(float *dst, float *a, float *b);
+float scalarRsqrt(float x, int newtonSteps);
+
+#endif
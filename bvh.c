@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include "bvh.h"
+
+
+// Per sphere data only needed while building
+typedef struct BuildState {
+   float (*centroids)[3];
+   float (*boundsMin)[3];
+   float (*boundsMax)[3];
+} BuildState;
+
+typedef struct Bin {
+   float boundsMin[3];
+   float boundsMax[3];
+   int count;
+} Bin;
+
+
+static void resetBounds(float *boundsMin, float *boundsMax) {
+   for(int axis = 0; axis < 3; axis++) {
+      boundsMin[axis] = INFINITY;
+      boundsMax[axis] = -INFINITY;
+   }
+}
+
+static void growBounds(float *boundsMin, float *boundsMax, float *pointMin, float *pointMax) {
+   for(int axis = 0; axis < 3; axis++) {
+      if(pointMin[axis] < boundsMin[axis]) boundsMin[axis] = pointMin[axis];
+      if(pointMax[axis] > boundsMax[axis]) boundsMax[axis] = pointMax[axis];
+   }
+}
+
+// Half the surface area of a box, the constant factor does not matter to SAH comparisons
+static float halfArea(float *boundsMin, float *boundsMax) {
+   float dx = boundsMax[0] - boundsMin[0];
+   float dy = boundsMax[1] - boundsMin[1];
+   float dz = boundsMax[2] - boundsMin[2];
+   if(dx < 0 || dy < 0 || dz < 0) return 0;
+   return dx * dy + dy * dz + dz * dx;
+}
+
+static int binIndex(float centroid, float centroidMin, float binScale) {
+   int bin = (int)((centroid - centroidMin) * binScale);
+   if(bin < 0) bin = 0;
+   if(bin > BVH_BINS - 1) bin = BVH_BINS - 1;
+   return bin;
+}
+
+static void makeLeaf(BVHNode *node, int start, int count) {
+   node->start = start;
+   node->count = count;
+}
+
+// Splits primIndices[start .. start + count) under nodeInd using a binned surface area heuristic
+static void subdivide(BVH *bvh, BuildState *state, int nodeInd, int start, int count, int depth) {
+
+   BVHNode *node = &bvh->nodes[nodeInd];
+   int *prims = &bvh->primIndices[start];
+
+   float centroidMin[3], centroidMax[3];
+   resetBounds(node->boundsMin, node->boundsMax);
+   resetBounds(centroidMin, centroidMax);
+   for(int i = 0; i < count; i++) {
+      growBounds(node->boundsMin, node->boundsMax, state->boundsMin[prims[i]], state->boundsMax[prims[i]]);
+      growBounds(centroidMin, centroidMax, state->centroids[prims[i]], state->centroids[prims[i]]);
+   }
+
+   if(count <= BVH_LEAF_SIZE || depth >= BVH_MAX_DEPTH) {
+      makeLeaf(node, start, count);
+      return;
+   }
+
+   // Find the cheapest bin boundary over all three axes
+   float bestCost = INFINITY;
+   int bestAxis = -1;
+   int bestSplit = 0;
+
+   for(int axis = 0; axis < 3; axis++) {
+
+      float extent = centroidMax[axis] - centroidMin[axis];
+      if(extent <= 0) continue;
+
+      float binScale = BVH_BINS / extent;
+      Bin bins[BVH_BINS];
+      for(int b = 0; b < BVH_BINS; b++) {
+         resetBounds(bins[b].boundsMin, bins[b].boundsMax);
+         bins[b].count = 0;
+      }
+
+      for(int i = 0; i < count; i++) {
+         Bin *bin = &bins[binIndex(state->centroids[prims[i]][axis], centroidMin[axis], binScale)];
+         growBounds(bin->boundsMin, bin->boundsMax, state->boundsMin[prims[i]], state->boundsMax[prims[i]]);
+         bin->count += 1;
+      }
+
+      // Sweep from the right to get the cost of every right hand side, then from the left
+      float rightArea[BVH_BINS];
+      int rightCount[BVH_BINS];
+      float sweepMin[3], sweepMax[3];
+      int sweepCount = 0;
+
+      resetBounds(sweepMin, sweepMax);
+      for(int b = BVH_BINS - 1; b > 0; b--) {
+         growBounds(sweepMin, sweepMax, bins[b].boundsMin, bins[b].boundsMax);
+         sweepCount += bins[b].count;
+         rightArea[b] = halfArea(sweepMin, sweepMax);
+         rightCount[b] = sweepCount;
+      }
+
+      resetBounds(sweepMin, sweepMax);
+      sweepCount = 0;
+      for(int b = 0; b < BVH_BINS - 1; b++) {
+         growBounds(sweepMin, sweepMax, bins[b].boundsMin, bins[b].boundsMax);
+         sweepCount += bins[b].count;
+         if(sweepCount == 0 || rightCount[b + 1] == 0) continue;
+
+         float cost = halfArea(sweepMin, sweepMax) * sweepCount + rightArea[b + 1] * rightCount[b + 1];
+         if(cost < bestCost) {
+            bestCost = cost;
+            bestAxis = axis;
+            bestSplit = b;
+         }
+      }
+   }
+
+   // Every centroid coincides, nothing left to split on
+   if(bestAxis < 0) {
+      makeLeaf(node, start, count);
+      return;
+   }
+
+   // Splitting has to beat intersecting every sphere in this node
+   if(bestCost >= halfArea(node->boundsMin, node->boundsMax) * count && count <= 4 * BVH_LEAF_SIZE) {
+      makeLeaf(node, start, count);
+      return;
+   }
+
+   // Partition the spheres in place around the chosen bin boundary
+   float binScale = BVH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+   int left = 0;
+   int right = count - 1;
+   while(left <= right) {
+      if(binIndex(state->centroids[prims[left]][bestAxis], centroidMin[bestAxis], binScale) <= bestSplit) {
+         left++;
+      }
+      else {
+         int swap = prims[left];
+         prims[left] = prims[right];
+         prims[right] = swap;
+         right--;
+      }
+   }
+
+   int leftChild = bvh->numNodes;
+   bvh->numNodes += 2;
+   node->start = leftChild;
+   node->count = 0;
+
+   subdivide(bvh, state, leftChild, start, left, depth + 1);
+   subdivide(bvh, state, leftChild + 1, start + left, count - left, depth + 1);
+}
+
+// Builds the hierarchy over count spheres; primIndices receives the order the leaves reference them in
+// Returns 0 on success and -1 when out of memory, leaving what was allocated to freeBVH()
+int buildBVH(BVH *bvh, float (*centers)[3], float *radii, int count) {
+
+   bvh->numPrims = count;
+   bvh->numNodes = 0;
+   bvh->primIndices = malloc(sizeof(int) * (count + 1));
+
+   // A binary tree with n leaves holding at least one sphere each has at most 2n - 1 nodes
+   bvh->nodes = malloc(sizeof(BVHNode) * (2 * count + 1));
+
+   if(!bvh->primIndices || !bvh->nodes) {
+      bvh->numPrims = 0;
+      return -1;
+   }
+   if(count == 0) {
+      return 0;
+   }
+
+   BuildState state;
+   state.centroids = centers;
+   state.boundsMin = malloc(sizeof(float[3]) * count);
+   state.boundsMax = malloc(sizeof(float[3]) * count);
+   if(!state.boundsMin || !state.boundsMax) {
+      free(state.boundsMin);
+      free(state.boundsMax);
+      bvh->numPrims = 0;
+      return -1;
+   }
+
+   for(int i = 0; i < count; i++) {
+      float radius = fabsf(radii[i]);
+      for(int axis = 0; axis < 3; axis++) {
+         state.boundsMin[i][axis] = centers[i][axis] - radius;
+         state.boundsMax[i][axis] = centers[i][axis] + radius;
+      }
+      bvh->primIndices[i] = i;
+   }
+
+   bvh->numNodes = 1;
+   subdivide(bvh, &state, 0, 0, count, 0);
+
+   free(state.boundsMin);
+   free(state.boundsMax);
+
+   return 0;
+}
+
+// Recomputes every node's bounds for spheres that moved since the build, keeping the tree's shape
+// centers and radii are in the order buildBVH() was given them; the tree gets looser the further
+// the spheres travel from where they were built, but it stays correct
+void refitBVH(BVH *bvh, float (*centers)[3], float *radii) {
+
+   // Children always come after their parent, so walking backwards finishes them first
+   for(int nodeInd = bvh->numNodes - 1; nodeInd >= 0; nodeInd--) {
+
+      BVHNode *node = &bvh->nodes[nodeInd];
+      resetBounds(node->boundsMin, node->boundsMax);
+
+      if(node->count == 0) {
+         growBounds(node->boundsMin, node->boundsMax, bvh->nodes[node->start].boundsMin, bvh->nodes[node->start].boundsMax);
+         growBounds(node->boundsMin, node->boundsMax, bvh->nodes[node->start + 1].boundsMin, bvh->nodes[node->start + 1].boundsMax);
+         continue;
+      }
+
+      for(int prim = node->start; prim < node->start + node->count; prim++) {
+         int sphere = bvh->primIndices[prim];
+         float radius = fabsf(radii[sphere]);
+         float sphereMin[3], sphereMax[3];
+         for(int axis = 0; axis < 3; axis++) {
+            sphereMin[axis] = centers[sphere][axis] - radius;
+            sphereMax[axis] = centers[sphere][axis] + radius;
+         }
+         growBounds(node->boundsMin, node->boundsMax, sphereMin, sphereMax);
+      }
+   }
+}
+
+void freeBVH(BVH *bvh) {
+   free(bvh->nodes);
+   free(bvh->primIndices);
+   bvh->nodes = NULL;
+   bvh->primIndices = NULL;
+   bvh->numNodes = 0;
+   bvh->numPrims = 0;
+}
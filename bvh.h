@@ -0,0 +1,39 @@
+#ifndef BVH_H
+#define BVH_H
+
+// Number of centroid bins the SAH builder evaluates per split
+#define BVH_BINS 16
+// Nodes holding this many spheres or fewer are never split
+#define BVH_LEAF_SIZE 4
+// Past this depth nodes become leaves no matter their size, which bounds the traversal stack
+#define BVH_MAX_DEPTH 64
+
+/*
+Inner nodes store the index of their left child in start (the right child always
+follows it) and a count of 0. Leaves cover entries start .. start + count - 1 of
+primIndices, the order buildBVH() left the spheres in.
+*/
+typedef struct BVHNode {
+   float boundsMin[3];
+   float boundsMax[3];
+   int start;
+   int count;
+} BVHNode;
+
+/*
+Bounding volume hierarchy over a set of spheres. primIndices maps leaf order back to
+the order the spheres were handed to buildBVH(); callers that lay their spheres out
+in leaf order can then walk a leaf's spheres contiguously.
+*/
+typedef struct BVH {
+   BVHNode *nodes;
+   int numNodes;
+   int *primIndices;
+   int numPrims;
+} BVH;
+
+int buildBVH(BVH *bvh, float (*centers)[3], float *radii, int count);
+void refitBVH(BVH *bvh, float (*centers)[3], float *radii);
+void freeBVH(BVH *bvh);
+
+#endif
@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "output.h"
+#include "stats.h"
+#include "rclib.h"
+#include "message.h"
+#include "cluster.h"
+
+// Message types
+#define MSG_HELLO 1
+#define MSG_SCENE 2
+#define MSG_TILE 3
+#define MSG_PIXELS 4
+#define MSG_ERROR 5
+#define MSG_DONE 6
+
+// Words before the scene text or pixels in SCENE and PIXELS
+#define SCENE_WORDS 6
+#define TILE_WORDS 3
+
+#define TILE_PENDING 0
+#define TILE_ASSIGNED 1
+#define TILE_DONE 2
+
+// A band of rows and who is rendering it
+typedef struct ClusterTile {
+   int y0;
+   int y1;
+   int state;      // TILE_*
+   int attempts;
+   int peer;       // Index of the worker it is assigned to
+   double sent;    // When the worker could start on it
+} ClusterTile;
+
+// A connected worker; fd is -1 once it is gone
+typedef struct Peer {
+   int fd;
+   bool ready;     // Sent the scene, so it can take tiles
+   int inFlight;
+} Peer;
+
+
+// Puts the tiles a worker held back in the queue and closes its connection
+static void dropPeer(ClusterJob *job, Peer *peers, int peerInd, ClusterTile *tiles, int *nextPending) {
+
+   for(int tileInd = 0; tileInd < job->numTiles; tileInd++) {
+      if(tiles[tileInd].state == TILE_ASSIGNED && tiles[tileInd].peer == peerInd) {
+         tiles[tileInd].state = TILE_PENDING;
+         job->tilesRetried += 1;
+         if(tileInd < *nextPending) *nextPending = tileInd;
+      }
+   }
+
+   close(peers[peerInd].fd);
+   peers[peerInd].fd = -1;
+   peers[peerInd].ready = false;
+   peers[peerInd].inFlight = 0;
+   job->workersFailed += 1;
+}
+
+// Handles one message from a worker; returns 0 when it was fine, 1 when the worker must be dropped,
+// and -1 when the render can't go on
+static int handleMessage(ClusterJob *job, Peer *peers, int peerInd, Message *msg, ClusterTile *tiles, OutputImage *output,
+                         const char *sceneText, size_t sceneSize, int *done) {
+
+   Peer *peer = &peers[peerInd];
+
+   if(msg->type == MSG_HELLO) {
+      if(msg->length < sizeof(uint32_t) || messageWord(msg, 0) != CLUSTER_PROTOCOL_VERSION || peer->ready) return 1;
+
+      uint32_t words[SCENE_WORDS] = {job->width, job->height, job->aaSamples, floatBits(job->aaThreshold),
+                                     floatBits(job->lightEpsilon), job->batchShadows ? CLUSTER_BATCH_SHADOWS : 0};
+      if(sendMessage(peer->fd, MSG_SCENE, words, SCENE_WORDS, sceneText, sceneSize) != 0) return 1;
+      peer->ready = true;
+      job->workersJoined += 1;
+      return 0;
+   }
+
+   if(msg->type == MSG_ERROR) {
+      int length = msg->length < sizeof(job->error) - 9 ? (int)msg->length : (int)sizeof(job->error) - 9;
+      setError(job->error, sizeof(job->error), "worker: %.*s", length, (char *)msg->data);
+      return -1;
+   }
+
+   if(msg->type != MSG_PIXELS || msg->length < TILE_WORDS * sizeof(uint32_t)) return 1;
+
+   uint32_t tileInd = messageWord(msg, 0);
+   if(tileInd >= (uint32_t)job->numTiles) return 1;
+
+   ClusterTile *tile = &tiles[tileInd];
+   size_t rowBytes = (size_t)job->width * 3;
+   if(tile->state != TILE_ASSIGNED || tile->peer != peerInd || messageWord(msg, 1) != (uint32_t)tile->y0 || \
+      messageWord(msg, 2) != (uint32_t)tile->y1 || msg->length != TILE_WORDS * sizeof(uint32_t) + rowBytes * (tile->y1 - tile->y0)) {
+      return 1;
+   }
+
+   uint8_t *rgb = msg->data + TILE_WORDS * sizeof(uint32_t);
+   for(int imgY = tile->y0; imgY < tile->y1; imgY++) {
+      storeOutputPixels(output, 0, imgY, rgb + (imgY - tile->y0) * rowBytes, job->width);
+   }
+   tile->state = TILE_DONE;
+   *done += 1;
+   peer->inFlight -= 1;
+
+   // The worker starts on its next queued tile now
+   double now = monotonicSeconds();
+   for(int other = 0; other < job->numTiles; other++) {
+      if(tiles[other].state == TILE_ASSIGNED && tiles[other].peer == peerInd) tiles[other].sent = now;
+   }
+   return 0;
+}
+
+// Forks the local workers, each connecting back to job->address; returns how many started
+static int forkWorkers(ClusterJob *job, int listenFd, pid_t *pids) {
+
+   int started = 0;
+
+   for(int worker = 0; worker < job->localWorkers; worker++) {
+      pid_t pid = fork();
+      if(pid < 0) break;
+      if(pid == 0) {
+         char error[256];
+         close(listenFd);
+         int status = runWorker(job->address, job->workerThreads, job->simdMode, error, sizeof(error));
+         if(status != 0) fprintf(stderr, "worker %d: %s\n", worker, error);
+         _exit(status != 0);
+      }
+      pids[started++] = pid;
+   }
+
+   return started;
+}
+
+/*
+Renders job->scenePath into job->outputPath through the workers that connect to
+job->address, forking job->localWorkers of them first. Returns 0 once every tile is
+stored, or -1 with the reason in job->error.
+*/
+int coordinateRender(ClusterJob *job) {
+
+   double start = monotonicSeconds();
+
+   job->numTiles = (job->height + job->tileRows - 1) / job->tileRows;
+   job->tilesRetried = 0;
+   job->workersJoined = 0;
+   job->workersFailed = 0;
+   job->error[0] = '\0';
+
+   char *sceneText;
+   size_t sceneSize;
+   if(readWholeFile(job->scenePath, &sceneText, &sceneSize) != 0) {
+      return setError(job->error, sizeof(job->error), "cannot read %s", job->scenePath);
+   }
+   if(sceneSize > MAX_MESSAGE - SCENE_WORDS * sizeof(uint32_t)) {
+      free(sceneText);
+      return setError(job->error, sizeof(job->error), "%s is too large to send to workers", job->scenePath);
+   }
+
+   int listenFd = openSocket(job->address, true, job->error, sizeof(job->error));
+   if(listenFd < 0) {
+      free(sceneText);
+      return -1;
+   }
+
+   OutputImage output;
+   if(openOutputImage(&output, job->outputPath, job->format, job->width, job->height) != 0) {
+      close(listenFd);
+      free(sceneText);
+      return setError(job->error, sizeof(job->error), "cannot create %s", job->outputPath);
+   }
+
+   // Allocated before forking, so failing here leaves no workers to stop
+   pid_t *pids = malloc(sizeof(pid_t) * (job->localWorkers + 1));
+   ClusterTile *tiles = calloc(job->numTiles, sizeof(ClusterTile));
+   if(!pids || !tiles) {
+      free(pids);
+      free(tiles);
+      close(listenFd);
+      if(strncmp(job->address, "unix:", 5) == 0) unlink(job->address + 5);
+      closeOutputImage(&output);
+      free(sceneText);
+      return setError(job->error, sizeof(job->error), "out of memory");
+   }
+   int numPids = forkWorkers(job, listenFd, pids);
+
+   for(int tileInd = 0; tileInd < job->numTiles; tileInd++) {
+      tiles[tileInd].y0 = tileInd * job->tileRows;
+      tiles[tileInd].y1 = tiles[tileInd].y0 + job->tileRows < job->height ? tiles[tileInd].y0 + job->tileRows : job->height;
+      tiles[tileInd].state = TILE_PENDING;
+   }
+
+   Peer *peers = NULL;
+   int numPeers = 0;
+   struct pollfd *fds = NULL;
+   int *fdPeer = NULL;
+   Message msg = {0, 0, NULL, 0};
+   int done = 0;
+   int nextPending = 0;   // No pending tile comes before this one
+   int status = 0;
+   double lastProgress = monotonicSeconds();
+
+   while(done < job->numTiles && status == 0) {
+
+      // Hand out tiles, lowest first, to every worker with room in its queue
+      for(int peerInd = 0; peerInd < numPeers; peerInd++) {
+         Peer *peer = &peers[peerInd];
+         while(peer->ready && peer->inFlight < CLUSTER_TILES_IN_FLIGHT) {
+            while(nextPending < job->numTiles && tiles[nextPending].state != TILE_PENDING) nextPending++;
+            if(nextPending == job->numTiles) break;
+
+            ClusterTile *tile = &tiles[nextPending];
+            if(tile->attempts == CLUSTER_MAX_ATTEMPTS) {
+               status = setError(job->error, sizeof(job->error), "rows %d to %d failed on %d workers", tile->y0, tile->y1, tile->attempts);
+               break;
+            }
+
+            uint32_t words[TILE_WORDS] = {nextPending, tile->y0, tile->y1};
+            if(sendMessage(peer->fd, MSG_TILE, words, TILE_WORDS, NULL, 0) != 0) {
+               dropPeer(job, peers, peerInd, tiles, &nextPending);
+               break;
+            }
+            tile->state = TILE_ASSIGNED;
+            tile->peer = peerInd;
+            tile->attempts += 1;
+            tile->sent = peer->inFlight == 0 ? monotonicSeconds() : INFINITY;
+            peer->inFlight += 1;
+         }
+      }
+      if(status != 0) break;
+
+      // Wait for a new worker or a message from a connected one; the old arrays are kept if growing fails
+      struct pollfd *grownFds = realloc(fds, sizeof(struct pollfd) * (numPeers + 1));
+      if(grownFds) fds = grownFds;
+      int *grownFdPeer = realloc(fdPeer, sizeof(int) * (numPeers + 1));
+      if(grownFdPeer) fdPeer = grownFdPeer;
+      if(!grownFds || !grownFdPeer) {
+         status = setError(job->error, sizeof(job->error), "out of memory");
+         break;
+      }
+      int numFds = 0;
+      fds[numFds].fd = listenFd;
+      fds[numFds++].events = POLLIN;
+      int connected = 0;
+      for(int peerInd = 0; peerInd < numPeers; peerInd++) {
+         if(peers[peerInd].fd < 0) continue;
+         fdPeer[numFds] = peerInd;
+         fds[numFds].fd = peers[peerInd].fd;
+         fds[numFds++].events = POLLIN;
+         connected += 1;
+      }
+
+      if(poll(fds, numFds, 1000) < 0 && errno != EINTR) {
+         status = setError(job->error, sizeof(job->error), "poll failed: %s", strerror(errno));
+         break;
+      }
+
+      if(fds[0].revents & POLLIN) {
+         int fd = accept(listenFd, NULL, NULL);
+         if(fd >= 0) {
+            // A worker that stops halfway through a message is given up on after the tile timeout
+            struct timeval timeout = {job->timeoutSeconds, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            Peer *grownPeers = realloc(peers, sizeof(Peer) * (numPeers + 1));
+            if(!grownPeers) {
+               close(fd);
+               status = setError(job->error, sizeof(job->error), "out of memory");
+               break;
+            }
+            peers = grownPeers;
+            peers[numPeers++] = (Peer){fd, false, 0};
+            lastProgress = monotonicSeconds();
+         }
+      }
+
+      for(int fdInd = 1; fdInd < numFds && status == 0; fdInd++) {
+         if(!(fds[fdInd].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+         int peerInd = fdPeer[fdInd];
+         int result = receiveMessage(peers[peerInd].fd, &msg) != 0 ? 1 : \
+                      handleMessage(job, peers, peerInd, &msg, tiles, &output, sceneText, sceneSize, &done);
+         if(result < 0) status = -1;
+         else if(result > 0) dropPeer(job, peers, peerInd, tiles, &nextPending);
+         else lastProgress = monotonicSeconds();
+      }
+
+      // Workers stuck on a tile are dropped, which frees the tile for the others
+      double now = monotonicSeconds();
+      for(int tileInd = 0; tileInd < job->numTiles; tileInd++) {
+         ClusterTile *tile = &tiles[tileInd];
+         if(tile->state == TILE_ASSIGNED && now - tile->sent > job->timeoutSeconds) {
+            dropPeer(job, peers, tile->peer, tiles, &nextPending);
+         }
+      }
+
+      if(connected == 0 && now - lastProgress > job->timeoutSeconds && status == 0) {
+         status = setError(job->error, sizeof(job->error), "no worker connected to %s for %d seconds", job->address, job->timeoutSeconds);
+      }
+   }
+
+   // Workers exit once told there is nothing left; on failure they see the connection close
+   for(int peerInd = 0; peerInd < numPeers; peerInd++) {
+      if(peers[peerInd].fd < 0) continue;
+      if(status == 0) sendMessage(peers[peerInd].fd, MSG_DONE, NULL, 0, NULL, 0);
+      close(peers[peerInd].fd);
+   }
+   close(listenFd);
+   if(strncmp(job->address, "unix:", 5) == 0) unlink(job->address + 5);
+
+   for(int pidInd = 0; pidInd < numPids; pidInd++) {
+      if(status != 0) kill(pids[pidInd], SIGTERM);
+      waitpid(pids[pidInd], NULL, 0);
+   }
+
+   if(closeOutputImage(&output) != 0 && status == 0) {
+      status = setError(job->error, sizeof(job->error), "cannot write %s", job->outputPath);
+   }
+
+   free(msg.data);
+   free(fds);
+   free(fdPeer);
+   free(peers);
+   free(tiles);
+   free(pids);
+   free(sceneText);
+
+   job->seconds = monotonicSeconds() - start;
+   return status;
+}
+
+// Connects to the coordinator at address, retrying while it starts up
+static int connectToCoordinator(const char *address, char *error, size_t errorSize) {
+
+   double deadline = monotonicSeconds() + CLUSTER_CONNECT_SECONDS;
+
+   for(;;) {
+      int fd = openSocket(address, false, error, errorSize);
+      if(fd >= 0 || monotonicSeconds() > deadline) return fd;
+      usleep(100000);
+   }
+}
+
+// Tells the coordinator why the worker gives up, and returns -1 with the same reason in error
+static int reportFailure(int fd, const char *reason, char *error, size_t errorSize) {
+   sendMessage(fd, MSG_ERROR, NULL, 0, reason, strlen(reason));
+   return setError(error, errorSize, "%s", reason);
+}
+
+/*
+Connects to the coordinator at address and renders the tiles it hands out with
+numThreads threads each, until it says it is done. Returns 0 then, or -1 with the
+reason in error when the scene can't be rendered or the coordinator goes away.
+*/
+int runWorker(const char *address, int numThreads, int simdMode, char *error, size_t errorSize) {
+
+   int fd = connectToCoordinator(address, error, errorSize);
+   if(fd < 0) return -1;
+
+   uint32_t version = CLUSTER_PROTOCOL_VERSION;
+   Message msg = {0, 0, NULL, 0};
+   if(sendMessage(fd, MSG_HELLO, &version, 1, NULL, 0) != 0 || receiveMessage(fd, &msg) != 0 || \
+      msg.type != MSG_SCENE || msg.length < SCENE_WORDS * sizeof(uint32_t)) {
+      free(msg.data);
+      close(fd);
+      return setError(error, errorSize, "no scene from %s", address);
+   }
+
+   int width = messageWord(&msg, 0);
+   int height = messageWord(&msg, 1);
+   int aaSamples = messageWord(&msg, 2);
+   float aaThreshold = bitsFloat(messageWord(&msg, 3));
+   float lightEpsilon = bitsFloat(messageWord(&msg, 4));
+   uint32_t flags = messageWord(&msg, 5);
+
+   rc_context *ctx = rc_context_create();
+   rc_scene *scene = NULL;
+   int status = 0;
+
+   if(!ctx) {
+      status = reportFailure(fd, "out of memory", error, errorSize);
+   }
+   else {
+      rc_context_set_threads(ctx, numThreads);
+      rc_context_set_simd(ctx, simdMode);
+      rc_context_set_batch_shadows(ctx, (flags & CLUSTER_BATCH_SHADOWS) != 0);
+      if(rc_context_set_aa(ctx, aaSamples, aaThreshold) != RC_OK || \
+         rc_scene_load_memory(ctx, (char *)msg.data + SCENE_WORDS * sizeof(uint32_t), msg.length - SCENE_WORDS * sizeof(uint32_t), "scene", &scene) != RC_OK || \
+         rc_scene_set_light_epsilon(ctx, scene, lightEpsilon) != RC_OK) {
+         status = reportFailure(fd, rc_error_message(ctx), error, errorSize);
+      }
+   }
+
+   // Room for a tile's words and pixels, sent as one message
+   uint8_t *reply = NULL;
+   size_t replySize = 0;
+
+   while(status == 0) {
+
+      if(receiveMessage(fd, &msg) != 0) {
+         status = setError(error, errorSize, "lost the coordinator at %s", address);
+         break;
+      }
+      if(msg.type == MSG_DONE) break;
+      if(msg.type != MSG_TILE || msg.length < TILE_WORDS * sizeof(uint32_t)) {
+         status = setError(error, errorSize, "unexpected message %u from %s", msg.type, address);
+         break;
+      }
+
+      uint32_t words[TILE_WORDS] = {messageWord(&msg, 0), messageWord(&msg, 1), messageWord(&msg, 2)};
+      int y0 = words[1];
+      int y1 = words[2];
+      size_t pixelBytes = (size_t)width * 3 * (y1 > y0 ? y1 - y0 : 0);
+      if(pixelBytes > replySize) {
+         free(reply);
+         reply = malloc(pixelBytes);
+         replySize = reply ? pixelBytes : 0;
+      }
+
+      rc_framebuffer framebuffer = {reply, width, y1 - y0, 0};
+      if(!reply) {
+         status = reportFailure(fd, "out of memory", error, errorSize);
+      }
+      else if(rc_render_rows(ctx, scene, width, height, y0, y1, &framebuffer) != RC_OK) {
+         status = reportFailure(fd, rc_error_message(ctx), error, errorSize);
+      }
+      else if(sendMessage(fd, MSG_PIXELS, words, TILE_WORDS, reply, pixelBytes) != 0) {
+         status = setError(error, errorSize, "lost the coordinator at %s", address);
+      }
+   }
+
+   free(reply);
+   free(msg.data);
+   rc_scene_free(scene);
+   rc_context_free(ctx);
+   close(fd);
+   return status;
+}
@@ -0,0 +1,69 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+Rendering one frame across several processes. A coordinator listens on an address,
+"unix:PATH" or "HOST:PORT" over TCP, and worker processes, on the same machine or
+others, connect to it. Each worker is sent the scene file's text and the render
+settings once, then tile jobs: bands of tileRows full rows, which it renders
+through rclib and sends back as packed RGB. The coordinator stores every band into
+the output file as it arrives, so the image is the same as a single process render.
+
+A worker that disconnects, sends something malformed or holds a tile past the
+timeout is dropped and its tiles go back in the queue for the others; a tile that
+fails CLUSTER_MAX_ATTEMPTS times fails the render. Workers may join at any time.
+
+Every message is a type and a payload length, then the payload, all as big endian
+32 bit words apart from scene text and pixels, so workers on other hosts need not
+share the coordinator's byte order:
+- HELLO     worker:      protocol version
+- SCENE     coordinator: width, height, AA samples, AA threshold and light epsilon as
+                         float bits, CLUSTER_BATCH_SHADOWS flag, then the scene file
+- TILE      coordinator: tile id, first row, end row
+- PIXELS    worker:      tile id, first row, end row, then the rows' RGB bytes
+- ERROR     worker:      why it can't render the scene, which fails the render
+- DONE      coordinator: no more tiles, the worker exits
+*/
+#define CLUSTER_PROTOCOL_VERSION 1
+#define CLUSTER_DEFAULT_TILE_ROWS 32
+#define CLUSTER_DEFAULT_TIMEOUT 60     // Seconds a worker may hold a tile
+#define CLUSTER_MAX_ATTEMPTS 3         // Times a tile is handed out before the render fails
+#define CLUSTER_TILES_IN_FLIGHT 2      // Tiles queued at each worker, so it never waits on a round trip
+#define CLUSTER_CONNECT_SECONDS 10     // How long a worker keeps trying to reach the coordinator
+
+// SCENE flags
+#define CLUSTER_BATCH_SHADOWS 1
+
+// One distributed render, with what happened to it filled in by coordinateRender()
+typedef struct ClusterJob {
+   const char *address;
+   const char *scenePath;
+   const char *outputPath;
+   int format;            // FORMAT_P6 or FORMAT_P3
+   int width;
+   int height;
+   int tileRows;
+   int aaSamples;
+   float aaThreshold;
+   float lightEpsilon;
+   bool batchShadows;
+   int timeoutSeconds;
+   int localWorkers;      // Worker processes forked on this machine, 0 to rely on remote ones
+   int workerThreads;     // Render threads of each local worker
+   int simdMode;          // SIMD_* mode of each local worker
+   // Results
+   int numTiles;
+   int tilesRetried;
+   int workersJoined;
+   int workersFailed;
+   double seconds;
+   char error[256];
+} ClusterJob;
+
+int coordinateRender(ClusterJob *job);
+int runWorker(const char *address, int numThreads, int simdMode, char *error, size_t errorSize);
+
+#endif
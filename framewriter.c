@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "output.h"
+#include "framewriter.h"
+
+
+// Whether pattern holds exactly one %d conversion (optionally zero padded, e.g. %04d) and no other %
+bool validFramePattern(const char *pattern) {
+
+   int conversions = 0;
+
+   for(const char *c = pattern; *c; c++) {
+      if(*c != '%') continue;
+
+      c++;
+      if(*c == '0') c++;
+      while(*c >= '0' && *c <= '9') c++;
+      if(*c != 'd') return false;
+      conversions += 1;
+   }
+
+   return conversions == 1;
+}
+
+// Encodes one frame into its PPM file a band of rows at a time; returns 0 on success and -1 on failure
+static int writeFrame(FrameWriter *writer, uint8_t *rgb, int frame) {
+
+   char path[4096];
+   OutputImage out;
+
+   snprintf(path, sizeof(path), writer->pattern, frame);
+   if(openOutputStream(&out, path, writer->format, writer->imgWidth, writer->imgHeight, FRAME_WRITE_ROWS) != 0) {
+      return -1;
+   }
+
+   int status = 0;
+   for(int y0 = 0; y0 < writer->imgHeight && status == 0; y0 += FRAME_WRITE_ROWS) {
+      int y1 = y0 + FRAME_WRITE_ROWS < writer->imgHeight ? y0 + FRAME_WRITE_ROWS : writer->imgHeight;
+      for(int imgY = y0; imgY < y1; imgY++) {
+         storeOutputPixels(&out, 0, imgY, rgb + (size_t)imgY * writer->imgWidth * 3, writer->imgWidth);
+      }
+      status = flushOutputBand(&out, y1 - y0);
+   }
+
+   if(closeOutputImage(&out) != 0) status = -1;
+
+   return status;
+}
+
+static void *writerMain(void *arg) {
+
+   FrameWriter *writer = arg;
+
+   pthread_mutex_lock(&writer->lock);
+   for(;;) {
+      int slot = writer->nextWrite;
+
+      while(writer->bufferFrame[slot] < 0 && !writer->closing) {
+         pthread_cond_wait(&writer->changed, &writer->lock);
+      }
+      if(writer->bufferFrame[slot] < 0) break;
+
+      // After a failure frames are still taken off the renderer's hands, just not written
+      int frame = writer->bufferFrame[slot];
+      bool write = writer->status == 0;
+      pthread_mutex_unlock(&writer->lock);
+
+      int status = write ? writeFrame(writer, writer->buffers[slot], frame) : 0;
+
+      pthread_mutex_lock(&writer->lock);
+      if(status != 0) writer->status = -1;
+      writer->bufferFrame[slot] = -1;
+      writer->nextWrite = (slot + 1) % FRAME_BUFFERS;
+      pthread_cond_broadcast(&writer->changed);
+   }
+   pthread_mutex_unlock(&writer->lock);
+
+   return NULL;
+}
+
+// Allocates the frame buffers and starts the writer thread; frames go to pattern with %d replaced by the frame number
+// Returns 0 on success and -1 if the buffers or thread can't be set up
+int startFrameWriter(FrameWriter *writer, const char *pattern, int format, int imgWidth, int imgHeight) {
+
+   writer->pattern = pattern;
+   writer->format = format;
+   writer->imgWidth = imgWidth;
+   writer->imgHeight = imgHeight;
+   writer->nextWrite = 0;
+   writer->closing = false;
+   writer->status = 0;
+
+   for(int slot = 0; slot < FRAME_BUFFERS; slot++) {
+      writer->buffers[slot] = malloc((size_t)imgWidth * imgHeight * 3);
+      writer->bufferFrame[slot] = -1;
+      if(!writer->buffers[slot]) {
+         for(int i = 0; i < slot; i++) free(writer->buffers[i]);
+         return -1;
+      }
+   }
+
+   pthread_mutex_init(&writer->lock, NULL);
+   pthread_cond_init(&writer->changed, NULL);
+
+   if(pthread_create(&writer->thread, NULL, writerMain, writer) != 0) {
+      pthread_mutex_destroy(&writer->lock);
+      pthread_cond_destroy(&writer->changed);
+      for(int slot = 0; slot < FRAME_BUFFERS; slot++) free(writer->buffers[slot]);
+      return -1;
+   }
+
+   return 0;
+}
+
+// Waits for buffer slot to be written out and returns it for the next frame, or NULL once writing has failed
+// Slots must be used in turn: frame k goes into slot k % FRAME_BUFFERS
+uint8_t *nextFrameBuffer(FrameWriter *writer, int slot) {
+
+   pthread_mutex_lock(&writer->lock);
+   while(writer->bufferFrame[slot] >= 0 && writer->status == 0) {
+      pthread_cond_wait(&writer->changed, &writer->lock);
+   }
+   bool failed = writer->status != 0;
+   pthread_mutex_unlock(&writer->lock);
+
+   return failed ? NULL : writer->buffers[slot];
+}
+
+// Hands a rendered frame in slot over to the writer thread
+void submitFrame(FrameWriter *writer, int slot, int frame) {
+   pthread_mutex_lock(&writer->lock);
+   writer->bufferFrame[slot] = frame;
+   pthread_cond_broadcast(&writer->changed);
+   pthread_mutex_unlock(&writer->lock);
+}
+
+// Waits for every submitted frame to be written, then stops the thread and frees the buffers
+// Returns 0 when all frames were written and -1 otherwise
+int finishFrameWriter(FrameWriter *writer) {
+
+   pthread_mutex_lock(&writer->lock);
+   writer->closing = true;
+   pthread_cond_broadcast(&writer->changed);
+   pthread_mutex_unlock(&writer->lock);
+
+   pthread_join(writer->thread, NULL);
+
+   pthread_mutex_destroy(&writer->lock);
+   pthread_cond_destroy(&writer->changed);
+   for(int slot = 0; slot < FRAME_BUFFERS; slot++) free(writer->buffers[slot]);
+
+   return writer->status;
+}
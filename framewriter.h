@@ -0,0 +1,40 @@
+#ifndef FRAMEWRITER_H
+#define FRAMEWRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Frames in flight: one being rendered while the one before it is written out
+#define FRAME_BUFFERS 2
+// Rows encoded per write when a frame goes out to its file
+#define FRAME_WRITE_ROWS 64
+
+/*
+Writes the frames of a sequence to disk on a thread of its own. The renderer fills
+the buffers in turn and hands each one over with submitFrame(); the writer thread
+encodes it into the frame's PPM file and gives the buffer back, so writing frame k
+overlaps rendering frame k + 1 and the buffers are reused for the whole sequence.
+*/
+typedef struct FrameWriter {
+   pthread_mutex_t lock;
+   pthread_cond_t changed;
+   pthread_t thread;
+   const char *pattern;               // Output path with one %d for the frame number
+   int format;
+   int imgWidth;
+   int imgHeight;
+   uint8_t *buffers[FRAME_BUFFERS];   // Packed RGB frames
+   int bufferFrame[FRAME_BUFFERS];    // Frame waiting to be written from each buffer, -1 when free
+   int nextWrite;                     // Buffer the writer thread takes next
+   bool closing;
+   int status;                        // -1 once a frame could not be written
+} FrameWriter;
+
+bool validFramePattern(const char *pattern);
+int startFrameWriter(FrameWriter *writer, const char *pattern, int format, int imgWidth, int imgHeight);
+uint8_t *nextFrameBuffer(FrameWriter *writer, int slot);
+void submitFrame(FrameWriter *writer, int slot, int frame);
+int finishFrameWriter(FrameWriter *writer);
+
+#endif
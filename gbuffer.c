@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "scene.h"
+#include "scenecache.h"
+#include "gbuffer.h"
+
+static const char gbufferMagic[8] = "RCGBUF";
+
+
+// Folds the hash of size more bytes into hash
+static uint64_t mixHash(uint64_t hash, const void *data, size_t size) {
+   return (hash * 0x9e3779b97f4a7c15ULL) ^ hashBytes(data, size);
+}
+
+// Hashes the view of a width x height render of scene and the parts of scene it shows, each on its own
+void hashSceneParts(CompiledScene *scene, float camWidth, float camHeight, float *camPosition, int width, int height, SceneHashes *hashes) {
+
+   float camera[5] = {camWidth, camHeight, camPosition[0], camPosition[1], camPosition[2]};
+   int size[2] = {width, height};
+   hashes->view = mixHash(hashBytes((uint8_t *)camera, sizeof(camera)), size, sizeof(size));
+
+   // Counts first, so moving a primitive from one kind to the other changes the hash
+   int counts[2] = {scene->numSpheres, scene->numPlanes};
+   size_t sphereBytes = sizeof(float) * scene->numSpheres;
+   size_t planeBytes = sizeof(float) * scene->numPlanes;
+   uint64_t geometry = hashBytes((uint8_t *)counts, sizeof(counts));
+   geometry = mixHash(geometry, scene->sphereX, sphereBytes);
+   geometry = mixHash(geometry, scene->sphereY, sphereBytes);
+   geometry = mixHash(geometry, scene->sphereZ, sphereBytes);
+   geometry = mixHash(geometry, scene->sphereRadius2, sphereBytes);
+   geometry = mixHash(geometry, scene->planeNX, planeBytes);
+   geometry = mixHash(geometry, scene->planeNY, planeBytes);
+   geometry = mixHash(geometry, scene->planeNZ, planeBytes);
+   geometry = mixHash(geometry, scene->planeOffset, planeBytes);
+   hashes->geometry = geometry;
+
+   hashes->materials = hashBytes((uint8_t *)scene->materials, sizeof(Material) * scene->numPrims);
+   hashes->lights = mixHash(scene->numLights, scene->lights, sizeof(Light) * scene->numLights);
+}
+
+// Maps the G-buffer file at path for a width x height render of the scene with the given hashes, creating it if needed
+// A complete file recorded for the same view and geometry is replayed, anything else is started over
+// Returns 0 on success and -1 if the file can't be set up
+int openGBuffer(GBuffer *gbuffer, const char *path, SceneHashes *hashes, int width, int height) {
+
+   size_t headerSize = (sizeof(GBufferHeader) + GBUFFER_ALIGN - 1) & ~(size_t)(GBUFFER_ALIGN - 1);
+
+   gbuffer->width = width;
+   gbuffer->height = height;
+   gbuffer->replay = false;
+   gbuffer->changes = GBUFFER_USED;
+   gbuffer->mapSize = headerSize + sizeof(GBufferSample) * width * height;
+
+   int fd = open(path, O_RDWR | O_CREAT, 0644);
+   if(fd < 0) return -1;
+
+   GBufferHeader header;
+   struct stat fileStat;
+   bool usable = fstat(fd, &fileStat) == 0 && pread(fd, &header, sizeof(header), 0) == sizeof(header) && \
+                 memcmp(header.magic, gbufferMagic, sizeof(header.magic)) == 0 && header.version == GBUFFER_VERSION && \
+                 header.sampleSize == sizeof(GBufferSample) && header.complete && header.width > 0 && header.height > 0 && \
+                 (uint64_t)fileStat.st_size == headerSize + sizeof(GBufferSample) * header.width * header.height;
+
+   // Shading reads the materials and lights from the scene, so only the view and the geometry have to match
+   if(usable) {
+      if(header.width != width || header.height != height || header.hashes.view != hashes->view) gbuffer->changes |= GBUFFER_VIEW_CHANGED;
+      if(header.hashes.geometry != hashes->geometry) gbuffer->changes |= GBUFFER_GEOMETRY_CHANGED;
+      if(header.hashes.materials != hashes->materials) gbuffer->changes |= GBUFFER_MATERIALS_CHANGED;
+      if(header.hashes.lights != hashes->lights) gbuffer->changes |= GBUFFER_LIGHTS_CHANGED;
+      gbuffer->replay = !(gbuffer->changes & (GBUFFER_VIEW_CHANGED | GBUFFER_GEOMETRY_CHANGED));
+   }
+
+   if(gbuffer->replay) {
+      gbuffer->changes |= GBUFFER_REUSED;
+   }
+   else {
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, gbufferMagic, sizeof(header.magic));
+      header.version = GBUFFER_VERSION;
+      header.sampleSize = sizeof(GBufferSample);
+      header.width = width;
+      header.height = height;
+      if(ftruncate(fd, gbuffer->mapSize) != 0) {
+         close(fd);
+         return -1;
+      }
+   }
+
+   gbuffer->map = mmap(NULL, gbuffer->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if(gbuffer->map == MAP_FAILED) {
+      gbuffer->map = NULL;
+      return -1;
+   }
+
+   // From here on the file describes this render's scene, which a replay's samples still fit
+   header.hashes = *hashes;
+   memcpy(gbuffer->map, &header, sizeof(header));
+   gbuffer->samples = (GBufferSample *)(gbuffer->map + headerSize);
+
+   return 0;
+}
+
+// Unmaps the file, marking a recorded one complete when every sample was written
+// Returns 0 on success and -1 if it could not be written out
+int closeGBuffer(GBuffer *gbuffer, bool complete) {
+
+   if(!gbuffer->map) return 0;
+
+   if(!gbuffer->replay && complete) {
+      ((GBufferHeader *)gbuffer->map)->complete = 1;
+   }
+
+   int status = munmap(gbuffer->map, gbuffer->mapSize);
+   gbuffer->map = NULL;
+   gbuffer->samples = NULL;
+
+   return status == 0 ? 0 : -1;
+}
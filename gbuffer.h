@@ -0,0 +1,76 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "scene.h"
+
+// Bumped whenever the layout of the file or of a sample changes
+#define GBUFFER_VERSION 1
+// Samples start on a cache line boundary after the header
+#define GBUFFER_ALIGN 64
+
+// What openGBuffer() found, for rc_stats.gbuffer
+#define GBUFFER_USED 1                 // A G-buffer file was given
+#define GBUFFER_REUSED 2               // Primary visibility came from it, only shading ran
+#define GBUFFER_VIEW_CHANGED 4         // Camera or image size differ from the recorded ones
+#define GBUFFER_GEOMETRY_CHANGED 8
+#define GBUFFER_MATERIALS_CHANGED 16
+#define GBUFFER_LIGHTS_CHANGED 32
+
+/*
+What the primary ray through the center of one pixel found. t is 0 when it hit
+nothing, and the rest is then unused.
+*/
+typedef struct GBufferSample {
+   int32_t hitObject;   // Primitive id, as shoot() reports it
+   float t;
+   float point[3];
+   float normal[3];     // Unit length
+} GBufferSample;
+
+// Hashes of the parts of a scene a G-buffer depends on, compared part by part
+typedef struct SceneHashes {
+   uint64_t view;        // Camera and image size
+   uint64_t geometry;    // Sphere and plane arrays, primitive order included
+   uint64_t materials;
+   uint64_t lights;
+} SceneHashes;
+
+/*
+Start of a G-buffer file, followed by width x height samples row by row from the
+top. The layout is the host's native one. complete is only set once every sample
+has been written, so a render that fails halfway leaves a file that is ignored.
+*/
+typedef struct GBufferHeader {
+   char magic[8];
+   uint32_t version;
+   uint32_t sampleSize;
+   int32_t width;
+   int32_t height;
+   uint32_t complete;
+   uint32_t padding;
+   SceneHashes hashes;
+} GBufferHeader;
+
+/*
+A G-buffer file mapped for one render. When replay is set the samples hold the
+visibility of this exact view and geometry and the render only shades them;
+otherwise the render fills them in as it traces.
+*/
+typedef struct GBuffer {
+   GBufferSample *samples;
+   int width;
+   int height;
+   bool replay;
+   int changes;          // GBUFFER_* flags
+   uint8_t *map;
+   size_t mapSize;
+} GBuffer;
+
+void hashSceneParts(CompiledScene *scene, float camWidth, float camHeight, float *camPosition, int width, int height, SceneHashes *hashes);
+int openGBuffer(GBuffer *gbuffer, const char *path, SceneHashes *hashes, int width, int height);
+int closeGBuffer(GBuffer *gbuffer, bool complete);
+
+#endif
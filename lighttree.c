@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include "bvh.h"
+#include "scene.h"
+#include "lighttree.h"
+
+// Gathered lists up to this long are put in order by insertion, longer ones by qsort()
+#define LIGHT_INSERTION_SORT 32
+
+
+// Distance past which light adds at most epsilon to a channel of a surface reflecting at most reflectance of it
+// Returns INFINITY for lights that reach everywhere, and 0 for lights that never add more than epsilon
+float lightInfluenceRadius(Light *light, float epsilon, float reflectance) {
+
+   if(epsilon <= 0) return INFINITY;
+
+   double brightest = 0;
+   for(int channel = 0; channel < 3; channel++) {
+      if(fabs(light->color[channel]) > brightest) brightest = fabs(light->color[channel]);
+   }
+   brightest *= reflectance;
+   if(brightest == 0) return 0;
+
+   // Only attenuation that grows with distance can be bounded
+   double a0 = light->radialA0;
+   double a1 = light->radialA1;
+   double a2 = light->radialA2;
+   if(a0 < 0 || a1 < 0 || a2 < 0) return INFINITY;
+
+   // Solve a0 + a1 * d + (a2 * d)^2 = brightest / epsilon for the distance d
+   double limit = brightest / epsilon;
+   if(a0 >= limit) return 0;
+
+   double a = a2 * a2;
+   double c = a0 - limit;
+   if(a > 0) return (-a1 + sqrt(a1 * a1 - 4 * a * c)) / (2 * a);
+   if(a1 > 0) return -c / a1;
+   return INFINITY;
+}
+
+// (Re)builds tree over the numLights lights for the given epsilon, 0 turning culling off, and the
+// most a surface of the scene reflects of a channel, CompiledScene.reflectance
+// Returns 0 on success; out of memory it returns -1, leaving an empty tree that culls nothing
+int buildLightTree(LightTree *tree, Light *lights, int numLights, float epsilon, float reflectance) {
+
+   freeLightTree(tree);
+   tree->epsilon = epsilon > 0 ? epsilon : 0;
+   tree->numLights = numLights;
+   if(tree->epsilon == 0) return 0;
+
+   tree->unbounded = malloc(sizeof(int) * (numLights + 1));
+   int *boundedLight = malloc(sizeof(int) * (numLights + 1));
+   float (*centers)[3] = malloc(sizeof(float[3]) * (numLights + 1));
+   float *radii = malloc(sizeof(float) * (numLights + 1));
+   int numBounded = 0;
+   if(!tree->unbounded || !boundedLight || !centers || !radii) {
+      free(boundedLight);
+      free(centers);
+      free(radii);
+      freeLightTree(tree);
+      return -1;
+   }
+
+   for(int lightNum = 0; lightNum < numLights; lightNum++) {
+      float radius = lightInfluenceRadius(&lights[lightNum], tree->epsilon, reflectance);
+      if(radius == INFINITY) {
+         tree->unbounded[tree->numUnbounded++] = lightNum;
+      }
+      else if(radius > 0) {
+         boundedLight[numBounded] = lightNum;
+         for(int axis = 0; axis < 3; axis++) centers[numBounded][axis] = lights[lightNum].position[axis];
+         radii[numBounded] = radius;
+         numBounded += 1;
+      }
+   }
+
+   int built = buildBVH(&tree->bvh, centers, radii, numBounded);
+
+   // Lay the lights out in leaf order so a leaf's lights are tested from contiguous arrays
+   tree->leafLight = malloc(sizeof(int) * (numBounded + 1));
+   tree->leafX = malloc(sizeof(float) * (numBounded + 1));
+   tree->leafY = malloc(sizeof(float) * (numBounded + 1));
+   tree->leafZ = malloc(sizeof(float) * (numBounded + 1));
+   tree->leafRadius2 = malloc(sizeof(float) * (numBounded + 1));
+   if(built != 0 || !tree->leafLight || !tree->leafX || !tree->leafY || !tree->leafZ || !tree->leafRadius2) {
+      free(boundedLight);
+      free(centers);
+      free(radii);
+      freeLightTree(tree);
+      return -1;
+   }
+
+   for(int entry = 0; entry < numBounded; entry++) {
+      int source = tree->bvh.primIndices[entry];
+      tree->leafLight[entry] = boundedLight[source];
+      tree->leafX[entry] = centers[source][0];
+      tree->leafY[entry] = centers[source][1];
+      tree->leafZ[entry] = centers[source][2];
+      tree->leafRadius2[entry] = radii[source] * radii[source];
+   }
+
+   free(boundedLight);
+   free(centers);
+   free(radii);
+
+   return 0;
+}
+
+static int compareLights(const void *a, const void *b) {
+   return *(const int *)a - *(const int *)b;
+}
+
+// Whether point lies inside node's bounds
+static bool containsPoint(BVHNode *node, float *point) {
+   return point[0] >= node->boundsMin[0] && point[0] <= node->boundsMax[0] && \
+          point[1] >= node->boundsMin[1] && point[1] <= node->boundsMax[1] && \
+          point[2] >= node->boundsMin[2] && point[2] <= node->boundsMax[2];
+}
+
+// Stores the index of every light whose influence reaches point into gathered, which has room for all
+// of them, in file order so they add up in the same order as without culling; returns how many there are
+int gatherLights(LightTree *tree, float *point, int *gathered) {
+
+   int count = 0;
+
+   for(int i = 0; i < tree->numUnbounded; i++) {
+      gathered[count++] = tree->unbounded[i];
+   }
+
+   BVH *bvh = &tree->bvh;
+   if(bvh->numPrims > 0) {
+
+      int stack[BVH_MAX_DEPTH * 2 + 2];
+      int stackSize = 0;
+      stack[stackSize++] = 0;
+
+      while(stackSize > 0) {
+
+         BVHNode *node = &bvh->nodes[stack[--stackSize]];
+         if(!containsPoint(node, point)) continue;
+
+         if(node->count == 0) {
+            stack[stackSize++] = node->start;
+            stack[stackSize++] = node->start + 1;
+            continue;
+         }
+
+         for(int entry = node->start; entry < node->start + node->count; entry++) {
+            float dx = point[0] - tree->leafX[entry];
+            float dy = point[1] - tree->leafY[entry];
+            float dz = point[2] - tree->leafZ[entry];
+            if(dx * dx + dy * dy + dz * dz < tree->leafRadius2[entry]) gathered[count++] = tree->leafLight[entry];
+         }
+      }
+   }
+
+   if(count > LIGHT_INSERTION_SORT) {
+      qsort(gathered, count, sizeof(int), compareLights);
+   }
+   else {
+      for(int i = 1; i < count; i++) {
+         int light = gathered[i];
+         int j = i;
+         for(; j > 0 && gathered[j - 1] > light; j--) gathered[j] = gathered[j - 1];
+         gathered[j] = light;
+      }
+   }
+
+   return count;
+}
+
+void freeLightTree(LightTree *tree) {
+   freeBVH(&tree->bvh);
+   free(tree->leafLight);
+   free(tree->leafX);
+   free(tree->leafY);
+   free(tree->leafZ);
+   free(tree->leafRadius2);
+   free(tree->unbounded);
+   tree->leafLight = NULL;
+   tree->leafX = NULL;
+   tree->leafY = NULL;
+   tree->leafZ = NULL;
+   tree->leafRadius2 = NULL;
+   tree->unbounded = NULL;
+   tree->numUnbounded = 0;
+   tree->epsilon = 0;
+}
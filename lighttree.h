@@ -0,0 +1,35 @@
+#ifndef LIGHTTREE_H
+#define LIGHTTREE_H
+
+#include "bvh.h"
+
+struct Light;
+
+/*
+Lights sorted by reach. With an epsilon above 0 every light gets an influence radius,
+the distance past which its radial attenuation keeps what it adds to a channel of a
+surface (reflecting at most the scene's reflectance of it) at or below epsilon. The
+lights with a finite radius go into a BVH over the spheres they reach, laid out in
+leaf order, so a shading point only visits the leaves around it; lights that reach
+everywhere are always gathered, and lights that reach nowhere never are. With epsilon
+0 nothing is culled and the tree stays empty.
+*/
+typedef struct LightTree {
+   float epsilon;
+   int numLights;     // Of the scene the tree was built for
+   BVH bvh;           // Over the bounded lights
+   int *leafLight;    // Light index of each BVH leaf entry
+   float *leafX;      // Position and squared radius of each leaf entry
+   float *leafY;
+   float *leafZ;
+   float *leafRadius2;
+   int *unbounded;    // Lights every point gathers, in file order
+   int numUnbounded;
+} LightTree;
+
+float lightInfluenceRadius(struct Light *light, float epsilon, float reflectance);
+int buildLightTree(LightTree *tree, struct Light *lights, int numLights, float epsilon, float reflectance);
+int gatherLights(LightTree *tree, float *point, int *gathered);
+void freeLightTree(LightTree *tree);
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "message.h"
+
+
+// Formats the reason for a failure into error and returns -1
+int setError(char *error, size_t errorSize, const char *format, ...) {
+   va_list args;
+   va_start(args, format);
+   vsnprintf(error, errorSize, format, args);
+   va_end(args);
+   return -1;
+}
+
+// Sends all of data, retrying on short writes; a closed connection is an error rather than SIGPIPE
+int sendAll(int fd, const void *data, size_t size) {
+
+   const uint8_t *pos = data;
+
+   while(size > 0) {
+      ssize_t sent = send(fd, pos, size, MSG_NOSIGNAL);
+      if(sent < 0 && errno == EINTR) continue;
+      if(sent <= 0) return -1;
+      pos += sent;
+      size -= sent;
+   }
+   return 0;
+}
+
+// Reads exactly size bytes; fails on end of file, an error or the socket's receive timeout
+int receiveAll(int fd, void *data, size_t size) {
+
+   uint8_t *pos = data;
+
+   while(size > 0) {
+      ssize_t received = recv(fd, pos, size, 0);
+      if(received < 0 && errno == EINTR) continue;
+      if(received <= 0) return -1;
+      pos += received;
+      size -= received;
+   }
+   return 0;
+}
+
+// Sends a message of numWords big endian words followed by size bytes of body
+int sendMessage(int fd, uint32_t type, const uint32_t *words, int numWords, const void *body, size_t size) {
+
+   uint32_t header[MESSAGE_HEADER_WORDS + MESSAGE_MAX_WORDS];
+   header[0] = htonl(type);
+   header[1] = htonl((uint32_t)(numWords * sizeof(uint32_t) + size));
+   for(int word = 0; word < numWords; word++) {
+      header[MESSAGE_HEADER_WORDS + word] = htonl(words[word]);
+   }
+
+   if(sendAll(fd, header, (MESSAGE_HEADER_WORDS + numWords) * sizeof(uint32_t)) != 0) return -1;
+   if(size > 0 && sendAll(fd, body, size) != 0) return -1;
+   return 0;
+}
+
+// Receives the next message into msg, growing its buffer as needed
+int receiveMessage(int fd, Message *msg) {
+
+   uint32_t header[MESSAGE_HEADER_WORDS];
+   if(receiveAll(fd, header, sizeof(header)) != 0) return -1;
+
+   msg->type = ntohl(header[0]);
+   msg->length = ntohl(header[1]);
+   if(msg->length > MAX_MESSAGE) return -1;
+
+   if(msg->length > msg->capacity) {
+      uint8_t *grown = realloc(msg->data, msg->length);
+      if(!grown) return -1;
+      msg->data = grown;
+      msg->capacity = msg->length;
+   }
+
+   return receiveAll(fd, msg->data, msg->length);
+}
+
+// Word index of a message's payload, which must be long enough to hold it
+uint32_t messageWord(Message *msg, int index) {
+   uint32_t word;
+   memcpy(&word, msg->data + index * sizeof(uint32_t), sizeof(word));
+   return ntohl(word);
+}
+
+uint32_t floatBits(float value) {
+   uint32_t bits;
+   memcpy(&bits, &value, sizeof(bits));
+   return bits;
+}
+
+float bitsFloat(uint32_t bits) {
+   float value;
+   memcpy(&value, &bits, sizeof(value));
+   return value;
+}
+
+// Opens a stream socket for address, "unix:PATH" or "HOST:PORT", bound and listening when listening is set
+// and connected otherwise; an empty or "*" host listens on every interface
+// Returns the socket, or -1 with the reason in error
+int openSocket(const char *address, bool listening, char *error, size_t errorSize) {
+
+   if(strncmp(address, "unix:", 5) == 0) {
+
+      const char *path = address + 5;
+      struct sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      if(path[0] == '\0' || strlen(path) >= sizeof(addr.sun_path)) return setError(error, errorSize, "bad socket path in %s", address);
+      strcpy(addr.sun_path, path);
+
+      int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if(fd < 0) return setError(error, errorSize, "cannot create a socket for %s", address);
+
+      // A socket file left behind by an earlier coordinator or server would make bind() fail
+      if(listening) unlink(path);
+
+      int status = listening ? bind(fd, (struct sockaddr *)&addr, sizeof(addr)) : connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+      if(status != 0 || (listening && listen(fd, SOMAXCONN) != 0)) {
+         close(fd);
+         return setError(error, errorSize, "cannot %s %s: %s", listening ? "listen on" : "connect to", address, strerror(errno));
+      }
+      return fd;
+   }
+
+   const char *colon = strrchr(address, ':');
+   if(!colon || colon[1] == '\0') return setError(error, errorSize, "address %s is neither unix:PATH nor HOST:PORT", address);
+
+   char host[256];
+   size_t hostLength = colon - address;
+   if(hostLength >= sizeof(host)) return setError(error, errorSize, "host name in %s is too long", address);
+   memcpy(host, address, hostLength);
+   host[hostLength] = '\0';
+   bool anyHost = hostLength == 0 || strcmp(host, "*") == 0;
+
+   struct addrinfo hints;
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   hints.ai_flags = listening ? AI_PASSIVE : 0;
+
+   struct addrinfo *found;
+   int lookup = getaddrinfo(anyHost ? (listening ? NULL : "localhost") : host, colon + 1, &hints, &found);
+   if(lookup != 0) return setError(error, errorSize, "cannot resolve %s: %s", address, gai_strerror(lookup));
+
+   int fd = -1;
+   for(struct addrinfo *candidate = found; candidate && fd < 0; candidate = candidate->ai_next) {
+
+      fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+      if(fd < 0) continue;
+
+      int on = 1;
+      int status;
+      if(listening) {
+         setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+         status = bind(fd, candidate->ai_addr, candidate->ai_addrlen);
+         if(status == 0) status = listen(fd, SOMAXCONN);
+      }
+      else {
+         status = connect(fd, candidate->ai_addr, candidate->ai_addrlen);
+         // Requests are small and latency bound
+         if(status == 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+      }
+
+      if(status != 0) {
+         close(fd);
+         fd = -1;
+      }
+   }
+   freeaddrinfo(found);
+
+   if(fd < 0) return setError(error, errorSize, "cannot %s %s: %s", listening ? "listen on" : "connect to", address, strerror(errno));
+   return fd;
+}
+
+// Reads the whole file at path into a new buffer stored in *data
+int readWholeFile(const char *path, char **data, size_t *size) {
+
+   int fd = open(path, O_RDONLY);
+   if(fd < 0) return -1;
+
+   struct stat fileStat;
+   if(fstat(fd, &fileStat) != 0) {
+      close(fd);
+      return -1;
+   }
+
+   *size = fileStat.st_size;
+   *data = malloc(*size + 1);
+   size_t done = 0;
+   while(*data && done < *size) {
+      ssize_t got = read(fd, *data + done, *size - done);
+      if(got <= 0) break;
+      done += got;
+   }
+   close(fd);
+
+   if(!*data || done < *size) {
+      free(*data);
+      return -1;
+   }
+   return 0;
+}
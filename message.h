@@ -0,0 +1,36 @@
+#ifndef MESSAGE_H
+#define MESSAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+Length prefixed messages over stream sockets, as the distributed renderer and the
+render server speak them. A message is a type and a payload length, then the
+payload, which starts with big endian 32 bit words and may end with raw bytes.
+*/
+#define MESSAGE_HEADER_WORDS 2
+#define MESSAGE_MAX_WORDS 16   // Most words sendMessage() puts before the bytes
+#define MAX_MESSAGE (1u << 31) // Largest payload accepted
+
+// A received message; data is reused, and grown, by the next receiveMessage()
+typedef struct Message {
+   uint32_t type;
+   uint32_t length;
+   uint8_t *data;
+   size_t capacity;
+} Message;
+
+int setError(char *error, size_t errorSize, const char *format, ...);
+int sendAll(int fd, const void *data, size_t size);
+int receiveAll(int fd, void *data, size_t size);
+int sendMessage(int fd, uint32_t type, const uint32_t *words, int numWords, const void *body, size_t size);
+int receiveMessage(int fd, Message *msg);
+uint32_t messageWord(Message *msg, int index);
+uint32_t floatBits(float value);
+float bitsFloat(uint32_t bits);
+int openSocket(const char *address, bool listening, char *error, size_t errorSize);
+int readWholeFile(const char *path, char **data, size_t *size);
+
+#endif
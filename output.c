@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "output.h"
+
+
+// "  0" .. "255" for writing P3 channels without going through printf
+static char channelDigits[256][3];
+static pthread_once_t channelDigitsOnce = PTHREAD_ONCE_INIT;
+
+
+static void initChannelDigits(void) {
+   for(int value = 0; value < 256; value++) {
+      channelDigits[value][0] = value >= 100 ? '0' + value / 100 : ' ';
+      channelDigits[value][1] = value >= 10 ? '0' + (value / 10) % 10 : ' ';
+      channelDigits[value][2] = '0' + value % 10;
+   }
+}
+
+static bool hostLittleEndian(void) {
+   uint16_t probe = 1;
+   return *(uint8_t *)&probe == 1;
+}
+
+// Fills in the fields both kinds of output share and writes the PPM header into header
+static int initOutputImage(OutputImage *out, char *header, size_t headerCapacity, int format, int imgWidth, int imgHeight) {
+
+   out->format = format;
+   out->imgWidth = imgWidth;
+   out->imgHeight = imgHeight;
+   out->pixelSize = format == FORMAT_P3 ? P3_PIXEL_SIZE : format == FORMAT_PFM ? sizeof(float) * 3 : 3;
+   out->rowStride = (size_t)imgWidth * out->pixelSize;
+   out->fd = -1;
+   out->map = NULL;
+   out->mapSize = 0;
+   out->pixels = NULL;
+   out->firstRow = 0;
+   out->bandRows = 0;
+
+   // Several renders may be setting up output at once
+   if(format == FORMAT_P3) {
+      pthread_once(&channelDigitsOnce, initChannelDigits);
+   }
+
+   // A negative PFM scale says the floats are little endian
+   if(format == FORMAT_PFM) {
+      return snprintf(header, headerCapacity, "PF\n%d %d\n%s\n", imgWidth, imgHeight, hostLittleEndian() ? "-1.0" : "1.0");
+   }
+   return snprintf(header, headerCapacity, "%s\n%d %d\n255\n", format == FORMAT_P3 ? "P3" : "P6", imgWidth, imgHeight);
+}
+
+// Writes all of buf, retrying on short writes
+static int writeAll(int fd, uint8_t *buf, size_t size) {
+
+   while(size > 0) {
+      ssize_t written = write(fd, buf, size);
+      if(written <= 0) return -1;
+      buf += written;
+      size -= written;
+   }
+
+   return 0;
+}
+
+// Creates path at its final size and maps it; returns 0 on success and -1 if the file can't be set up
+int openOutputImage(OutputImage *out, const char *path, int format, int imgWidth, int imgHeight) {
+
+   char header[64];
+   int headerSize = initOutputImage(out, header, sizeof(header), format, imgWidth, imgHeight);
+
+   out->mapSize = headerSize + (size_t)imgWidth * imgHeight * out->pixelSize;
+
+   out->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if(out->fd < 0) {
+      return -1;
+   }
+
+   if(ftruncate(out->fd, out->mapSize) != 0) {
+      close(out->fd);
+      return -1;
+   }
+
+   // Reserving the blocks now turns a full disk into an error here rather than a SIGBUS when a tile is stored;
+   // file systems that can't reserve space report writeback failures through closeOutputImage() instead
+   int reserved = posix_fallocate(out->fd, 0, out->mapSize);
+   if(reserved != 0 && reserved != EOPNOTSUPP && reserved != EINVAL) {
+      close(out->fd);
+      return -1;
+   }
+
+   out->map = mmap(NULL, out->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, out->fd, 0);
+   if(out->map == MAP_FAILED) {
+      out->map = NULL;
+      close(out->fd);
+      return -1;
+   }
+
+   memcpy(out->map, header, headerSize);
+   out->pixels = out->map + headerSize;
+
+   return 0;
+}
+
+// Renders into pixels, whose rows are rowStride bytes apart (0 packs them tightly)
+void openOutputBuffer(OutputImage *out, uint8_t *pixels, int imgWidth, int imgHeight, size_t rowStride) {
+
+   char header[64];
+   initOutputImage(out, header, sizeof(header), FORMAT_RGB, imgWidth, imgHeight);
+
+   out->pixels = pixels;
+   if(rowStride > 0) out->rowStride = rowStride;
+}
+
+// Opens path for band by band writing, holding bandRows rows in memory at a time
+// Returns 0 on success and -1 if the file can't be set up
+int openOutputStream(OutputImage *out, const char *path, int format, int imgWidth, int imgHeight, int bandRows) {
+
+   char header[64];
+   int headerSize = initOutputImage(out, header, sizeof(header), format, imgWidth, imgHeight);
+
+   out->bandRows = bandRows;
+   out->pixels = malloc((size_t)bandRows * imgWidth * out->pixelSize);
+   if(!out->pixels) {
+      return -1;
+   }
+
+   out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if(out->fd < 0) {
+      free(out->pixels);
+      return -1;
+   }
+
+   if(writeAll(out->fd, (uint8_t *)header, headerSize) != 0) {
+      free(out->pixels);
+      close(out->fd);
+      return -1;
+   }
+
+   return 0;
+}
+
+// Appends the first rows rows of a streamed output's band to the file and moves the band down past them
+// Returns 0 on success and -1 on a write error
+int flushOutputBand(OutputImage *out, int rows) {
+
+   if(out->bandRows == 0) return 0;
+
+   if(writeAll(out->fd, out->pixels, (size_t)rows * out->imgWidth * out->pixelSize) != 0) {
+      return -1;
+   }
+   out->firstRow += rows;
+
+   return 0;
+}
+
+// Stores count RGB triples starting at pixel (imgX, imgY), which must all sit on the same row
+// For streamed output the row has to fall inside the current band
+// Safe to call from several threads at once as long as they write different pixels
+void storeOutputPixels(OutputImage *out, int imgX, int imgY, uint8_t *rgb, int count) {
+
+   uint8_t *dst = out->pixels + (size_t)(imgY - out->firstRow) * out->rowStride + (size_t)imgX * out->pixelSize;
+
+   if(out->format != FORMAT_P3) {
+      memcpy(dst, rgb, (size_t)count * 3);
+      return;
+   }
+
+   for(int i = 0; i < count; i++) {
+      for(int channel = 0; channel < 3; channel++) {
+         memcpy(dst, channelDigits[rgb[i * 3 + channel]], 3);
+         dst[3] = channel < 2 ? ' ' : '\n';
+         dst += 4;
+      }
+   }
+}
+
+// Stores count RGB triples of radiance starting at pixel (imgX, imgY) of a mapped PFM file, where rows run
+// bottom to top; like storeOutputPixels() it is safe for threads writing different pixels
+void storeOutputRadiance(OutputImage *out, int imgX, int imgY, const float *rgb, int count) {
+   uint8_t *dst = out->pixels + (size_t)(out->imgHeight - 1 - imgY) * out->rowStride + (size_t)imgX * out->pixelSize;
+   memcpy(dst, rgb, (size_t)count * out->pixelSize);
+}
+
+// Reads the PFM file at path into a new buffer of RGB floats stored in *pixels, rows top to bottom
+// Returns 0 on success and -1 if the file can't be read or isn't an RGB PFM
+int readPfmImage(const char *path, float **pixels, int *imgWidth, int *imgHeight) {
+
+   FILE *in = fopen(path, "rb");
+   if(!in) return -1;
+
+   // The header is three whitespace separated fields after "PF", then one whitespace character
+   float scale;
+   *pixels = NULL;
+   if(fscanf(in, "PF %d %d %f", imgWidth, imgHeight, &scale) != 3 || fgetc(in) == EOF || \
+      *imgWidth < 1 || *imgHeight < 1 || scale == 0 || (size_t)*imgWidth > SIZE_MAX / 12 / (size_t)*imgHeight) {
+      fclose(in);
+      return -1;
+   }
+
+   size_t rowFloats = (size_t)*imgWidth * 3;
+   *pixels = malloc(rowFloats * *imgHeight * sizeof(float));
+   bool swap = (scale < 0) != hostLittleEndian();
+   int status = *pixels ? 0 : -1;
+
+   for(int row = *imgHeight - 1; row >= 0 && status == 0; row--) {
+      float *dst = *pixels + row * rowFloats;
+      if(fread(dst, sizeof(float), rowFloats, in) != rowFloats) status = -1;
+      for(size_t i = 0; swap && i < rowFloats; i++) {
+         uint32_t bits;
+         memcpy(&bits, &dst[i], sizeof(bits));
+         bits = __builtin_bswap32(bits);
+         memcpy(&dst[i], &bits, sizeof(bits));
+      }
+   }
+   fclose(in);
+
+   if(status != 0) {
+      free(*pixels);
+      *pixels = NULL;
+   }
+   return status;
+}
+
+// Flushes, unmaps and closes the file; returns 0 on success and -1 if it could not be written out
+int closeOutputImage(OutputImage *out) {
+
+   int status = 0;
+
+   if(out->map) {
+      // The file was only sized up front, so running out of space shows up when the pages are written back
+      if(msync(out->map, out->mapSize, MS_SYNC) != 0) status = -1;
+      if(munmap(out->map, out->mapSize) != 0) status = -1;
+      out->map = NULL;
+   }
+   if(out->bandRows > 0) {
+      free(out->pixels);
+      out->pixels = NULL;
+   }
+   if(out->fd >= 0 && close(out->fd) != 0) status = -1;
+
+   return status;
+}
@@ -0,0 +1,48 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Output formats for --format
+#define FORMAT_P6 6   // Binary PPM, the default
+#define FORMAT_P3 3   // ASCII PPM
+#define FORMAT_RGB 0  // Raw RGB triples in memory the caller owns, no file
+#define FORMAT_PFM 7  // Portable float map: the radiance before tone mapping, rows bottom to top
+
+// Bytes one pixel takes up in a P3 file: every channel is padded to three digits, "255 255 255\n"
+#define P3_PIXEL_SIZE 12
+
+/*
+A PPM or PFM file being written. Every pixel has a fixed offset (P3 channels are
+padded to a fixed width to make that possible), so the render threads store finished
+pixels straight into their final place:
+- Mapped: the file is sized once up front and memory mapped whole
+- Buffer: pixels go into caller owned memory, nothing is written to a file
+- Streamed: only a band of bandRows rows starting at firstRow is held in memory and
+  flushOutputBand() appends it to the file before the next band is rendered
+*/
+typedef struct OutputImage {
+   int format;
+   int imgWidth;
+   int imgHeight;
+   int fd;
+   uint8_t *map;
+   size_t mapSize;
+   uint8_t *pixels;      // Pixel firstRow's first byte
+   size_t pixelSize;     // Bytes per pixel in the file
+   size_t rowStride;     // Bytes from one row of pixels to the next
+   int firstRow;         // First row held in pixels
+   int bandRows;         // Rows held in pixels; 0 when the whole file is mapped
+} OutputImage;
+
+int openOutputImage(OutputImage *out, const char *path, int format, int imgWidth, int imgHeight);
+void openOutputBuffer(OutputImage *out, uint8_t *pixels, int imgWidth, int imgHeight, size_t rowStride);
+int openOutputStream(OutputImage *out, const char *path, int format, int imgWidth, int imgHeight, int bandRows);
+int flushOutputBand(OutputImage *out, int rows);
+void storeOutputPixels(OutputImage *out, int imgX, int imgY, uint8_t *rgb, int count);
+void storeOutputRadiance(OutputImage *out, int imgX, int imgY, const float *rgb, int count);
+int readPfmImage(const char *path, float **pixels, int *imgWidth, int *imgHeight);
+int closeOutputImage(OutputImage *out);
+
+#endif
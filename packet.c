@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "raycast.h"
+#include "bvh.h"
+#include "scene.h"
+#include "packet.h"
+#include "stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PACKET_X86 1
+#include <immintrin.h>
+
+#define PACKET_WIDTH 4
+#define PACKET_TARGET "sse2"
+#define PACKET_SQRT(v) ((PacketFloat4)_mm_sqrt_ps((__m128)(v)))
+#define PACKET_KERNEL tracePacketSSE
+#include "packet_kernel.h"
+#undef PACKET_WIDTH
+#undef PACKET_TARGET
+#undef PACKET_SQRT
+#undef PACKET_KERNEL
+
+#define PACKET_WIDTH 8
+#define PACKET_TARGET "avx2"
+#define PACKET_SQRT(v) ((PacketFloat8)_mm256_sqrt_ps((__m256)(v)))
+#define PACKET_KERNEL tracePacketAVX2
+#include "packet_kernel.h"
+#undef PACKET_WIDTH
+#undef PACKET_TARGET
+#undef PACKET_SQRT
+#undef PACKET_KERNEL
+
+#define PACKET_WIDTH 16
+#define PACKET_TARGET "avx512f"
+#define PACKET_SQRT(v) ((PacketFloat16)_mm512_sqrt_ps((__m512)(v)))
+#define PACKET_KERNEL tracePacketAVX512
+#include "packet_kernel.h"
+#undef PACKET_WIDTH
+#undef PACKET_TARGET
+#undef PACKET_SQRT
+#undef PACKET_KERNEL
+#endif
+
+
+static const char *simdModeNames[] = {"scalar", "sse", "avx2", "avx512"};
+
+// Returns the SIMD_* value for a --simd argument, or -2 when it is not recognised
+int parseSimdMode(const char *name) {
+
+   if(strcmp(name, "auto") == 0) return SIMD_AUTO;
+
+   for(int mode = SIMD_SCALAR; mode <= SIMD_AVX512; mode++) {
+      if(strcmp(name, simdModeNames[mode]) == 0) return mode;
+   }
+
+   return -2;
+}
+
+const char *simdModeName(int mode) {
+   if(mode < SIMD_SCALAR || mode > SIMD_AVX512) return "auto";
+   return simdModeNames[mode];
+}
+
+static int simdModeSupported(int mode) {
+   if(mode == SIMD_SCALAR) return 1;
+#ifdef PACKET_X86
+   __builtin_cpu_init();
+   if(mode == SIMD_SSE) return __builtin_cpu_supports("sse2");
+   if(mode == SIMD_AVX2) return __builtin_cpu_supports("avx2");
+   if(mode == SIMD_AVX512) return __builtin_cpu_supports("avx512f");
+#endif
+   return 0;
+}
+
+// Picks the widest supported mode for SIMD_AUTO, otherwise steps down until the CPU can run it
+int resolveSimdMode(int requested) {
+
+   int mode = requested == SIMD_AUTO ? SIMD_AVX512 : requested;
+
+   while(mode > SIMD_SCALAR && !simdModeSupported(mode)) {
+      mode -= 1;
+   }
+
+   return mode;
+}
+
+int simdPacketWidth(int mode) {
+   switch(mode) {
+      case SIMD_SSE:
+         return 4;
+      case SIMD_AVX2:
+         return 8;
+      case SIMD_AVX512:
+         return 16;
+   }
+   return 1;
+}
+
+// Pixel block a packet covers; lane i maps to (i % packetWidth, i / packetWidth)
+void simdPacketShape(int mode, int *packetWidth, int *packetHeight) {
+   int width = simdPacketWidth(mode);
+   *packetWidth = width >= 4 ? (width >= 8 ? 4 : 2) : 1;
+   *packetHeight = width / *packetWidth;
+}
+
+// Closest hits for a packet of rays sharing origin; tOut is -1 and hitOut -1 for lanes that miss
+// mode must be a resolved, non scalar mode
+void tracePrimaryPacket(int mode, CompiledScene *scene, float *origin, float *dirX, float *dirY, float *dirZ, float *tOut, int *hitOut, RenderStats *stats) {
+#ifdef PACKET_X86
+   switch(mode) {
+      case SIMD_SSE:
+         tracePacketSSE(scene, origin, dirX, dirY, dirZ, tOut, hitOut, stats);
+         return;
+      case SIMD_AVX2:
+         tracePacketAVX2(scene, origin, dirX, dirY, dirZ, tOut, hitOut, stats);
+         return;
+      case SIMD_AVX512:
+         tracePacketAVX512(scene, origin, dirX, dirY, dirZ, tOut, hitOut, stats);
+         return;
+   }
+#endif
+
+   // Scalar fallback, one lane at a time
+   for(int lane = 0; lane < simdPacketWidth(mode); lane++) {
+      float dirVector[3] = {dirX[lane], dirY[lane], dirZ[lane]};
+      tOut[lane] = shoot(scene, origin, dirVector, NO_PRIMITIVE, &hitOut[lane], stats);
+   }
+}
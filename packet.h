@@ -0,0 +1,27 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+/*
+Primary ray packet paths, selectable at runtime with --simd:
+- SIMD_SCALAR: one ray at a time through shoot()
+- SIMD_SSE: 4 rays per packet, 2x2 pixel blocks
+- SIMD_AVX2: 8 rays per packet, 4x2 pixel blocks
+- SIMD_AVX512: 16 rays per packet, 4x4 pixel blocks
+*/
+#define SIMD_AUTO -1
+#define SIMD_SCALAR 0
+#define SIMD_SSE 1
+#define SIMD_AVX2 2
+#define SIMD_AVX512 3
+
+// Widest packet any mode uses
+#define MAX_PACKET_WIDTH 16
+
+int parseSimdMode(const char *name);
+const char *simdModeName(int mode);
+int resolveSimdMode(int requested);
+int simdPacketWidth(int mode);
+void simdPacketShape(int mode, int *packetWidth, int *packetHeight);
+void tracePrimaryPacket(int mode, struct CompiledScene *scene, float *origin, float *dirX, float *dirY, float *dirZ, float *tOut, int *hitOut, struct RenderStats *stats);
+
+#endif
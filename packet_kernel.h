@@ -0,0 +1,133 @@
+/*
+Packet intersection kernel template, included once per instruction set by packet.c.
+The includer defines:
+- PACKET_WIDTH: rays per packet
+- PACKET_TARGET: target attribute string the kernel is compiled for
+- PACKET_SQRT(v): square root of a PacketFloat
+- PACKET_KERNEL: name of the generated function
+
+Every lane performs exactly the operations getSphereIntersection()/getPlaneIntersection()
+perform for a single ray, in the same order, so packet and scalar hits match bit for bit.
+*/
+
+#define PACKET_CAT_(a, b) a##b
+#define PACKET_CAT(a, b) PACKET_CAT_(a, b)
+#define PacketFloat PACKET_CAT(PacketFloat, PACKET_WIDTH)
+#define PacketInt PACKET_CAT(PacketInt, PACKET_WIDTH)
+
+typedef float PacketFloat __attribute__((vector_size(PACKET_WIDTH * 4)));
+typedef int PacketInt __attribute__((vector_size(PACKET_WIDTH * 4)));
+
+// Lane-wise mask ? a : b for float vectors
+#define PACKET_SELECT(mask, a, b) ((PacketFloat)(((PacketInt)(a) & (mask)) | ((PacketInt)(b) & ~(mask))))
+
+__attribute__((target(PACKET_TARGET)))
+static void PACKET_KERNEL(CompiledScene *scene, float *origin, float *dirX, float *dirY, float *dirZ, float *tOut, int *hitOut, RenderStats *stats) {
+
+   PacketFloat dx, dy, dz;
+   memcpy(&dx, dirX, sizeof(dx));
+   memcpy(&dy, dirY, sizeof(dy));
+   memcpy(&dz, dirZ, sizeof(dz));
+
+   PacketFloat closestT, zero;
+   PacketInt hit;
+   for(int lane = 0; lane < PACKET_WIDTH; lane++) {
+      closestT[lane] = INFINITY;
+      zero[lane] = 0;
+      hit[lane] = -1;
+   }
+
+   BVH *bvh = &scene->bvh;
+   PacketFloat invX = 1 / dx;
+   PacketFloat invY = 1 / dy;
+   PacketFloat invZ = 1 / dz;
+   int stack[BVH_MAX_DEPTH * 2 + 2];
+   int stackSize = 0;
+   int nodeTests = 0;
+   int sphereTests = 0;
+
+   if(bvh->numPrims > 0) stack[stackSize++] = 0;
+
+   while(stackSize > 0) {
+
+      BVHNode *node = &bvh->nodes[stack[--stackSize]];
+      nodeTests += 1;
+
+      // Slab test against every lane; the node is entered when any lane still reaches it
+      PacketFloat tNear = zero;
+      PacketFloat tFar = closestT;
+      PacketFloat inv[3] = {invX, invY, invZ};
+      for(int axis = 0; axis < 3; axis++) {
+         PacketFloat t0 = (node->boundsMin[axis] - origin[axis]) * inv[axis];
+         PacketFloat t1 = (node->boundsMax[axis] - origin[axis]) * inv[axis];
+         PacketInt swap = t0 > t1;
+         PacketFloat lo = PACKET_SELECT(swap, t1, t0);
+         PacketFloat hi = PACKET_SELECT(swap, t0, t1);
+         tNear = PACKET_SELECT(lo > tNear, lo, tNear);
+         tFar = PACKET_SELECT(hi < tFar, hi, tFar);
+      }
+      PacketInt reached = tNear <= tFar;
+      int anyReached = 0;
+      for(int lane = 0; lane < PACKET_WIDTH; lane++) {
+         anyReached |= reached[lane];
+      }
+      if(!anyReached) continue;
+
+      if(node->count == 0) {
+         stack[stackSize++] = node->start + 1;
+         stack[stackSize++] = node->start;
+         continue;
+      }
+
+      // Leaves cover a contiguous run of spheres; all lanes share the origin so c is scalar
+      sphereTests += node->count;
+      for(int sphereInd = node->start; sphereInd < node->start + node->count; sphereInd++) {
+
+         float ox = origin[0] - scene->sphereX[sphereInd];
+         float oy = origin[1] - scene->sphereY[sphereInd];
+         float oz = origin[2] - scene->sphereZ[sphereInd];
+         float c = ox * ox + oy * oy + oz * oz - scene->sphereRadius2[sphereInd];
+
+         PacketFloat b = 2 * (dx * ox + dy * oy + dz * oz);
+         PacketFloat discriminant = b * b - 4 * c;
+         PacketInt valid = discriminant >= 0;
+         PacketFloat root = PACKET_SQRT(PACKET_SELECT(valid, discriminant, zero));
+         PacketFloat t0 = (-b - root) / 2;
+         PacketFloat t1 = (-b + root) / 2;
+         PacketFloat t = PACKET_SELECT(t0 > 0, t0, t1);
+
+         valid &= (t > 0) & (t < closestT);
+         closestT = PACKET_SELECT(valid, t, closestT);
+         hit = (valid & sphereInd) | (~valid & hit);
+      }
+   }
+
+   // Planes are unbounded, so they are tested one by one
+   for(int planeInd = 0; planeInd < scene->numPlanes; planeInd++) {
+
+      float nx = scene->planeNX[planeInd];
+      float ny = scene->planeNY[planeInd];
+      float nz = scene->planeNZ[planeInd];
+      float offset = scene->planeOffset[planeInd] - (nx * origin[0] + ny * origin[1] + nz * origin[2]);
+
+      PacketFloat t = offset / (nx * dx + ny * dy + nz * dz);
+      PacketInt valid = (t > 0) & (t < closestT);
+      closestT = PACKET_SELECT(valid, t, closestT);
+      hit = (valid & (scene->numSpheres + planeInd)) | (~valid & hit);
+   }
+
+   STAT_ADD(stats, STAT_BVH_NODES, nodeTests);
+   STAT_ADD(stats, STAT_SPHERE_TESTS, sphereTests * PACKET_WIDTH);
+   STAT_ADD(stats, STAT_PLANE_TESTS, scene->numPlanes * PACKET_WIDTH);
+
+   for(int lane = 0; lane < PACKET_WIDTH; lane++) {
+      tOut[lane] = hit[lane] < 0 ? -1 : closestT[lane];
+      hitOut[lane] = hit[lane];
+   }
+}
+
+#undef PacketFloat
+#undef PacketInt
+#undef PACKET_SELECT
+#undef PACKET_CAT
+#undef PACKET_CAT_
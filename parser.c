@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "raycast.h"
+#include "scene.h"
+#include "parser.h"
+
+// Longest number parseFloat() hands over to strtod() when it has too many digits to do itself
+#define MAX_NUMBER_LENGTH 64
+
+
+typedef struct KindSpec {
+   const char *name;
+   int kind;
+} KindSpec;
+
+// One "name: value" pair an object kind accepts; components is 1 for a number and 3 for a [x, y, z] vector
+typedef struct AttributeSpec {
+   int kind;
+   const char *name;
+   int components;
+   size_t offset;
+} AttributeSpec;
+
+static const KindSpec kinds[] = {
+   {"camera", CAMERA},
+   {"sphere", SPHERE},
+   {"plane", PLANE},
+   {"light", LIGHT},
+   {"keyframe", KEYFRAME},
+};
+
+static const AttributeSpec attributes[] = {
+   {CAMERA, "width", 1, offsetof(Object, width)},
+   {CAMERA, "height", 1, offsetof(Object, height)},
+   {CAMERA, "position", 3, offsetof(Object, position)},
+
+   {SPHERE, "radius", 1, offsetof(Object, radius)},
+   {SPHERE, "diffuse_color", 3, offsetof(Object, diffuseColor)},
+   {SPHERE, "specular_color", 3, offsetof(Object, specularColor)},
+   {SPHERE, "shininess", 1, offsetof(Object, shininess)},
+   {SPHERE, "position", 3, offsetof(Object, position)},
+
+   {PLANE, "color", 3, offsetof(Object, color)},
+   {PLANE, "diffuse_color", 3, offsetof(Object, diffuseColor)},
+   {PLANE, "specular_color", 3, offsetof(Object, specularColor)},
+   {PLANE, "shininess", 1, offsetof(Object, shininess)},
+   {PLANE, "position", 3, offsetof(Object, position)},
+   {PLANE, "normal", 3, offsetof(Object, normal)},
+
+   {LIGHT, "color", 3, offsetof(Object, color)},
+   {LIGHT, "theta", 1, offsetof(Object, theta)},
+   {LIGHT, "radial-a0", 1, offsetof(Object, radialA0)},
+   {LIGHT, "radial-a1", 1, offsetof(Object, radialA1)},
+   {LIGHT, "radial-a2", 1, offsetof(Object, radialA2)},
+   {LIGHT, "angular-a0", 1, offsetof(Object, angularA0)},
+   {LIGHT, "position", 3, offsetof(Object, position)},
+   {LIGHT, "direction", 3, offsetof(Object, spotDirection)},
+
+   {KEYFRAME, "object", 1, offsetof(Object, target)},
+   {KEYFRAME, "frame", 1, offsetof(Object, frame)},
+   {KEYFRAME, "position", 3, offsetof(Object, position)},
+};
+
+// Exact powers of ten; any integer below 2^53 divided or multiplied by one of these rounds like strtod()
+static const double powersOfTen[] = {
+   1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+// Cursor over one line of the file, which is not NUL terminated
+typedef struct LineReader {
+   const char *pos;
+   const char *end;
+   int line;
+   ParseError *error;
+} LineReader;
+
+static int fail(LineReader *reader, const char *format, const char *detail, int detailLength) {
+   reader->error->line = reader->line;
+   snprintf(reader->error->message, sizeof(reader->error->message), format, detailLength, detail);
+   return -1;
+}
+
+static void skipSpace(LineReader *reader) {
+   while(reader->pos < reader->end && (*reader->pos == ' ' || *reader->pos == '\t' || *reader->pos == '\r')) {
+      reader->pos++;
+   }
+}
+
+static bool isDigit(char c) {
+   return c >= '0' && c <= '9';
+}
+
+// Reads a decimal number such as -7, 0.125 or 1.5e3; returns -1 if there isn't one at the cursor
+static int parseFloat(LineReader *reader, float *value) {
+
+   const char *start = reader->pos;
+   const char *p = reader->pos;
+   const char *end = reader->end;
+   bool negative = false;
+   uint64_t mantissa = 0;
+   int digits = 0;
+   int exponent = 0;
+
+   if(p < end && (*p == '-' || *p == '+')) {
+      negative = *p == '-';
+      p++;
+   }
+
+   // Leading zeros don't count towards the 19 digits a uint64_t can hold
+   while(p < end && *p == '0') p++;
+   bool sawDigit = p > start && p[-1] == '0';
+
+   while(p < end && isDigit(*p)) {
+      if(digits < 19) mantissa = mantissa * 10 + (*p - '0');
+      else exponent += 1;
+      digits += mantissa > 0;
+      sawDigit = true;
+      p++;
+   }
+
+   if(p < end && *p == '.') {
+      p++;
+      while(p < end && isDigit(*p)) {
+         if(digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            exponent -= 1;
+            digits += mantissa > 0;
+         }
+         sawDigit = true;
+         p++;
+      }
+   }
+
+   if(!sawDigit) {
+      return fail(reader, "expected a number but found '%.*s'", start, (int)(end - start > 16 ? 16 : end - start));
+   }
+
+   if(p < end && (*p == 'e' || *p == 'E')) {
+      const char *expStart = p++;
+      bool expNegative = false;
+      int expValue = 0;
+      if(p < end && (*p == '-' || *p == '+')) {
+         expNegative = *p == '-';
+         p++;
+      }
+      if(p == end || !isDigit(*p)) {
+         p = expStart;
+      }
+      else {
+         while(p < end && isDigit(*p)) {
+            if(expValue < 10000) expValue = expValue * 10 + (*p - '0');
+            p++;
+         }
+         exponent += expNegative ? -expValue : expValue;
+      }
+   }
+
+   reader->pos = p;
+
+   double result;
+   if(mantissa < ((uint64_t)1 << 53) && exponent >= -22 && exponent <= 22) {
+      result = (double)mantissa;
+      result = exponent < 0 ? result / powersOfTen[-exponent] : result * powersOfTen[exponent];
+   }
+   else {
+      // Too many digits or too large an exponent to be exact, let the C library round it
+      char buf[MAX_NUMBER_LENGTH];
+      int length = p - start < MAX_NUMBER_LENGTH - 1 ? (int)(p - start) : MAX_NUMBER_LENGTH - 1;
+      memcpy(buf, start, length);
+      buf[length] = '\0';
+      *value = strtod(buf, NULL);
+      return 0;
+   }
+
+   *value = negative ? -result : result;
+   return 0;
+}
+
+static int expect(LineReader *reader, char c) {
+   skipSpace(reader);
+   if(reader->pos < reader->end && *reader->pos == c) {
+      reader->pos++;
+      return 0;
+   }
+
+   char expected[2] = {c, '\0'};
+   return fail(reader, "expected '%.*s'", expected, 1);
+}
+
+// Reads a run of name characters, stopping at ':', ',', whitespace or the end of the line
+static int readName(LineReader *reader, const char **name, int *length) {
+
+   skipSpace(reader);
+   *name = reader->pos;
+   while(reader->pos < reader->end && *reader->pos != ':' && *reader->pos != ',' && \
+         *reader->pos != ' ' && *reader->pos != '\t' && *reader->pos != '\r') {
+      reader->pos++;
+   }
+   *length = reader->pos - *name;
+
+   if(*length == 0) {
+      return fail(reader, "expected a name%.*s", "", 0);
+   }
+
+   return 0;
+}
+
+static bool nameEquals(const char *name, int length, const char *expected) {
+   return (int)strlen(expected) == length && memcmp(name, expected, length) == 0;
+}
+
+static int parseValue(LineReader *reader, const AttributeSpec *spec, Object *obj) {
+
+   float *dst = (float *)((char *)obj + spec->offset);
+
+   skipSpace(reader);
+   if(spec->components == 1) {
+      return parseFloat(reader, dst);
+   }
+
+   if(expect(reader, '[') != 0) return -1;
+   for(int i = 0; i < spec->components; i++) {
+      if(i > 0 && expect(reader, ',') != 0) return -1;
+      skipSpace(reader);
+      if(parseFloat(reader, &dst[i]) != 0) return -1;
+   }
+   return expect(reader, ']');
+}
+
+// "kind, name: value, name: [x, y, z], ..." adds one object; blank lines are skipped
+static int parseLine(LineReader *reader, SceneStore *store) {
+
+   const char *name;
+   int length;
+
+   skipSpace(reader);
+   if(reader->pos == reader->end) return 0;
+
+   if(readName(reader, &name, &length) != 0) return -1;
+
+   int kind = NONE;
+   for(size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+      if(nameEquals(name, length, kinds[i].name)) kind = kinds[i].kind;
+   }
+   if(kind == NONE) {
+      return fail(reader, "unknown object kind '%.*s'", name, length);
+   }
+
+   Object *obj = addSceneObject(store);
+   if(!obj) {
+      reader->error->outOfMemory = true;
+      return fail(reader, "out of memory adding %.*s", name, length);
+   }
+   obj->kind = kind;
+
+   skipSpace(reader);
+   while(reader->pos < reader->end) {
+
+      if(expect(reader, ',') != 0) return -1;
+      if(readName(reader, &name, &length) != 0) return -1;
+      if(expect(reader, ':') != 0) return -1;
+
+      const AttributeSpec *spec = NULL;
+      for(size_t i = 0; i < sizeof(attributes) / sizeof(attributes[0]) && !spec; i++) {
+         if(attributes[i].kind == kind && nameEquals(name, length, attributes[i].name)) spec = &attributes[i];
+      }
+      if(!spec) {
+         return fail(reader, "unknown attribute '%.*s'", name, length);
+      }
+
+      if(parseValue(reader, spec, obj) != 0) return -1;
+      skipSpace(reader);
+   }
+
+   return 0;
+}
+
+// Parses a whole scene file held in memory into store in a single pass
+// Returns 0 on success; on failure returns -1 and fills in error
+int parseScene(const char *data, size_t size, SceneStore *store, ParseError *error) {
+
+   LineReader reader;
+   const char *end = data + size;
+
+   reader.pos = data;
+   reader.line = 1;
+   reader.error = error;
+   error->outOfMemory = false;
+
+   while(reader.pos < end) {
+      const char *lineEnd = memchr(reader.pos, '\n', end - reader.pos);
+      if(!lineEnd) lineEnd = end;
+
+      reader.end = lineEnd;
+      if(parseLine(&reader, store) != 0) return -1;
+
+      reader.pos = lineEnd + 1;
+      reader.line += 1;
+   }
+
+   return 0;
+}
+
+// Parses size bytes of scene file text at data into store, which is initialised here and sized from the text
+// Returns 0 on success; on failure returns -1 and fills in error
+int loadSceneMemory(const char *data, size_t size, SceneStore *store, ParseError *error) {
+
+   error->line = 0;
+   error->outOfMemory = false;
+   if(initSceneStore(store, size / SCENE_BYTES_PER_OBJECT + 1) != 0) {
+      snprintf(error->message, sizeof(error->message), "out of memory");
+      error->outOfMemory = true;
+      return -1;
+   }
+
+   if(size == 0) return 0;
+   return parseScene(data, size, store, error);
+}
+
+// Maps the scene file at path and parses it into store, which is initialised here and sized from the file
+// Returns 0 on success; on failure returns -1 and fills in error
+int loadSceneFile(const char *path, SceneStore *store, ParseError *error) {
+
+   error->line = 0;
+   error->outOfMemory = false;
+
+   int fd = open(path, O_RDONLY);
+   if(fd < 0) {
+      snprintf(error->message, sizeof(error->message), "cannot open %s", path);
+      return -1;
+   }
+
+   struct stat fileStat;
+   if(fstat(fd, &fileStat) != 0) {
+      snprintf(error->message, sizeof(error->message), "cannot stat %s", path);
+      close(fd);
+      return -1;
+   }
+
+   size_t size = fileStat.st_size;
+   if(initSceneStore(store, size / SCENE_BYTES_PER_OBJECT + 1) != 0) {
+      snprintf(error->message, sizeof(error->message), "out of memory loading %s", path);
+      error->outOfMemory = true;
+      close(fd);
+      return -1;
+   }
+
+   if(size == 0) {
+      close(fd);
+      return 0;
+   }
+
+   const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if(data == MAP_FAILED) {
+      snprintf(error->message, sizeof(error->message), "cannot map %s", path);
+      return -1;
+   }
+   madvise((void *)data, size, MADV_SEQUENTIAL);
+
+   int status = parseScene(data, size, store, error);
+
+   munmap((void *)data, size);
+
+   return status;
+}
@@ -0,0 +1,20 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+struct SceneStore;
+
+// Where and why a scene file was rejected
+typedef struct ParseError {
+   int line;            // 1 based, 0 when the problem is not tied to a line
+   char message[160];
+   bool outOfMemory;    // Set when memory ran out rather than the text being wrong
+} ParseError;
+
+int parseScene(const char *data, size_t size, struct SceneStore *store, ParseError *error);
+int loadSceneFile(const char *path, struct SceneStore *store, ParseError *error);
+int loadSceneMemory(const char *data, size_t size, struct SceneStore *store, ParseError *error);
+
+#endif
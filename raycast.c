@@ -1,30 +1,28 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdint.h>
-#include <ctype.h>
 #include <stdbool.h>
 #include <string.h>
-#include <math.h>
-#include "v3math.h"
+#include <limits.h>
+#include <unistd.h>
 #include "raycast.h"
+#include "scenecache.h"
+#include "output.h"
+#include "packet.h"
+#include "render.h"
+#include "gbuffer.h"
+#include "rclib.h"
+#include "cluster.h"
+#include "server.h"
 
 
-Object objects[128];
-int numObjects;
-int closestObjIndex = 0;
-
-
-float clamp(float v) {
-  if (v > 1) return 1;
-  if (v < 0) return 0;
-  return v;
-}
-
 /*
 Function for displaying error messages; Error codes are as follows:
 - 0: Incorrect command line input for the program
 - 1: Invalid input file
 - 2: Invalid output file
+- 3: Distributed render failed
+- 4: Render server failed
+- 5: Out of memory
 */
 void help(int errno) {
 
@@ -32,7 +30,7 @@ void help(int errno) {
 
    switch(errno) {
       case 0:
-         fprintf(stderr, "Command Format: ./raycast <[width] [height] [input.json] [output.ppm]>");
+         fprintf(stderr, "Command Format: ./raycast <[width] [height] [input.json] [output.ppm]> [--threads N] [--simd auto|scalar|sse|avx2|avx512] [--format p6|p3|pfm] [--band-rows N] [--frames N] [--aa N] [--aa-threshold T]\n       [--time-budget MS] [--snapshots PATTERN] [--gbuffer PATH] [--light-epsilon E] [--batch-shadows]\n       [--tonemap clamp|reinhard|aces] [--exposure EV] [--gamma G] [--dither]\n       [--stats [text|json]] [--coordinate ADDRESS [--local-workers N] [--tile-rows N] [--tile-timeout S]]\n       [--submit ADDRESS]\n       ./raycast --compile-scene [input.json]\n       ./raycast --tonemap-pfm [input.pfm] [output.ppm] [--format p6|p3] [--tonemap OP] [--exposure EV] [--gamma G] [--dither]\n       ./raycast --worker ADDRESS [--threads N] [--simd MODE]\n       ./raycast --serve ADDRESS [--threads N] [--simd MODE] [--scene-cache N]");
          break;
       case 1:
          fprintf(stderr, "Input file is invalid");
@@ -40,862 +38,479 @@ void help(int errno) {
       case 2:
          fprintf(stderr, "Output file is invalid");
          break;
+      case 3:
+         fprintf(stderr, "Distributed render failed");
+         break;
+      case 4:
+         fprintf(stderr, "Render server failed");
+         break;
+      case 5:
+         fprintf(stderr, "Out of memory");
+         break;
    }
 
    exit(1);
 }
 
-void displayObjects(Object *image, int arrSize) {
-
-   Object *obj = NULL;
-
-   for(int i = 0; i < arrSize; i++) {
-
-      obj = &image[i];
-
-      // Camera
-      if(obj->kind == 1) {
-         printf("%d) CAMERA:\n", i + 1);
-         printf("   Width: %f\n   Height: %f\n\n", obj->width, obj->height);
-      }
-      // Sphere
-      else if(obj->kind == 2) {
-         printf("%d) SPHERE:\n", i + 1);
-         printf("   Position: [%f, %f, %f]\n", obj->position[0], obj->position[1], obj->position[2]);
-         printf("   Diffuse Color: [%f, %f, %f]\n", obj->diffuseColor[0], obj->diffuseColor[1], obj->diffuseColor[2]);
-         printf("   Specular Color: [%f, %f, %f]\n", obj->specularColor[0], obj->specularColor[1], obj->specularColor[2]);
-         printf("   Radius: %f\n\n", obj->radius);
-      }
-      // Plane
-      else if(obj->kind == 3) {
-         printf("%d) PLANE:\n", i + 1);
-         printf("   Position: [%f, %f, %f]\n", obj->position[0], obj->position[1], obj->position[2]);
-         printf("   Diffuse Color: [%f, %f, %f]\n", obj->diffuseColor[0], obj->diffuseColor[1], obj->diffuseColor[2]);
-         printf("   Specular Color: [%f, %f, %f]\n", obj->specularColor[0], obj->specularColor[1], obj->specularColor[2]);
-         printf("   Normal: [%f, %f, %f]\n\n", obj->normal[0], obj->normal[1], obj->normal[2]);
-      }
-      // Light
-      else if(obj->kind == 4) {
-         printf("%d) LIGHT:\n", i + 1);
-         printf("   Position: [%f, %f, %f]\n", obj->position[0], obj->position[1], obj->position[2]);
-         printf("   Color: [%f, %f, %f]\n", obj->color[0], obj->color[1], obj->color[2]);
-         printf("   Direction: [%f, %f, %f]\n", obj->direction[0], obj->direction[1], obj->direction[2]);
-         printf("   Spot Direction: [%f, %f, %f]\n", obj->spotDirection[0], obj->spotDirection[1], obj->spotDirection[2]);
-         printf("   Radial-a0: %f\n", obj->radialA0);
-         printf("   Radial-a1: %f\n", obj->radialA1);
-         printf("   Radial-a2: %f\n", obj->radialA2);
-         printf("   Angular-a0: %f\n", obj->angularA0);
-         printf("   Theta: %f\n\n", obj->theta);
-      }
-   }
-}
-
-// Given an origin and a direction vector, find if any intersections occur with a plane
-float getPlaneIntersection(float *origin, float *directionVector, Object *plane) {
-
-   float planeNormal[3] = {plane->normal[0], plane->normal[1], plane->normal[2]};
-   float rayD[3];
-   float temp[3];
-   v3_subtract(temp, origin, plane->position);
-   float d = v3_dot_product(planeNormal, temp);
+// Reads all of in into a new buffer, for a scene piped in with no size known up front
+static char *readStream(FILE *in, size_t *size) {
 
-   float closestT = - ((v3_dot_product(planeNormal, origin) + d) \
-                    / ( v3_dot_product(planeNormal, directionVector ) ) );
-   
+   size_t capacity = 1 << 16;
+   char *data = malloc(capacity);
 
-
-   // Intersection point behind origin (camera)
-   if (closestT < 0){
-      return -1;
+   *size = 0;
+   while(data) {
+      *size += fread(data + *size, 1, capacity - *size, in);
+      if(*size < capacity) break;
+      capacity *= 2;
+      char *grown = realloc(data, capacity);
+      if(!grown) free(data);
+      data = grown;
    }
-
-   return closestT;
+   return data;
 }
 
-// Given an origin and a direction vector, find if any intersections occur with a sphere
-float getSphereIntersection(float *origin, float *directionVector, Object *sphere) {
-
-   float a = 0;
-   float b = 0;
-   float c = 0;
-   float t0 = 1000;
-   float t1 = 1000;
-
-   // Calculating A, B, and, C for t value
-   float dVectorX = directionVector[0];
-   float dVectorY = directionVector[1];
-   float dVectorZ = directionVector[2];
-   a = 1;
-   b = 2 * (dVectorX * (origin[0] - sphere->position[0]) + \
-            dVectorY * (origin[1] - sphere->position[1]) + \
-            dVectorZ * (origin[2] - sphere->position[2]));
-   c = pow((origin[0] - sphere->position[0]), 2) + \
-       pow((origin[1] - sphere->position[1]), 2) + \
-       pow((origin[2] - sphere->position[2]), 2) - \
-       pow(sphere->radius, 2);
-
-   float discriminant = (pow(b, 2) - 4 * a * c);
-   if(discriminant < 0) {
-      return -1;
+// Has the render server at address render a job, the scene and image being "-" for stdin and stdout
+// Paths are sent absolute, since the server has a working directory of its own
+static void submitRender(char *address, int width, int height, char *inputFile, char *outputFile, int format,
+                         int aaSamples, float aaThreshold, float lightEpsilon, bool batchShadows) {
+
+   ServeJob job = {0};
+   char scenePath[PATH_MAX];
+   char outputPath[PATH_MAX];
+   char *sceneText = NULL;
+
+   if(strcmp(inputFile, "-") == 0) {
+      sceneText = readStream(stdin, &job.sceneSize);
+      if(!sceneText) help(1);
+      job.scene = sceneText;
+      job.inlineScene = true;
    }
-
-   // Calulating t values which are a magnitude, but this reduces down to a single float
-   t0 = ((-b - sqrt(discriminant)) / (2 * a));
-   t1 = ((-b + sqrt(discriminant)) / (2 * a));
-
-   float closestT = t0;
-
-   // Both t0 and t1 are behind the camera, not rendering either
-   if ( t0 <= 0 && t1 <= 0 ){
-      return -1;
-   }
-   // t0 behind the camera, t1 is closest
-   else if (t0 <= 0 && t1 > 0){
-      closestT = t1;
-   }
-   // t1 behind the camera, t0 is closest
-   else if ( t1 <= 0 && t0 > 0){
-      closestT = t0;
-   }
-   // Both t0 and t1 are in front of the camera
    else {
-      if(t0 < t1) {
-         closestT = t0;
-      }
-      else {
-         closestT = t1;
-      }
+      if(!realpath(inputFile, scenePath)) help(1);
+      job.scene = scenePath;
+      job.sceneSize = strlen(scenePath);
    }
 
-   return closestT;
-}
-
-
-void illuminate(float *color, float *R0, int closestObj) {
-
-   float illuminationColor[3] = {0, 0, 0};
-
-   // Loop through light array
-   // For each light: create light vector L, test to see if objects are in shadow or not -> determines pixel color
-   for(int lightInd = 0; lightInd < numObjects; lightInd += 1) {
-
-      float cosTheta = cos(objects[lightInd].theta);
-
-      if(objects[lightInd].kind != 4) continue;
+   if(strcmp(outputFile, "-") != 0) {
+      char cwd[PATH_MAX];
+      if(outputFile[0] == '/') snprintf(outputPath, sizeof(outputPath), "%s", outputFile);
+      else if(!getcwd(cwd, sizeof(cwd)) || snprintf(outputPath, sizeof(outputPath), "%s/%s", cwd, outputFile) >= (int)sizeof(outputPath)) help(2);
+      job.outputPath = outputPath;
+   }
 
-     
-      // Calculate new direction vector
-      float L[3];
-      v3_subtract(L, objects[lightInd].position, R0);
+   job.format = format;
+   job.width = width;
+   job.height = height;
+   job.aaSamples = aaSamples;
+   job.aaThreshold = aaThreshold;
+   job.lightEpsilon = lightEpsilon;
+   job.batchShadows = batchShadows;
+
+   if(submitJob(address, &job) != 0) {
+      fprintf(stderr, "%s\n", job.error);
+      help(4);
+   }
+   if(job.image && fwrite(job.image, 1, job.imageSize, stdout) != job.imageSize) help(2);
 
-      float lightDistance = v3_length(L);
+   // Keeps out of the way of an image on stdout
+   FILE *log = job.image ? stderr : stdout;
+   fprintf(log, "Rendered in %.2f ms: scene %s in %.2f ms, render %.2f ms, write %.2f ms, %.2f ms in the server\n",
+           job.seconds * 1000, job.sceneCached ? "cached" : "loaded", job.loadSeconds * 1000, job.renderSeconds * 1000,
+           job.writeSeconds * 1000, job.serverSeconds * 1000);
 
-      v3_normalize(L, L);
+   free(job.image);
+   free(sceneText);
+}
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char **argv) {
 
-      // Call shoot, find intersection point with light position and point
-      float t = 0;
-      {
-	      int newHitObject = 0;
-         t = shoot(R0, L, closestObj, &newHitObject);
+   char *positional[4];
+   int numPositional = 0;
+   int numThreads = defaultThreadCount();
+   int simdMode = SIMD_AUTO;
+   int outputFormat = FORMAT_P6;
+   int bandRows = 0;
+   int numFrames = 0;
+   bool compileOnly = false;
+   bool toneMapOnly = false;
+   int budgetMs = 0;
+   char *snapshotPattern = NULL;
+   char *gbufferPath = NULL;
+   float lightEpsilon = 0;
+   bool batchShadows = false;
+   int toneMapOp = TONEMAP_CLAMP;
+   float exposure = 0;
+   float gamma = 1;
+   bool dither = false;
+   char *coordinateAddress = NULL;
+   char *workerAddress = NULL;
+   bool threadsGiven = false;
+   int localWorkers = 0;
+   int tileRows = CLUSTER_DEFAULT_TILE_ROWS;
+   int tileTimeout = CLUSTER_DEFAULT_TIMEOUT;
+   char *serveAddress = NULL;
+   char *submitAddress = NULL;
+   int cacheScenes = SERVER_DEFAULT_SCENES;
+   int aaSamples = 1;
+   float aaThreshold = AA_DEFAULT_THRESHOLD;
+   bool printStats = false;
+   bool statsJson = false;
+
+   // Options may appear anywhere after the program name, everything else is positional
+   for(int argInd = 1; argInd < argc; argInd++) {
+      if(strcmp(argv[argInd], "--threads") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         numThreads = atoi(argv[++argInd]);
+         if(numThreads < 1) help(0);
+         threadsGiven = true;
       }
-
-      // Check if intersection point is lit
-      // we have an intersection, so its in the shadow
-      if(t > 0 && t < lightDistance) {
-         continue;
+      else if(strcmp(argv[argInd], "--simd") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         simdMode = parseSimdMode(argv[++argInd]);
+         if(simdMode < SIMD_AUTO) help(0);
       }
-      
-      // Calculate normal vectors
-      float normal[3] = {0,0,0};
-      if(objects[closestObj].kind == 3) {
-         normal[0] = objects[closestObj].normal[0];
-         normal[1] = objects[closestObj].normal[1]; // Plane normal
-         normal[2] = objects[closestObj].normal[2];
+      else if(strcmp(argv[argInd], "--band-rows") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         bandRows = atoi(argv[++argInd]);
+         if(bandRows < 1) help(0);
       }
-      else if(objects[closestObj].kind == 2) {
-         v3_subtract(normal, R0, objects[closestObj].position ); // Sphere normal
+      else if(strcmp(argv[argInd], "--frames") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         numFrames = atoi(argv[++argInd]);
+         if(numFrames < 1) help(0);
       }
-      v3_normalize(normal, normal);
-
-      // Calculate diffuse color
-      float nDotL = v3_dot_product(normal, L);
-
-      float diffuse[3] = {0,0,0};
-      
-      if (nDotL > 0){
-         diffuse[0] = (objects[closestObj].diffuseColor[0] * objects[lightInd].color[0] * nDotL);
-         diffuse[1] = (objects[closestObj].diffuseColor[1] * objects[lightInd].color[1] * nDotL);
-         diffuse[2] = (objects[closestObj].diffuseColor[2] * objects[lightInd].color[2] * nDotL);
+      else if(strcmp(argv[argInd], "--format") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         argInd += 1;
+         if(strcmp(argv[argInd], "p6") == 0) outputFormat = FORMAT_P6;
+         else if(strcmp(argv[argInd], "p3") == 0) outputFormat = FORMAT_P3;
+         else if(strcmp(argv[argInd], "pfm") == 0) outputFormat = FORMAT_PFM;
+         else help(0);
       }
-      else {
-         diffuse[0] = 0;
-         diffuse[1] = 0;
-         diffuse[2] = 0;
+      else if(strcmp(argv[argInd], "--time-budget") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         budgetMs = atoi(argv[++argInd]);
+         if(budgetMs < 1) help(0);
       }
-
-      // Calculate specular color
-      float V[3] = {R0[0], R0[1], R0[2]};
-
-      float R[3] = {0,0,0};
-      v3_reflect(R, L, normal);
-
-      float vDotr = v3_dot_product(V, R);
-      float specular[3] = {0,0,0};
-      
-      if ( vDotr > 0 && nDotL > 0 ){
-         specular[0] = (objects[closestObj].specularColor[0] * objects[lightInd].color[0] * pow(vDotr, 20));
-         specular[1] = (objects[closestObj].specularColor[1] * objects[lightInd].color[1] * pow(vDotr, 20));
-         specular[2] = (objects[closestObj].specularColor[2] * objects[lightInd].color[2] * pow(vDotr, 20));
+      else if(strcmp(argv[argInd], "--snapshots") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         snapshotPattern = argv[++argInd];
       }
-      else{
-         specular[0] = 0;
-         specular[1] = 0;
-         specular[2] = 0;
+      else if(strcmp(argv[argInd], "--gbuffer") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         gbufferPath = argv[++argInd];
       }
-
-
-      // Calculate radial attenuation
-      float radatt = 1 / (objects[lightInd].radialA0 + \
-                         (objects[lightInd].radialA1 * lightDistance) + \
-                         (pow(objects[lightInd].radialA2 * lightDistance, 2)));
-
-
-      /*
-
-      // Calculate angular attenuation
-      float angatt = 0;
-      float v0[3] = {0,0,0};
-      float vL[3] =  {objects[lightInd].spotDirection[0], \
-                      objects[lightInd].spotDirection[1], \
-                      objects[lightInd].spotDirection[2]};
-
-      v3_subtract(v0, R0, objects[lightInd].position);
-      v3_normalize(v0, v0);
-
-
-      float v0dotvL = v3_dot_product(v0, vL);
-      float cosAlpha = v0dotvL;
-      if (objects[lightInd].theta != 0){
-         angatt = pow(v0dotvL, objects[lightInd].angularA0);
+      else if(strcmp(argv[argInd], "--light-epsilon") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         lightEpsilon = atof(argv[++argInd]);
       }
-      else if (cosAlpha < cosTheta){
-         angatt = 0; 
+      else if(strcmp(argv[argInd], "--batch-shadows") == 0) {
+         batchShadows = true;
       }
-      else{
-         angatt = 1;
+      else if(strcmp(argv[argInd], "--tonemap") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         toneMapOp = parseToneMapOp(argv[++argInd]);
+         if(toneMapOp < 0) help(0);
       }
-      */
-
-      // Calculate return color by combining diffuse and specular color
-      illuminationColor[0] +=  radatt  * ( diffuse[0]  );
-      illuminationColor[1] +=  radatt  * ( diffuse[1]  );
-      illuminationColor[2] +=  radatt  * ( diffuse[2]  );
+      else if(strcmp(argv[argInd], "--exposure") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         exposure = atof(argv[++argInd]);
+      }
+      else if(strcmp(argv[argInd], "--gamma") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         gamma = atof(argv[++argInd]);
+      }
+      else if(strcmp(argv[argInd], "--dither") == 0) {
+         dither = true;
+      }
+      else if(strcmp(argv[argInd], "--tonemap-pfm") == 0) {
+         toneMapOnly = true;
+      }
+      else if(strcmp(argv[argInd], "--coordinate") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         coordinateAddress = argv[++argInd];
+      }
+      else if(strcmp(argv[argInd], "--worker") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         workerAddress = argv[++argInd];
+      }
+      else if(strcmp(argv[argInd], "--local-workers") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         localWorkers = atoi(argv[++argInd]);
+         if(localWorkers < 1) help(0);
+      }
+      else if(strcmp(argv[argInd], "--tile-rows") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         tileRows = atoi(argv[++argInd]);
+         if(tileRows < 1) help(0);
+      }
+      else if(strcmp(argv[argInd], "--tile-timeout") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         tileTimeout = atoi(argv[++argInd]);
+         if(tileTimeout < 1) help(0);
+      }
+      else if(strcmp(argv[argInd], "--serve") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         serveAddress = argv[++argInd];
+      }
+      else if(strcmp(argv[argInd], "--scene-cache") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         cacheScenes = atoi(argv[++argInd]);
+         if(cacheScenes < 0) help(0);
+      }
+      else if(strcmp(argv[argInd], "--submit") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         submitAddress = argv[++argInd];
+      }
+      else if(strcmp(argv[argInd], "--aa") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         aaSamples = atoi(argv[++argInd]);
+      }
+      else if(strcmp(argv[argInd], "--aa-threshold") == 0) {
+         if(argInd + 1 >= argc) help(0);
+         aaThreshold = atof(argv[++argInd]);
+      }
+      // The format is optional, --stats alone prints the readable summary
+      else if(strcmp(argv[argInd], "--stats") == 0) {
+         printStats = true;
+         if(argInd + 1 < argc && strcmp(argv[argInd + 1], "json") == 0) statsJson = true;
+         if(argInd + 1 < argc && (strcmp(argv[argInd + 1], "json") == 0 || strcmp(argv[argInd + 1], "text") == 0)) argInd += 1;
+      }
+      else if(strcmp(argv[argInd], "--compile-scene") == 0) {
+         compileOnly = true;
+      }
+      else if(numPositional < 4) {
+         positional[numPositional++] = argv[argInd];
+      }
+      else {
+         help(0);
+      }
+   }
 
+   // A submitted job whose image goes to stdout must not have anything else there
+   bool imageToStdout = submitAddress && numPositional == 4 && strcmp(positional[3], "-") == 0;
+   if(!imageToStdout) {
+      printf("\n--------------------------\n");
+      printf("Project 4 - Illumination\n");
+      printf("--------------------------\n\n");
    }
 
-   // Assign color value to return color
-   color[0] = illuminationColor[0]; // illuminationColor[0];
-   color[1] = illuminationColor[1]; // illuminationColor[1];
-   color[2] = illuminationColor[2]; // illuminationColor[2];
-}
+   // Check for too many or not enough arguments, compiling a scene only takes the input file, tone mapping a PFM file
+   // it and the output file and a worker or server none
+   if(numPositional != (workerAddress || serveAddress ? 0 : compileOnly ? 1 : toneMapOnly ? 2 : 4)) {
+      help(0);
+   }
+   // Check for starting "./raycast"
+   if(strcmp(argv[0], "./raycast") != 0) {
+      help(0);
+   }
 
-// Shoots a ray fmakerom origin using dirVector, stores any intersection into T-value
-// This function should work correctly, assuming the correct values are handed into is
-float shoot(float *origin, float *dirVector, int currentObject, int *hitObject) {
-
-   float closestT = INFINITY;
-   *hitObject = -1;
-
-   //printf("%d\n", numObjects);
-  
-   for(int objIndex = 0; objIndex < numObjects; objIndex++) {
-      
-      Object *workingObj = &objects[objIndex];
-
-      if (objects[objIndex].kind == 1) continue;
-      
-      // Skip current object
-      if(objIndex == currentObject ) {
-         continue;
-      }
-
-      // Sphere found
-      if(workingObj->kind == 2) {
-        
-         // The t values are a magnitude, this reduces down to a single float
-         float t = getSphereIntersection(origin, dirVector, workingObj);
-         
-         // Compare the current T found and closest T found to see which point is closer 
-         // If it is smaller than our current smallest, reassign
-         if (t > 0 && t < closestT){
-            
-            closestT = t;
-            *hitObject = objIndex;
-            //printf("obj index in shoot: %d\n", objIndex);
-         }
-      }
-      // Plane found
-      else if(workingObj->kind == 3) {      
-         float t = getPlaneIntersection(origin, dirVector, workingObj);  
-         if (t > 0 && t < closestT){
-
-            closestT = t;
-            *hitObject = objIndex;
-            //printf("obj index in shoot: %d\n", objIndex);
-         }
+   // A worker takes its scene and settings from the coordinator and renders until it is told to stop
+   if(workerAddress) {
+      char error[256];
+      printf("Rendering tiles for %s\n", workerAddress);
+      fflush(stdout);
+      if(runWorker(workerAddress, numThreads, simdMode, error, sizeof(error)) != 0) {
+         fprintf(stderr, "%s\n", error);
+         help(3);
       }
-
+      return 0;
    }
 
-   // No intersection found
-   if (closestT == INFINITY) return -1;
-
-   // intersection found, return the t value
-   return closestT;
-}
-
-
-
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-int main(int argc, char **argv) {
-
-   int imgWidth = atoi(argv[1]);
-   
-	int imgHeight = atoi(argv[2]);
-   uint8_t *image = malloc(sizeof(uint8_t) * imgWidth * imgHeight * 3);
+   // A server renders jobs from clients until it is stopped
+   if(serveAddress) {
+      char error[256];
+      ServerConfig config = {serveAddress, numThreads, simdMode, cacheScenes};
+      printf("Serving renders on %s with %d threads\n", serveAddress, numThreads);
+      fflush(stdout);
+      if(runServer(&config, error, sizeof(error)) != 0) {
+         fprintf(stderr, "%s\n", error);
+         help(4);
+      }
+      return 0;
+   }
 
-	char *inputFile = argv[3];
-   char *outputFile = argv[4];
+   // Workers and the server only get the settings in a job, which has no tone map
+   bool toneMapped = toneMapOp != TONEMAP_CLAMP || exposure != 0 || gamma != 1 || dither;
+
+   // Tone maps the radiance a --format pfm render wrote, without tracing anything
+   if(toneMapOnly) {
+      if(compileOnly || submitAddress || coordinateAddress || outputFormat == FORMAT_PFM) help(0);
+      rc_context *ctx = rc_context_create();
+      if(!ctx) help(5);
+      rc_context_set_simd(ctx, simdMode);
+      if(rc_context_set_tonemap(ctx, toneMapOp, exposure, gamma, dither) != RC_OK) {
+         fprintf(stderr, "%s\n", rc_error_message(ctx));
+         help(0);
+      }
+      int status = rc_tonemap_file(ctx, positional[0], positional[1], outputFormat);
+      if(status != RC_OK) {
+         fprintf(stderr, "%s\n", rc_error_message(ctx));
+         help(status == RC_ERROR_INPUT ? 1 : status == RC_ERROR_ARGUMENT ? 0 : status == RC_ERROR_MEMORY ? 5 : 2);
+      }
+      if(printStats) {
+         rc_stats stats;
+         rc_context_stats(ctx, &stats);
+         rc_stats_print(&stats, stderr, statsJson);
+      }
+      rc_context_free(ctx);
+      return 0;
+   }
 
-   char temp1[100];
-   char temp2[100];
-   char temp3[100];
+   int imgWidth = compileOnly ? 0 : atoi(positional[0]);
+   int imgHeight = compileOnly ? 0 : atoi(positional[1]);
+   char *inputFile = compileOnly ? positional[0] : positional[2];
+   char *outputFile = compileOnly ? NULL : positional[3];
 
-   FILE *inputFH = fopen(inputFile, "r");
-   FILE *outputFH = fopen(outputFile, "w");
+   // A submitted job is rendered by the server, which knows nothing of this process's settings beyond the job's
+   if(submitAddress) {
+      if(compileOnly || imgWidth < 1 || imgHeight < 1 || numFrames > 0 || budgetMs > 0 || snapshotPattern || bandRows > 0 || \
+         gbufferPath || coordinateAddress || toneMapped || outputFormat == FORMAT_PFM) {
+         help(0);
+      }
+      submitRender(submitAddress, imgWidth, imgHeight, inputFile, outputFile, outputFormat, aaSamples, aaThreshold, lightEpsilon, batchShadows);
+      return 0;
+   }
 
-   char buf[1000];
-   
+   rc_context *ctx = rc_context_create();
+   rc_scene *scene;
+   int status;
 
-   printf("\n--------------------------\n");
-   printf("Project 4 - Illumination\n");
-	printf("--------------------------\n\n");
+   if(!ctx) help(5);
 
-   // Check for too many or not enough arguments
-   if(argc != 5) {
+   rc_context_set_threads(ctx, numThreads);
+   rc_context_set_simd(ctx, simdMode);
+   rc_context_set_gbuffer(ctx, gbufferPath);
+   rc_context_set_batch_shadows(ctx, batchShadows);
+   if(rc_context_set_tonemap(ctx, toneMapOp, exposure, gamma, dither) != RC_OK) {
+      fprintf(stderr, "%s\n", rc_error_message(ctx));
       help(0);
    }
-   // Check for starting "./raycast"
-   if(strcmp(argv[0], "./raycast") != 0) {
+   if(rc_context_set_aa(ctx, aaSamples, aaThreshold) != RC_OK) {
+      fprintf(stderr, "%s\n", rc_error_message(ctx));
       help(0);
    }
 
-   //fgets(asd, 100, inputFH);
    // Check for valid input.json/input.cvs file
-   if(!inputFH) {
-      help(1);
+   status = rc_scene_load(ctx, inputFile, compileOnly ? 0 : RC_LOAD_CACHE, &scene);
+   if(status != RC_OK) {
+      fprintf(stderr, "%s\n", rc_error_message(ctx));
+      help(status == RC_ERROR_MEMORY ? 5 : 1);
    }
-   // Check for valid output.ppm file
-   if(!outputFH) {
-      help(2);
+   if(rc_scene_from_cache(scene)) {
+      printf("Using scene cache %s%s\n\n", inputFile, SCENE_CACHE_SUFFIX);
    }
 
-
-   float camWidth, camHeight;
-
-   float spherePos[3];
-   float radius;
-   float diffuseColor[3];
-   float specularColor[3];
-
-   float planePos[3];
-   float planeColor[3];
-   float planeDiffuse[3];
-   float planeSpecular[3] = {0, 0, 0};
-   float normal[3];
-
-   float lightPos[3];
-   float lightColor[3];
-   float theta, radialA0, radialA1, radialA2;
-   float spotDirection[3];
-   float angularA0;
-
-   char character;
-
-   char *firstline;
-
-   char str[1000];
-
-   int objIndex = 0;
-   Object *camera;
-   Object *sphere;
-   Object *plane;
-   Object *light;
-   Object *temp;
-   
-   // Temporary parsing variables
-   char line[1000];
-   char objectKind[10];
-   char attr1[10];
-   char attr2[10];
-   char attr3[10];
-   char attr4[10];
-   char attr5[10];
-   char attr6[10];
-   char comma[2];
-   char bracket[2];
-   float tempfloat1 = 0;
-   float tempfloat2 = 0;
-   float tempfloat3 = 0;
-   float *tempV1;
-   float *tempV2;
-   float *tempV3;
-   char *tempPtr;
-   char charTemp[2];
-
-   char delim[3] = ", ";
-
-   while(fgets(line, 1000, inputFH)) {
-
-      sscanf(line, "%s", objectKind);
-      tempPtr = line;
-
-      // Camera found
-      if (strcmp(objectKind, "camera,") == 0){
-
-         //camera = malloc(sizeof(Object));
-         camera = &objects[objIndex];
-         numObjects += 1;
-
-         sscanf(line, "%s%s%f%s%s%f", objectKind, attr1, &tempfloat1, attr2, comma, &tempfloat2);
-
-         if (strcmp(attr1, "width:") == 0){
-            camWidth = tempfloat1;
-            camHeight = tempfloat2;
-         }
-
-         else{
-            camWidth = tempfloat2;
-            camHeight = tempfloat1;
-         }
-         
-         camera->kind = 1;
-         camera->width = camWidth;
-         camera->height = camHeight;
-         //objects[objIndex] = *camera;
-      }
-
-      // Sphere found
-      else if (strcmp(objectKind, "sphere,") == 0){
-
-         //sphere = malloc(sizeof(Object));
-         sphere = &objects[objIndex];
-         numObjects += 1;
-
-         // splits the line up into an array
-         
-         tempPtr = strtok(line, delim);
-         // loop through the attributes and values from this line
-         while (tempPtr != NULL ){
-            
-            if (strcmp(tempPtr, "radius:") == 0){
-               tempPtr = strtok(NULL, delim);
-               radius = atof(tempPtr);
-            }
-
-            if (strcmp(tempPtr, "diffuse_color:") == 0){
- 
-               // first value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr += 1;
-               diffuseColor[0] = atof(tempPtr);
-
-               // second value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               diffuseColor[1] = atof(tempPtr);
-      
-               // third value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr[strlen(tempPtr) - 1] = '\0';
-               diffuseColor[2] = atof(tempPtr);
-            }
-
-            if (strcmp(tempPtr, "specular_color:") == 0){
-
-               // first value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr += 1;
-               specularColor[0] = atof(tempPtr);
-
-               // second value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               specularColor[1] = atof(tempPtr);
-      
-               // third value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr[strlen(tempPtr) - 1] = '\0';
-               specularColor[2] = atof(tempPtr);
-            }
-
-            if (strcmp(tempPtr, "position:") == 0){
-  
-               // first value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr += 1;
-               spherePos[0] = atof(tempPtr);
-
-               // second value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               spherePos[1] = atof(tempPtr);
-      
-               // third value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr[strlen(tempPtr) - 1] = '\0';
-               spherePos[2] = atof(tempPtr);
-            }
-            
-            sphere->kind = 2;
-            sphere->radius = radius;
-            sphere->diffuseColor[0] = diffuseColor[0];
-            sphere->diffuseColor[1] = diffuseColor[1];
-            sphere->diffuseColor[2] = diffuseColor[2];
-            sphere->specularColor[0] = specularColor[0];
-            sphere->specularColor[1] = specularColor[1];
-            sphere->specularColor[2] = specularColor[2];
-            sphere->position[0] = spherePos[0];
-            sphere->position[1] = spherePos[1];
-            sphere->position[2] = spherePos[2];
-            //objects[objIndex] = *sphere;
-            
-            tempPtr = strtok(NULL, delim);
-         }
-      }
-      // Plane found
-      else if (strcmp(objectKind, "plane,") == 0){
-
-         //plane = malloc(sizeof(Object));
-         plane = &objects[objIndex];
-         numObjects += 1;
-
-         // splits the line up into an array
-         char delim[3] = ", ";
-         tempPtr = strtok(line, delim);
-         // loop through the attributes and values from this line
-         while (tempPtr != NULL ){
-            
-            if (strcmp(tempPtr, "color:") == 0){
-
-               // first value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr += 1;
-               planeColor[0] = atof(tempPtr);
-
-               // second value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               planeColor[1] = atof(tempPtr);
-      
-               // third value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr[strlen(tempPtr) - 1] = '\0';
-               planeColor[2] = atof(tempPtr);
-            }
-
-            if (strcmp(tempPtr, "diffuse_color:") == 0){
-
-               // first value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr += 1;
-               planeDiffuse[0] = atof(tempPtr);
-
-               // second value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               planeDiffuse[1] = atof(tempPtr);
-      
-               // third value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr[strlen(tempPtr) - 1] = '\0';
-               planeDiffuse[2] = atof(tempPtr);
-            }
-
-            if (strcmp(tempPtr, "specular_color:") == 0){
-
-               // first value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr += 1;
-               planeSpecular[0] = atof(tempPtr);
-
-               // second value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               planeSpecular[1] = atof(tempPtr);
-	       printf("ps: %f\n", planeSpecular[1]);
-      
-               // third value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr[strlen(tempPtr) - 1] = '\0';
-               planeSpecular[2] = atof(tempPtr);
-            }
-
-            if (strcmp(tempPtr, "position:") == 0){
-    
-               // first value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr += 1;
-               planePos[0] = atof(tempPtr);
-
-               // second value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               planePos[1] = atof(tempPtr);
-      
-               // third value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr[strlen(tempPtr) - 1] = '\0';
-               planePos[2] = atof(tempPtr);
-
-            }
-
-            if (strcmp(tempPtr, "normal:") == 0){
-
-               // first value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr += 1;
-               normal[0] = atof(tempPtr);
-
-               // second value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               normal[1] = atof(tempPtr);
-      
-               // third value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr[strlen(tempPtr) - 1] = '\0';
-               normal[2] = atof(tempPtr);
-
-            }
-
-            plane->kind = 3;
-            plane->position[0] = planePos[0];
-            plane->position[1] = planePos[1];
-            plane->position[2] = planePos[2];
-            plane->normal[0] = normal[0];
-            plane->normal[1] = normal[1];
-            plane->normal[2] = normal[2];
-            plane->diffuseColor[0] = planeDiffuse[0];
-            plane->diffuseColor[1] = planeDiffuse[1];
-            plane->diffuseColor[2] = planeDiffuse[2];
-            plane->specularColor[0] = planeSpecular[0];
-            plane->specularColor[1] = planeSpecular[1];
-            plane->specularColor[2] = planeSpecular[2];
-            //objects[objIndex] = *plane;
-
-            tempPtr = strtok(NULL, delim);
-         }
-      }
-      // Light found
-      else if (strcmp(objectKind, "light,") == 0) {
-
-         //light = malloc(sizeof(Object));
-         light = &objects[objIndex];
-         numObjects += 1;
-
-         // splits the line up into an array
-         char delim[3] = ", ";
-         tempPtr = strtok(line, delim);
-         // loop through the attributes and values from this line
-         while (tempPtr != NULL ){
-
-            if (strcmp(tempPtr, "color:") == 0){
-
-               // first value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr += 1;
-               lightColor[0] = atof(tempPtr);
-
-               // second value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               lightColor[1] = atof(tempPtr);
-      
-               // third value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr[strlen(tempPtr) - 1] = '\0';
-               lightColor[2] = atof(tempPtr);
-            }
-
-            if (strcmp(tempPtr, "theta:") == 0){
-               //printf("%s\n", tempPtr);
-               tempPtr = strtok(NULL, delim);
-               theta = atof(tempPtr);
-            }
-
-            if (strcmp(tempPtr, "radial-a2:") == 0){
-               tempPtr = strtok(NULL, delim);
-               radialA2 = atof(tempPtr);
-            }
-
-            if (strcmp(tempPtr, "radial-a1:") == 0){
-               //printf("%s\n", tempPtr);
-               tempPtr = strtok(NULL, delim);
-               radialA1 = atof(tempPtr);
-            }
-
-            if (strcmp(tempPtr, "radial-a0:") == 0){
-               //printf("%s\n", tempPtr);
-               tempPtr = strtok(NULL, delim);
-               radialA0 = atof(tempPtr);
-            }
-
-            if (strcmp(tempPtr, "position:") == 0){
-
-               // first value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr += 1;
-               lightPos[0] = atof(tempPtr);
-
-               // second value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               lightPos[1] = atof(tempPtr);
-      
-               // third value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr[strlen(tempPtr) - 1] = '\0';
-               lightPos[2] = atof(tempPtr);
-            }
-
-            if (strcmp(tempPtr, "angular-a0:") == 0){
-               //printf("%s\n", tempPtr);
-               tempPtr = strtok(NULL, delim);
-               angularA0 = atof(tempPtr);
-            }
-
-            if (strcmp(tempPtr, "direction:") == 0){
-
-               // first value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr += 1;
-               spotDirection[0] = atof(tempPtr);
-
-               // second value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               spotDirection[1] = atof(tempPtr);
-      
-               // third value at tempPtr
-               tempPtr = strtok(NULL, delim);
-               tempPtr[strlen(tempPtr) - 1] = '\0';
-               spotDirection[2] = atof(tempPtr);
-            }
-
-            light->kind = 4;
-            light->position[0] = lightPos[0];
-            light->position[1] = lightPos[1];
-            light->position[2] = lightPos[2];
-            light->spotDirection[0] = spotDirection[0];
-            light->spotDirection[1] = spotDirection[1];
-            light->spotDirection[2] = spotDirection[2];
-            light->color[0] = lightColor[0];
-            light->color[1] = lightColor[1];
-            light->color[2] = lightColor[2];
-            light->theta = theta;
-            light->radialA0 = radialA0;
-            light->radialA1 = radialA1;
-            light->radialA2 = radialA2;
-            light->angularA0 = angularA0;
-            //objects[objIndex] = *light;
-            tempPtr = strtok(NULL, delim);
-         }
-      }
-      
-      tempPtr = strtok(line, delim);
-      objIndex += 1;
+   if(compileOnly) {
+      if(rc_scene_write_cache(ctx, scene) != RC_OK) {
+         fprintf(stderr, "%s\n", rc_error_message(ctx));
+         help(2);
+      }
+      printf("Wrote scene cache %s%s (%d objects)\n", inputFile, SCENE_CACHE_SUFFIX, rc_scene_num_objects(scene));
+      rc_scene_free(scene);
+      rc_context_free(ctx);
+      return 0;
    }
 
-   displayObjects(objects, numObjects);
-
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
+   // Check for valid image size, sequences and progressive renders are written whole so they can't be streamed in bands
+   // and a G-buffer holds the one frame of an ordinary render
+   bool progressive = budgetMs > 0 || snapshotPattern;
+   // A distributed render hands out bands of rows itself and doesn't keep a G-buffer
+   // A PFM file is written bottom row first, only ever whole and by one process
+   if(imgWidth < 1 || imgHeight < 1 || ((numFrames > 0 || progressive) && bandRows > 0) || (numFrames > 0 && progressive) || \
+      (gbufferPath && (numFrames > 0 || progressive)) || \
+      (coordinateAddress && (numFrames > 0 || progressive || bandRows > 0 || gbufferPath || toneMapped)) || (localWorkers > 0 && !coordinateAddress) || \
+      (outputFormat == FORMAT_PFM && (numFrames > 0 || progressive || bandRows > 0 || coordinateAddress))) {
+      help(0);
+   }
 
-   int imgX, imgY;
+   status = rc_scene_set_light_epsilon(ctx, scene, lightEpsilon);
+   if(status != RC_OK) {
+      fprintf(stderr, "%s\n", rc_error_message(ctx));
+      help(status == RC_ERROR_MEMORY ? 5 : 0);
+   }
 
-   float pixelWidth = camWidth / imgWidth;
-   float pixelHeight = camHeight / imgHeight;
+   rc_scene_print(scene, stdout);
 
-   // objIndex = 0;
-   Object *workingObj = NULL;
-   float rayOrigin[3] = {0, 0, 0};
-   float directionVector[3];
-   float closestT = 1000;
-   float currentT = 1000;
-   float p[3];
-   int imageArrInd = 0;
-   
    // Goes throughout each pixel, checking for intersections
    // Once intersection is found, color pixel with respective color
-   // printf("Closest object index: %d\n\n", closestObjIndex);
-   
-   for(imgY = 0; imgY < imgHeight; imgY += 1) {
-
-      for(imgX = imgWidth; imgX > 0; imgX -= 1) {
-
-         p[0] = 0 - (camWidth / 2) + pixelWidth * (imgX + 0.5);
-         p[1] = 0 - (camHeight / 2) + pixelHeight * (imgY + 0.5);
-         p[2] = -1;
-
-         float tempColor[3];
-
-         // Calculating Direction Vector
-         v3_subtract(directionVector, p, rayOrigin);
-         v3_normalize(directionVector, directionVector);
-         
-         //closestObjIndex = 0;
-         // Finding which intersection point is closest to camera for every pixel
-         int hitObject;
-         closestT = shoot(rayOrigin, directionVector, closestObjIndex, &hitObject);
-
-
-         //printf("closest T: %f\n", closestT);
-         float illumColor[3] = {0,0,0};
-         // Plane or Sphere found
-         if(closestT > 0) {
-	         float intersectCoords[3] = { rayOrigin[0] + (directionVector[0] * closestT), \
-                                         rayOrigin[1] + (directionVector[1] * closestT), \
-                                         rayOrigin[2] + (directionVector[2] * closestT) };
-            
-            // Calculating new color after illuminating with light
-            illuminate(illumColor, intersectCoords, hitObject);
-
-            // For Illuminate, change diffuseColor -> illumColor
-            tempColor[0] = illumColor[0];
-            tempColor[1] = illumColor[1];
-            tempColor[2] = illumColor[2];
-         }
-         // None Type found
-         else {
-            tempColor[0] = 0;
-            tempColor[1] = 0;
-            tempColor[2] = 0;
-         }
-
-         // Placing the color values into the image array to be written to PPM
-         image[imageArrInd + 0] = clamp(tempColor[0]) * 255;
-         image[imageArrInd + 1] = clamp(tempColor[1]) * 255;
-         image[imageArrInd + 2] = clamp(tempColor[2]) * 255;
-
-         imageArrInd += 3;
+   // A sequence names its files with the output file as a pattern, e.g. frame%04d.ppm
+   if(coordinateAddress) {
+      ClusterJob job = {0};
+      job.address = coordinateAddress;
+      job.scenePath = inputFile;
+      job.outputPath = outputFile;
+      job.format = outputFormat;
+      job.width = imgWidth;
+      job.height = imgHeight;
+      job.tileRows = tileRows;
+      job.aaSamples = aaSamples;
+      job.aaThreshold = aaThreshold;
+      job.lightEpsilon = lightEpsilon;
+      job.batchShadows = batchShadows;
+      job.timeoutSeconds = tileTimeout;
+      job.localWorkers = localWorkers;
+      // Local workers share the machine unless told otherwise
+      job.workerThreads = numThreads;
+      if(localWorkers > 0 && !threadsGiven) job.workerThreads = numThreads / localWorkers > 1 ? numThreads / localWorkers : 1;
+      job.simdMode = simdMode;
+
+      // Workers forked from here must not flush what is buffered for this process
+      fflush(stdout);
+      if(coordinateRender(&job) != 0) {
+         fprintf(stderr, "%s\n", job.error);
+         help(3);
       }
+      printf("Rendered %d tiles on %d workers in %.0f ms, %d tiles retried after %d worker failures\n",
+             job.numTiles, job.workersJoined, job.seconds * 1000, job.tilesRetried, job.workersFailed);
+
+      rc_scene_free(scene);
+      rc_context_free(ctx);
+      return 0;
+   }
+   else if(numFrames > 0) {
+      status = rc_render_sequence(ctx, scene, imgWidth, imgHeight, outputFile, outputFormat, numFrames);
+   }
+   else if(progressive) {
+      status = rc_render_progressive(ctx, scene, imgWidth, imgHeight, outputFile, outputFormat, budgetMs, snapshotPattern);
+   }
+   else {
+      status = rc_render_file(ctx, scene, imgWidth, imgHeight, outputFile, outputFormat, bandRows);
+   }
+   if(status != RC_OK) {
+      fprintf(stderr, "%s\n", rc_error_message(ctx));
+      help(status == RC_ERROR_ARGUMENT ? 0 : status == RC_ERROR_MEMORY ? 5 : 2);
+   }
+
+   if(status == RC_OK && progressive) {
+      rc_stats stats;
+      rc_context_stats(ctx, &stats);
+      printf("Traced %.1f%% of the pixels in %.0f ms\n", 100.0 * stats.pixelsTraced / ((double)imgWidth * imgHeight), stats.renderSeconds * 1000);
    }
-   
-   // Writing to the output.ppm file from the image array
-   int ppmWidth = imgWidth;
-   int ppmHeight = imgHeight;
-   fprintf(outputFH, "%s\n", "P3");
-   fprintf(outputFH, "%d %d\n", ppmWidth, ppmHeight);
-   fprintf(outputFH, "%d\n", 255);
-
-   for (int i = ppmWidth * ppmHeight * 3; i > 0 ; i -=3){
-      fprintf(outputFH, "%d %d %d\n", image[i + 0], image[i + 1], image[i + 2]);
+
+   // Whether the G-buffer saved tracing, and what changed since it was recorded
+   if(gbufferPath) {
+      rc_stats stats;
+      rc_context_stats(ctx, &stats);
+      printf("G-buffer %s: %s", gbufferPath, (stats.gbuffer & GBUFFER_REUSED) ? "shaded from the recorded hits" : "recorded");
+      if(stats.gbuffer & GBUFFER_VIEW_CHANGED) printf(", view changed");
+      if(stats.gbuffer & GBUFFER_GEOMETRY_CHANGED) printf(", geometry changed");
+      if(stats.gbuffer & GBUFFER_MATERIALS_CHANGED) printf(", materials changed");
+      if(stats.gbuffer & GBUFFER_LIGHTS_CHANGED) printf(", lights changed");
+      printf("\n");
+   }
+
+   // Goes to stderr so it doesn't mix with the object listing
+   if(printStats) {
+      rc_stats stats;
+      rc_context_stats(ctx, &stats);
+      rc_stats_print(&stats, stderr, statsJson);
    }
 
-   free(image);
-   fclose(inputFH);
-   fclose(outputFH);
+   rc_scene_free(scene);
+   rc_context_free(ctx);
 
    return 0;
 }
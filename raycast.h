@@ -1,12 +1,15 @@
 #ifndef RAYCAST_H
 #define RAYCAST_H
 
+#include <stdbool.h>
+
 
 #define NONE 0
 #define CAMERA 1
 #define SPHERE 2
 #define PLANE 3
 #define LIGHT 4
+#define KEYFRAME 5
 
 /*
 Kinds of Objects:
@@ -15,6 +18,7 @@ Kinds of Objects:
 - 2: Sphere
 - 3: Plane
 - 4: Light
+- 5: Keyframe, the position another object has at a given frame of a sequence
 */
 typedef struct Object {
    
@@ -23,6 +27,7 @@ typedef struct Object {
    float position[3];
    float diffuseColor[3];
    float specularColor[3];
+   float shininess;   // Phong exponent of a sphere or plane's highlights, 0 for none
 
    union {
       // Camera properties
@@ -49,17 +54,61 @@ typedef struct Object {
          float angularA0;
          float spotDirection[3];
       };
+      // Keyframe properties
+      struct {
+         float frame;
+         float target;   // 1 based position in the file of the object being moved
+      };
    };
 
    } Object;
 
 
+/*
+Last primitive found blocking each light. Neighbouring pixels are usually shadowed by
+the same object, so every render thread keeps one of these and tests it first. It
+also holds the thread's list of the lights that reach the point being shaded, and
+its scratch space for shading a whole tile at once.
+*/
+typedef struct ShadowCache {
+   int *lastOccluder;   // Indexed by the light's position among the scene's lights, -1 if unknown
+   int *gathered;       // Room for every light, filled by gatherLights()
+   int numLights;
+   struct ShadowBatch *batch;   // NULL until illuminateBatch() first runs
+} ShadowCache;
+
+/*
+A shadow ray from a shaded point toward a light, traced together with others toward
+the same light by occludedBatch().
+*/
+typedef struct ShadowRay {
+   float origin[3];
+   float direction[3];   // Unit length
+   float maxT;           // Distance to the light
+   int exclude;          // Primitive the ray leaves from
+} ShadowRay;
+
+// Most shadow rays occludedBatch() traces together, one bit each of its masks
+#define SHADOW_BATCH 32
+
+
+// Primary rays start at the camera, so there is no primitive for them to skip
+#define NO_PRIMITIVE -1
+
+struct CompiledScene;
+struct RenderStats;
+struct GBufferSample;
+
 void help(int errno);
-void displayObjects(Object *image, int arrSize);
-float getPlaneIntersection(float *origin, float *directionVector, Object *plane);
-float getSphereIntersection(float *origin, float *directionVector, Object *sphere);
-// void illuminate(float *color, float *dirVector, float *point, int closestIndex);
-void illuminate(float *color, float *point, int closestIndex);
-float shoot(float *origin, float *dirVector, int currentObject, int *hitObject);
+float getPlaneIntersection(struct CompiledScene *scene, float *origin, float *directionVector, int planeInd);
+float getSphereIntersection(struct CompiledScene *scene, float *origin, float *directionVector, int sphereInd);
+void surfaceNormal(struct CompiledScene *scene, float *point, int closestIndex, float *normal);
+void illuminate(struct CompiledScene *scene, float *color, float *point, float *normal, float *eye, int closestIndex, ShadowCache *cache, struct RenderStats *stats);
+void illuminateBatch(struct CompiledScene *scene, struct GBufferSample *samples, float (*colors)[3], int width, int height, int stride, float *eye, ShadowCache *cache, struct RenderStats *stats);
+float shoot(struct CompiledScene *scene, float *origin, float *dirVector, int currentObject, int *hitObject, struct RenderStats *stats);
+int occludedBySpheres(struct CompiledScene *scene, float *origin, float *dirVector, float maxT, int currentObject, struct RenderStats *stats);
+void occludedBatch(struct CompiledScene *scene, ShadowRay *rays, int *order, int count, int *occluder, bool *occluded, struct RenderStats *stats);
+int initShadowCache(ShadowCache *cache, struct CompiledScene *scene);
+void freeShadowCache(ShadowCache *cache);
 
 #endif
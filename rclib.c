@@ -0,0 +1,826 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include "raycast.h"
+#include "scene.h"
+#include "scenecache.h"
+#include "animate.h"
+#include "framewriter.h"
+#include "gbuffer.h"
+#include "output.h"
+#include "parser.h"
+#include "packet.h"
+#include "stats.h"
+#include "render.h"
+#include "rclib.h"
+
+
+struct rc_context {
+   int numThreads;
+   int simdMode;        // Resolved SIMD_* mode
+   int aaGrid;
+   float aaThreshold;
+   char *gbufferPath;   // NULL for none
+   bool batchShadows;
+   RenderPool *pool;    // NULL to start numThreads threads for each render
+   ToneMap toneMap;
+   rc_stats stats;      // Of the last render
+   char error[256];
+};
+
+struct rc_scene {
+   SceneStore store;
+   CompiledScene compiled;
+   float camWidth;
+   float camHeight;
+   float camPosition[3];   // At the current frame
+   Animation animation;
+   char *cachePath;
+   uint64_t sourceHash;
+   uint64_t sourceSize;
+   bool cached;
+};
+
+struct rc_pool {
+   RenderPool *threads;
+};
+
+
+// Records the reason for a failure in ctx and passes status through
+static int fail(rc_context *ctx, int status, const char *format, ...) {
+
+   va_list args;
+   va_start(args, format);
+   vsnprintf(ctx->error, sizeof(ctx->error), format, args);
+   va_end(args);
+
+   return status;
+}
+
+rc_context *rc_context_create(void) {
+
+   rc_context *ctx = malloc(sizeof(rc_context));
+   if(!ctx) return NULL;
+
+   ctx->numThreads = defaultThreadCount();
+   ctx->simdMode = resolveSimdMode(SIMD_AUTO);
+   ctx->aaGrid = 1;
+   ctx->aaThreshold = AA_DEFAULT_THRESHOLD;
+   ctx->gbufferPath = NULL;
+   ctx->batchShadows = false;
+   ctx->pool = NULL;
+   initToneMap(&ctx->toneMap, ctx->simdMode);
+   memset(&ctx->stats, 0, sizeof(ctx->stats));
+   ctx->error[0] = '\0';
+
+   return ctx;
+}
+
+void rc_context_free(rc_context *ctx) {
+   if(!ctx) return;
+   free(ctx->gbufferPath);
+   free(ctx);
+}
+
+int rc_context_set_threads(rc_context *ctx, int numThreads) {
+   if(numThreads < 1) return fail(ctx, RC_ERROR_ARGUMENT, "thread count must be at least 1");
+   ctx->numThreads = numThreads;
+   return RC_OK;
+}
+
+// simdMode is any SIMD_* mode, SIMD_AUTO included; modes the CPU lacks fall back to a narrower one
+int rc_context_set_simd(rc_context *ctx, int simdMode) {
+   if(simdMode < SIMD_AUTO || simdMode > SIMD_AVX512) return fail(ctx, RC_ERROR_ARGUMENT, "unknown SIMD mode %d", simdMode);
+   ctx->simdMode = resolveSimdMode(simdMode);
+   ctx->toneMap.simdMode = ctx->simdMode;
+   return RC_OK;
+}
+
+// Adaptive anti-aliasing: pixels on an edge, or whose color differs from a neighbour's by more than threshold
+// in any 0 to 1 channel, are resampled samples times. samples is a square number up to 64, 1 turns it off
+int rc_context_set_aa(rc_context *ctx, int samples, float threshold) {
+
+   int grid = 1;
+   while((grid + 1) * (grid + 1) <= samples) grid += 1;
+
+   if(samples < 1 || grid * grid != samples || grid > AA_MAX_GRID) {
+      return fail(ctx, RC_ERROR_ARGUMENT, "anti-aliasing samples must be 1, 4, 9 ... up to %d", AA_MAX_GRID * AA_MAX_GRID);
+   }
+   if(!(threshold >= 0)) return fail(ctx, RC_ERROR_ARGUMENT, "anti-aliasing threshold must not be negative");
+
+   ctx->aaGrid = grid;
+   ctx->aaThreshold = threshold;
+   return RC_OK;
+}
+
+// Keeps the primary hits of rc_render() and rc_render_file() in a G-buffer file at path, NULL for none. A render
+// whose camera, image size and geometry match the ones the file was recorded for only reruns shading from it,
+// so lights and materials can change between renders; anything else traces as usual and records the file again
+int rc_context_set_gbuffer(rc_context *ctx, const char *path) {
+
+   char *copy = NULL;
+   if(path) {
+      copy = malloc(strlen(path) + 1);
+      if(!copy) return fail(ctx, RC_ERROR_MEMORY, "out of memory");
+      strcpy(copy, path);
+   }
+
+   free(ctx->gbufferPath);
+   ctx->gbufferPath = copy;
+   return RC_OK;
+}
+
+// Shades each tile's first samples together once they are traced, tracing all their shadow rays toward one light
+// after another in batches sorted by direction. The image is the same either way; progressive renders ignore it
+int rc_context_set_batch_shadows(rc_context *ctx, bool enabled) {
+   ctx->batchShadows = enabled;
+   return RC_OK;
+}
+
+// Renders on the threads of pool, which any number of contexts may share at once, rather than starting
+// the context's own; the thread calling rc_render*() renders too. NULL goes back to the context's threads
+int rc_context_set_pool(rc_context *ctx, rc_pool *pool) {
+   ctx->pool = pool ? pool->threads : NULL;
+   return RC_OK;
+}
+
+// How radiance becomes bytes: scaled by 2^exposure, compressed into [0, 1] by op (TONEMAP_CLAMP, TONEMAP_REINHARD
+// or TONEMAP_ACES), raised to 1 / gamma and quantized, with dither adding up to one step of noise first. The
+// defaults are TONEMAP_CLAMP, 0, 1 and false. Also applies to rc_tonemap_file(); PFM output is never tone mapped
+int rc_context_set_tonemap(rc_context *ctx, int op, float exposure, float gamma, bool dither) {
+   if(op < TONEMAP_CLAMP || op > TONEMAP_ACES) return fail(ctx, RC_ERROR_ARGUMENT, "unknown tone map operator %d", op);
+   if(!(exposure > -64 && exposure < 64)) return fail(ctx, RC_ERROR_ARGUMENT, "exposure must be between -64 and 64 stops");
+   if(!(gamma > 0 && gamma < 100)) return fail(ctx, RC_ERROR_ARGUMENT, "gamma must be above 0 and below 100");
+
+   ctx->toneMap.op = op;
+   ctx->toneMap.exposure = exposure;
+   ctx->toneMap.gamma = gamma;
+   ctx->toneMap.dither = dither;
+   return RC_OK;
+}
+
+// Description of the last failure reported through ctx
+const char *rc_error_message(rc_context *ctx) {
+   return ctx->error;
+}
+
+// Counts and timings of the last rc_scene_load() and rc_render*() calls through ctx, zero before the first
+void rc_context_stats(rc_context *ctx, rc_stats *stats) {
+   *stats = ctx->stats;
+}
+
+// Clears what the last render recorded, keeping the load timings
+static void resetRenderStats(rc_context *ctx) {
+   rc_stats *stats = &ctx->stats;
+   double loadSeconds = stats->loadSeconds;
+   double compileSeconds = stats->compileSeconds;
+
+   memset(stats, 0, sizeof(*stats));
+   stats->counted = STATS_ENABLED;
+   stats->numThreads = ctx->pool ? renderPoolThreads(ctx->pool) + 1 : ctx->numThreads;
+   stats->loadSeconds = loadSeconds;
+   stats->compileSeconds = compileSeconds;
+}
+
+static void printRate(FILE *out, const char *name, long long count, long long total, const char *unit) {
+   fprintf(out, "   %-20s %14lld", name, count);
+   if(total > 0) fprintf(out, "   %6.2f per %s", (double)count / total, unit);
+   fprintf(out, "\n");
+}
+
+// Writes stats as a readable summary or, with json, as one JSON object
+void rc_stats_print(rc_stats *stats, FILE *out, bool json) {
+
+   long long rays = stats->primaryRays + stats->shadowRays;
+   double raysPerSecond = stats->renderSeconds > 0 ? rays / stats->renderSeconds : 0;
+
+   if(json) {
+      fprintf(out, "{\"threads\": %d, \"counted\": %s, ", stats->numThreads, stats->counted ? "true" : "false");
+      fprintf(out, "\"primary_rays\": %lld, \"shadow_rays\": %lld, \"shadow_occluded\": %lld, \"shadow_cache_hits\": %lld, ",
+              stats->primaryRays, stats->shadowRays, stats->shadowOccluded, stats->shadowCacheHits);
+      fprintf(out, "\"lights_culled\": %lld, ", stats->lightsCulled);
+      fprintf(out, "\"sphere_tests\": %lld, \"plane_tests\": %lld, \"bvh_nodes\": %lld, \"tiles\": %lld, \"aa_pixels\": %lld, ",
+              stats->sphereTests, stats->planeTests, stats->bvhNodes, stats->tiles, stats->aaPixels);
+      fprintf(out, "\"load_seconds\": %.6f, \"compile_seconds\": %.6f, \"render_seconds\": %.6f, \"store_seconds\": %.6f, \"write_seconds\": %.6f, ",
+              stats->loadSeconds, stats->compileSeconds, stats->renderSeconds, stats->storeSeconds, stats->writeSeconds);
+      fprintf(out, "\"gbuffer\": %d, \"rays_per_sec\": %.0f}\n", stats->gbuffer, raysPerSecond);
+      return;
+   }
+
+   fprintf(out, "Render statistics (%d threads):\n", stats->numThreads);
+   fprintf(out, "   %-20s %14lld\n", "Primary rays", stats->primaryRays);
+   fprintf(out, "   %-20s %14lld\n", "Shadow rays", stats->shadowRays);
+   if(stats->counted) {
+      printRate(out, "Shadow occluded", stats->shadowOccluded, stats->shadowRays, "shadow ray");
+      printRate(out, "Shadow cache hits", stats->shadowCacheHits, stats->shadowRays, "shadow ray");
+      fprintf(out, "   %-20s %14lld\n", "Lights culled", stats->lightsCulled);
+      printRate(out, "Sphere tests", stats->sphereTests, rays, "ray");
+      printRate(out, "Plane tests", stats->planeTests, rays, "ray");
+      printRate(out, "BVH nodes", stats->bvhNodes, rays, "ray");
+      fprintf(out, "   %-20s %14lld\n", "Tiles", stats->tiles);
+      fprintf(out, "   %-20s %14lld\n", "Anti-aliased pixels", stats->aaPixels);
+   }
+   else {
+      fprintf(out, "   (hot path counters were compiled out)\n");
+   }
+   fprintf(out, "Phases:\n");
+   fprintf(out, "   %-20s %11.3f ms\n", "Load", stats->loadSeconds * 1000);
+   fprintf(out, "   %-20s %11.3f ms\n", "Compile", stats->compileSeconds * 1000);
+   fprintf(out, "   %-20s %11.3f ms   %.2f Mrays/s\n", "Render", stats->renderSeconds * 1000, raysPerSecond / 1e6);
+   if(stats->counted) {
+      fprintf(out, "   %-20s %11.3f ms   thread time storing tiles\n", "Store", stats->storeSeconds * 1000);
+   }
+   fprintf(out, "   %-20s %11.3f ms\n", "Write", stats->writeSeconds * 1000);
+}
+
+// Everything rc_scene_load() and rc_scene_load_memory() do once the objects are read: finds the camera,
+// compiles the scene unless it came from a cache and poses it at frame 0; frees loaded on failure
+static int finishLoad(rc_context *ctx, rc_scene *loaded, const char *name, double loadStart, rc_scene **scene) {
+
+   // The first camera in the file decides the view plane's size
+   Object *camera = NULL;
+   for(int objIndex = 0; objIndex < loaded->store.numObjects && !camera; objIndex++) {
+      if(sceneObject(&loaded->store, objIndex)->kind == CAMERA) camera = sceneObject(&loaded->store, objIndex);
+   }
+   if(!camera) {
+      rc_scene_free(loaded);
+      return fail(ctx, RC_ERROR_INPUT, "%s: no camera in scene", name);
+   }
+   loaded->camWidth = camera->width;
+   loaded->camHeight = camera->height;
+
+   double compileStart = monotonicSeconds();
+   ctx->stats.loadSeconds = compileStart - loadStart;
+
+   if(!loaded->cached && compileScene(&loaded->compiled, &loaded->store) != 0) {
+      rc_scene_free(loaded);
+      return fail(ctx, RC_ERROR_MEMORY, "out of memory compiling %s", name);
+   }
+
+   char animationError[160];
+   int animationStatus = buildAnimation(&loaded->animation, &loaded->store, &loaded->compiled, animationError, sizeof(animationError));
+   if(animationStatus != 0) {
+      rc_scene_free(loaded);
+      if(animationStatus == -2) return fail(ctx, RC_ERROR_MEMORY, "out of memory animating %s", name);
+      return fail(ctx, RC_ERROR_INPUT, "%s: %s", name, animationError);
+   }
+   poseScene(&loaded->animation, &loaded->compiled, 0, loaded->camPosition);
+   ctx->stats.compileSeconds = monotonicSeconds() - compileStart;
+
+   *scene = loaded;
+   return RC_OK;
+}
+
+// Loads and compiles the scene file at path into a new scene stored in *scene
+// With RC_LOAD_CACHE a cache written by rc_scene_write_cache() is used when it matches the file
+int rc_scene_load(rc_context *ctx, const char *path, int flags, rc_scene **scene) {
+
+   ParseError parseError;
+   double loadStart = monotonicSeconds();
+
+   *scene = NULL;
+
+   rc_scene *loaded = calloc(1, sizeof(rc_scene));
+   size_t cachePathSize = strlen(path) + strlen(SCENE_CACHE_SUFFIX) + 1;
+   if(loaded) loaded->cachePath = malloc(cachePathSize);
+   if(!loaded || !loaded->cachePath) {
+      free(loaded);
+      return fail(ctx, RC_ERROR_MEMORY, "out of memory loading %s", path);
+   }
+   snprintf(loaded->cachePath, cachePathSize, "%s%s", path, SCENE_CACHE_SUFFIX);
+
+   if(hashSceneFile(path, &loaded->sourceHash, &loaded->sourceSize) != 0) {
+      free(loaded->cachePath);
+      free(loaded);
+      return fail(ctx, RC_ERROR_INPUT, "cannot open %s", path);
+   }
+
+   // A cache compiled from this exact scene file replaces parsing and compiling it
+   if((flags & RC_LOAD_CACHE) && loadSceneCache(loaded->cachePath, loaded->sourceHash, loaded->sourceSize, &loaded->store, &loaded->compiled) == 0) {
+      loaded->cached = true;
+   }
+   else if(loadSceneFile(path, &loaded->store, &parseError) != 0) {
+      releaseSceneStore(&loaded->store);
+      free(loaded->cachePath);
+      free(loaded);
+      if(parseError.outOfMemory) return fail(ctx, RC_ERROR_MEMORY, "out of memory loading %s", path);
+      if(parseError.line > 0) return fail(ctx, RC_ERROR_INPUT, "%s:%d: %s", path, parseError.line, parseError.message);
+      return fail(ctx, RC_ERROR_INPUT, "%s", parseError.message);
+   }
+
+   return finishLoad(ctx, loaded, path, loadStart, scene);
+}
+
+// Loads a scene from size bytes of scene file text at data, which the scene doesn't keep; name stands
+// in for the file name in error messages. A scene loaded this way has no cache file
+int rc_scene_load_memory(rc_context *ctx, const char *data, size_t size, const char *name, rc_scene **scene) {
+
+   ParseError parseError;
+   double loadStart = monotonicSeconds();
+
+   *scene = NULL;
+
+   rc_scene *loaded = calloc(1, sizeof(rc_scene));
+   if(!loaded) return fail(ctx, RC_ERROR_MEMORY, "out of memory loading %s", name);
+
+   loaded->sourceHash = hashBytes((const uint8_t *)data, size);
+   loaded->sourceSize = size;
+
+   if(loadSceneMemory(data, size, &loaded->store, &parseError) != 0) {
+      releaseSceneStore(&loaded->store);
+      free(loaded);
+      if(parseError.outOfMemory) return fail(ctx, RC_ERROR_MEMORY, "out of memory loading %s", name);
+      if(parseError.line > 0) return fail(ctx, RC_ERROR_INPUT, "%s:%d: %s", name, parseError.line, parseError.message);
+      return fail(ctx, RC_ERROR_INPUT, "%s", parseError.message);
+   }
+
+   return finishLoad(ctx, loaded, name, loadStart, scene);
+}
+
+// Writes the compiled form of scene next to the file it was loaded from
+int rc_scene_write_cache(rc_context *ctx, rc_scene *scene) {
+   if(!scene->cachePath) return fail(ctx, RC_ERROR_ARGUMENT, "a scene loaded from memory has no file to cache next to");
+   if(writeSceneCache(scene->cachePath, &scene->store, &scene->compiled, scene->sourceHash, scene->sourceSize) != 0) {
+      return fail(ctx, RC_ERROR_OUTPUT, "cannot write %s", scene->cachePath);
+   }
+   return RC_OK;
+}
+
+bool rc_scene_from_cache(rc_scene *scene) {
+   return scene->cached;
+}
+
+int rc_scene_num_objects(rc_scene *scene) {
+   return scene->store.numObjects;
+}
+
+// Last frame any keyframe of scene names, 0 for a still scene
+float rc_scene_last_frame(rc_scene *scene) {
+   return scene->animation.lastFrame;
+}
+
+// Moves the keyframed objects of scene to where they are at frame, interpolating between keyframes
+// Scenes start out at frame 0; this must not run while scene is being rendered
+int rc_scene_set_frame(rc_context *ctx, rc_scene *scene, float frame) {
+   if(frame != frame) return fail(ctx, RC_ERROR_ARGUMENT, "frame is not a number");
+   poseScene(&scene->animation, &scene->compiled, frame, scene->camPosition);
+   return RC_OK;
+}
+
+// Culls lights whose radial attenuation keeps them from adding more than epsilon to any 0 to 1 channel
+// of a shaded point, sorting the rest into a hierarchy by reach; 0, the default, culls nothing
+// Like rc_scene_set_frame(), this must not run while scene is being rendered
+int rc_scene_set_light_epsilon(rc_context *ctx, rc_scene *scene, float epsilon) {
+   if(!(epsilon >= 0 && epsilon < 1)) return fail(ctx, RC_ERROR_ARGUMENT, "light epsilon must be at least 0 and below 1");
+   if(buildLightTree(&scene->compiled.lightTree, scene->compiled.lights, scene->compiled.numLights, epsilon, scene->compiled.reflectance) != 0) {
+      return fail(ctx, RC_ERROR_MEMORY, "out of memory sorting %d lights", scene->compiled.numLights);
+   }
+   return RC_OK;
+}
+
+void rc_scene_print(rc_scene *scene, FILE *out) {
+   displayObjects(out, &scene->store);
+}
+
+void rc_scene_free(rc_scene *scene) {
+
+   if(!scene) return;
+
+   // Before the store: a cached scene's objects live in the compiled scene's mapping
+   freeAnimation(&scene->animation);
+   freeCompiledScene(&scene->compiled);
+   releaseSceneStore(&scene->store);
+   free(scene->cachePath);
+   free(scene);
+}
+
+// Starts numThreads shared render threads, 0 or more; contexts using the pool through rc_context_set_pool()
+// add the thread calling rc_render*() to them. Returns NULL when the threads can't be started
+rc_pool *rc_pool_create(int numThreads) {
+
+   if(numThreads < 0) return NULL;
+
+   rc_pool *pool = malloc(sizeof(rc_pool));
+   if(!pool) return NULL;
+
+   pool->threads = createRenderPool(numThreads);
+   if(!pool->threads) {
+      free(pool);
+      return NULL;
+   }
+   return pool;
+}
+
+// Stops the pool's threads; no context may be rendering on it
+void rc_pool_free(rc_pool *pool) {
+   if(!pool) return;
+   freeRenderPool(pool->threads);
+   free(pool);
+}
+
+static void initRenderJob(RenderJob *job, rc_context *ctx, rc_scene *scene, OutputImage *output) {
+   job->scene = &scene->compiled;
+   job->imgWidth = output->imgWidth;
+   job->imgHeight = output->imgHeight;
+   job->camWidth = scene->camWidth;
+   job->camHeight = scene->camHeight;
+   for(int axis = 0; axis < 3; axis++) job->camPosition[axis] = scene->camPosition[axis];
+   job->bandY0 = 0;
+   job->bandY1 = output->imgHeight;
+   job->numThreads = ctx->numThreads;
+   job->pool = ctx->pool;
+   job->simdMode = ctx->simdMode;
+   job->aaGrid = ctx->aaGrid;
+   job->aaThreshold = ctx->aaThreshold;
+   job->output = output;
+   job->progressive = NULL;
+   job->gbuffer = NULL;
+   job->batchShadows = ctx->batchShadows;
+   job->toneMap = ctx->toneMap;
+   job->hdr = output->format == FORMAT_PFM || toneMapNeedsRadiance(&ctx->toneMap);
+   memset(&job->stats, 0, sizeof(RenderStats));
+}
+
+// renderImage() with its counts and time added to the context's stats
+// Returns RC_OK, or RC_ERROR_MEMORY when tiles were left out for want of memory
+static int timedRender(rc_context *ctx, RenderJob *job) {
+
+   rc_stats *stats = &ctx->stats;
+   RenderStats *counts = &job->stats;
+
+   memset(counts, 0, sizeof(RenderStats));
+
+   double start = monotonicSeconds();
+   int renderStatus = renderImage(job);
+   stats->renderSeconds += monotonicSeconds() - start;
+
+   stats->primaryRays += counts->count[STAT_PRIMARY_RAYS];
+   stats->shadowRays += counts->count[STAT_SHADOW_RAYS];
+   stats->shadowOccluded += counts->count[STAT_SHADOW_OCCLUDED];
+   stats->shadowCacheHits += counts->count[STAT_SHADOW_CACHE_HITS];
+   stats->lightsCulled += counts->count[STAT_LIGHTS_CULLED];
+   stats->sphereTests += counts->count[STAT_SPHERE_TESTS];
+   stats->planeTests += counts->count[STAT_PLANE_TESTS];
+   stats->bvhNodes += counts->count[STAT_BVH_NODES];
+   stats->tiles += counts->count[STAT_TILES];
+   stats->aaPixels += counts->count[STAT_AA_PIXELS];
+   stats->storeSeconds += counts->storeSeconds;
+
+   if(renderStatus != 0) return fail(ctx, RC_ERROR_MEMORY, "out of memory setting up the render threads");
+   return RC_OK;
+}
+
+// Maps the context's G-buffer file, when it has one, for job to shade from or record into
+static int attachGBuffer(rc_context *ctx, rc_scene *scene, RenderJob *job, GBuffer *gbuffer) {
+
+   if(!ctx->gbufferPath) return RC_OK;
+
+   SceneHashes hashes;
+   hashSceneParts(&scene->compiled, scene->camWidth, scene->camHeight, scene->camPosition, job->imgWidth, job->imgHeight, &hashes);
+   if(openGBuffer(gbuffer, ctx->gbufferPath, &hashes, job->imgWidth, job->imgHeight) != 0) {
+      return fail(ctx, RC_ERROR_OUTPUT, "cannot set up G-buffer %s", ctx->gbufferPath);
+   }
+
+   job->gbuffer = gbuffer;
+   ctx->stats.gbuffer = gbuffer->changes;
+   return RC_OK;
+}
+
+// Unmaps job's G-buffer; a recorded one is only marked usable when the render finished
+static int detachGBuffer(rc_context *ctx, RenderJob *job, bool complete) {
+
+   if(!job->gbuffer) return RC_OK;
+
+   double start = monotonicSeconds();
+   int status = closeGBuffer(job->gbuffer, complete);
+   ctx->stats.writeSeconds += monotonicSeconds() - start;
+   job->gbuffer = NULL;
+
+   if(status != 0) return fail(ctx, RC_ERROR_OUTPUT, "cannot write G-buffer %s", ctx->gbufferPath);
+   return RC_OK;
+}
+
+// Renders scene at the framebuffer's size into its pixels
+int rc_render(rc_context *ctx, rc_scene *scene, rc_framebuffer *framebuffer) {
+
+   if(!framebuffer->pixels || framebuffer->width < 1 || framebuffer->height < 1) {
+      return fail(ctx, RC_ERROR_ARGUMENT, "framebuffer needs pixels and a size of at least 1x1");
+   }
+   if(framebuffer->stride != 0 && framebuffer->stride < (size_t)framebuffer->width * 3) {
+      return fail(ctx, RC_ERROR_ARGUMENT, "framebuffer stride %zu is shorter than a row", framebuffer->stride);
+   }
+
+   OutputImage output;
+   RenderJob job;
+
+   GBuffer gbuffer;
+
+   resetRenderStats(ctx);
+   openOutputBuffer(&output, framebuffer->pixels, framebuffer->width, framebuffer->height, framebuffer->stride);
+   initRenderJob(&job, ctx, scene, &output);
+   if(attachGBuffer(ctx, scene, &job, &gbuffer) != RC_OK) return RC_ERROR_OUTPUT;
+   if(timedRender(ctx, &job) != RC_OK) {
+      detachGBuffer(ctx, &job, false);
+      return RC_ERROR_MEMORY;
+   }
+
+   return detachGBuffer(ctx, &job, true);
+}
+
+// Renders rows y0 up to but not including y1 of a width x height image of scene into framebuffer, which holds
+// just those rows; they come out the same as in rc_render() of the whole image
+int rc_render_rows(rc_context *ctx, rc_scene *scene, int width, int height, int y0, int y1, rc_framebuffer *framebuffer) {
+
+   if(width < 1 || height < 1) return fail(ctx, RC_ERROR_ARGUMENT, "image size %dx%d is too small", width, height);
+   if(y0 < 0 || y1 > height || y0 >= y1) return fail(ctx, RC_ERROR_ARGUMENT, "rows %d to %d are not inside a %d row image", y0, y1, height);
+   if(!framebuffer->pixels || framebuffer->width != width || framebuffer->height != y1 - y0) {
+      return fail(ctx, RC_ERROR_ARGUMENT, "framebuffer needs pixels and a size of %dx%d", width, y1 - y0);
+   }
+   if(framebuffer->stride != 0 && framebuffer->stride < (size_t)width * 3) {
+      return fail(ctx, RC_ERROR_ARGUMENT, "framebuffer stride %zu is shorter than a row", framebuffer->stride);
+   }
+   if(ctx->gbufferPath) return fail(ctx, RC_ERROR_ARGUMENT, "a G-buffer covers the whole image, it can't be used for some of its rows");
+
+   OutputImage output;
+   RenderJob job;
+
+   resetRenderStats(ctx);
+   openOutputBuffer(&output, framebuffer->pixels, width, height, framebuffer->stride);
+   output.firstRow = y0;
+   initRenderJob(&job, ctx, scene, &output);
+   job.bandY0 = y0;
+   job.bandY1 = y1;
+
+   return timedRender(ctx, &job);
+}
+
+// Renders scene into a width x height PPM file at path in format FORMAT_P6 or FORMAT_P3, or into a PFM file of the
+// radiance before tone mapping with FORMAT_PFM, which rc_tonemap_file() can turn into a PPM later
+// bandRows > 0 streams the image in bands of that many rows instead of mapping the whole file
+int rc_render_file(rc_context *ctx, rc_scene *scene, int width, int height, const char *path, int format, int bandRows) {
+
+   if(width < 1 || height < 1) return fail(ctx, RC_ERROR_ARGUMENT, "image size %dx%d is too small", width, height);
+   if(format != FORMAT_P6 && format != FORMAT_P3 && format != FORMAT_PFM) return fail(ctx, RC_ERROR_ARGUMENT, "unknown output format %d", format);
+   if(bandRows < 0) return fail(ctx, RC_ERROR_ARGUMENT, "band rows must not be negative");
+   // PFM rows run bottom to top, so they can't be appended as they are rendered
+   if(format == FORMAT_PFM && bandRows > 0) return fail(ctx, RC_ERROR_ARGUMENT, "a PFM file can't be streamed in bands");
+
+   OutputImage output;
+   RenderJob job;
+
+   resetRenderStats(ctx);
+
+   // Streaming keeps only one band of rows in memory, otherwise the whole file is mapped
+   int outputStatus;
+   if(bandRows > 0) {
+      outputStatus = openOutputStream(&output, path, format, width, height, bandRows);
+   }
+   else {
+      outputStatus = openOutputImage(&output, path, format, width, height);
+   }
+   if(outputStatus != 0) {
+      return fail(ctx, RC_ERROR_OUTPUT, "cannot create %s", path);
+   }
+
+   initRenderJob(&job, ctx, scene, &output);
+
+   GBuffer gbuffer;
+   if(attachGBuffer(ctx, scene, &job, &gbuffer) != RC_OK) {
+      closeOutputImage(&output);
+      return RC_ERROR_OUTPUT;
+   }
+
+   if(bandRows == 0) {
+      if(timedRender(ctx, &job) != RC_OK) {
+         detachGBuffer(ctx, &job, false);
+         closeOutputImage(&output);
+         return RC_ERROR_MEMORY;
+      }
+   }
+   else {
+      for(job.bandY0 = 0; job.bandY0 < height; job.bandY0 = job.bandY1) {
+         job.bandY1 = job.bandY0 + bandRows < height ? job.bandY0 + bandRows : height;
+         if(timedRender(ctx, &job) != RC_OK) {
+            detachGBuffer(ctx, &job, false);
+            closeOutputImage(&output);
+            return RC_ERROR_MEMORY;
+         }
+
+         double start = monotonicSeconds();
+         int flushStatus = flushOutputBand(&output, job.bandY1 - job.bandY0);
+         ctx->stats.writeSeconds += monotonicSeconds() - start;
+         if(flushStatus != 0) {
+            detachGBuffer(ctx, &job, false);
+            closeOutputImage(&output);
+            return fail(ctx, RC_ERROR_OUTPUT, "cannot write %s", path);
+         }
+      }
+   }
+
+   if(detachGBuffer(ctx, &job, true) != RC_OK) {
+      closeOutputImage(&output);
+      return RC_ERROR_OUTPUT;
+   }
+
+   // Every pixel is already in place, this only has to flush the mapping
+   double start = monotonicSeconds();
+   int closeStatus = closeOutputImage(&output);
+   ctx->stats.writeSeconds += monotonicSeconds() - start;
+   if(closeStatus != 0) {
+      return fail(ctx, RC_ERROR_OUTPUT, "cannot write %s", path);
+   }
+
+   return RC_OK;
+}
+
+// Renders frames 0 .. numFrames - 1 of scene into PPM files named by pattern, which holds one %d for the
+// frame number (e.g. "frame%04d.ppm"). Each frame's file is written on a separate thread while the next
+// frame renders, and the frame buffers are reused throughout. scene is left at the last frame
+int rc_render_sequence(rc_context *ctx, rc_scene *scene, int width, int height, const char *pattern, int format, int numFrames) {
+
+   if(width < 1 || height < 1) return fail(ctx, RC_ERROR_ARGUMENT, "image size %dx%d is too small", width, height);
+   if(format != FORMAT_P6 && format != FORMAT_P3) return fail(ctx, RC_ERROR_ARGUMENT, "unknown output format %d", format);
+   if(numFrames < 1) return fail(ctx, RC_ERROR_ARGUMENT, "a sequence needs at least one frame");
+   if(!validFramePattern(pattern)) return fail(ctx, RC_ERROR_ARGUMENT, "output name %s needs exactly one %%d for the frame number", pattern);
+   if(ctx->gbufferPath) return fail(ctx, RC_ERROR_ARGUMENT, "a G-buffer holds a single frame, it can't be used for a sequence");
+
+   resetRenderStats(ctx);
+
+   FrameWriter writer;
+   if(startFrameWriter(&writer, pattern, format, width, height) != 0) {
+      return fail(ctx, RC_ERROR_MEMORY, "cannot set up %dx%d frame buffers", width, height);
+   }
+
+   int status = RC_OK;
+   for(int frame = 0; frame < numFrames && status == RC_OK; frame++) {
+
+      // Frames are written behind the render, so only the time spent waiting on the writer counts
+      int slot = frame % FRAME_BUFFERS;
+      double start = monotonicSeconds();
+      uint8_t *pixels = nextFrameBuffer(&writer, slot);
+      ctx->stats.writeSeconds += monotonicSeconds() - start;
+      if(!pixels) break;
+
+      OutputImage output;
+      RenderJob job;
+
+      poseScene(&scene->animation, &scene->compiled, frame, scene->camPosition);
+      openOutputBuffer(&output, pixels, width, height, 0);
+      initRenderJob(&job, ctx, scene, &output);
+      status = timedRender(ctx, &job);
+
+      if(status == RC_OK) submitFrame(&writer, slot, frame);
+   }
+
+   double start = monotonicSeconds();
+   int writeStatus = finishFrameWriter(&writer);
+   ctx->stats.writeSeconds += monotonicSeconds() - start;
+   if(writeStatus != 0 && status == RC_OK) {
+      return fail(ctx, RC_ERROR_OUTPUT, "cannot write every frame of %s", pattern);
+   }
+
+   return status;
+}
+
+// Renders scene into a width x height PPM file at path coarse to fine: 1/64 of the pixels first, then 1/16,
+// 1/4 and the rest, every pixel drawn from the nearest one traced so far. With budgetMs > 0 tracing stops
+// once that many milliseconds have passed and the image so far is written; only the first level is always
+// finished. snapshotPattern, when not NULL, names a file with one %d for the level (e.g. "level%d.ppm")
+// written after every level on a thread of its own
+int rc_render_progressive(rc_context *ctx, rc_scene *scene, int width, int height, const char *path, int format, int budgetMs, const char *snapshotPattern) {
+
+   if(width < 1 || height < 1) return fail(ctx, RC_ERROR_ARGUMENT, "image size %dx%d is too small", width, height);
+   if(format != FORMAT_P6 && format != FORMAT_P3) return fail(ctx, RC_ERROR_ARGUMENT, "unknown output format %d", format);
+   if(budgetMs < 0) return fail(ctx, RC_ERROR_ARGUMENT, "time budget must not be negative");
+   if(ctx->aaGrid > 1) return fail(ctx, RC_ERROR_ARGUMENT, "anti-aliasing can't be combined with a progressive render");
+   if(ctx->gbufferPath) return fail(ctx, RC_ERROR_ARGUMENT, "a G-buffer can't be combined with a progressive render");
+   if(snapshotPattern && !validFramePattern(snapshotPattern)) {
+      return fail(ctx, RC_ERROR_ARGUMENT, "snapshot name %s needs exactly one %%d for the level", snapshotPattern);
+   }
+
+   double start = monotonicSeconds();
+   resetRenderStats(ctx);
+
+   size_t numPixels = (size_t)width * height;
+   ProgressiveImage progressive;
+   progressive.samples = malloc(numPixels * 3);
+   progressive.traced = calloc(numPixels, 1);
+   uint8_t *row = malloc((size_t)width * 3);
+   if(!progressive.samples || !progressive.traced || !row) {
+      free(progressive.samples);
+      free(progressive.traced);
+      free(row);
+      return fail(ctx, RC_ERROR_MEMORY, "cannot hold the samples of a %dx%d image", width, height);
+   }
+
+   OutputImage output;
+   RenderJob job;
+   FrameWriter writer;
+   int status = RC_OK;
+
+   if(openOutputImage(&output, path, format, width, height) != 0) {
+      status = fail(ctx, RC_ERROR_OUTPUT, "cannot create %s", path);
+   }
+   else if(snapshotPattern && startFrameWriter(&writer, snapshotPattern, format, width, height) != 0) {
+      closeOutputImage(&output);
+      status = fail(ctx, RC_ERROR_MEMORY, "cannot set up %dx%d snapshot buffers", width, height);
+   }
+   if(status != RC_OK) {
+      free(progressive.samples);
+      free(progressive.traced);
+      free(row);
+      return status;
+   }
+
+   initRenderJob(&job, ctx, scene, &output);
+   job.progressive = &progressive;
+
+   int level = 0;
+   for(progressive.step = PROGRESSIVE_FIRST_STEP; progressive.step >= 1; progressive.step /= 2, level++) {
+
+      progressive.deadline = budgetMs > 0 && level > 0 ? start + budgetMs / 1000.0 : 0;
+      status = timedRender(ctx, &job);
+      if(status != RC_OK) break;
+
+      if(snapshotPattern) {
+         int slot = level % FRAME_BUFFERS;
+         double writeStart = monotonicSeconds();
+         uint8_t *pixels = nextFrameBuffer(&writer, slot);
+         if(pixels) {
+            for(int imgY = 0; imgY < height; imgY++) {
+               fillProgressiveRow(&job, imgY, pixels + (size_t)imgY * width * 3);
+            }
+            submitFrame(&writer, slot, level);
+         }
+         ctx->stats.writeSeconds += monotonicSeconds() - writeStart;
+      }
+
+      if(budgetMs > 0 && monotonicSeconds() > start + budgetMs / 1000.0) break;
+   }
+
+   double writeStart = monotonicSeconds();
+   for(int imgY = 0; imgY < height; imgY++) {
+      fillProgressiveRow(&job, imgY, row);
+      storeOutputPixels(&output, 0, imgY, row, width);
+   }
+   if(closeOutputImage(&output) != 0 && status == RC_OK) {
+      status = fail(ctx, RC_ERROR_OUTPUT, "cannot write %s", path);
+   }
+   if(snapshotPattern && finishFrameWriter(&writer) != 0 && status == RC_OK) {
+      status = fail(ctx, RC_ERROR_OUTPUT, "cannot write every snapshot of %s", snapshotPattern);
+   }
+   ctx->stats.writeSeconds += monotonicSeconds() - writeStart;
+
+   for(size_t pixel = 0; pixel < numPixels; pixel++) ctx->stats.pixelsTraced += progressive.traced[pixel];
+
+   free(progressive.samples);
+   free(progressive.traced);
+   free(row);
+
+   return status;
+}
+
+// Tone maps the radiance in the PFM file pfmPath, written by rc_render_file() with FORMAT_PFM, into a PPM file at
+// path in format FORMAT_P6 or FORMAT_P3 with the context's tone map, so the exposure or operator can be changed
+// without rendering again
+int rc_tonemap_file(rc_context *ctx, const char *pfmPath, const char *path, int format) {
+
+   if(format != FORMAT_P6 && format != FORMAT_P3) return fail(ctx, RC_ERROR_ARGUMENT, "unknown output format %d", format);
+
+   resetRenderStats(ctx);
+
+   double start = monotonicSeconds();
+   float *radiance;
+   int width, height;
+   if(readPfmImage(pfmPath, &radiance, &width, &height) != 0) {
+      return fail(ctx, RC_ERROR_INPUT, "cannot read %s as a PFM image", pfmPath);
+   }
+   ctx->stats.loadSeconds = monotonicSeconds() - start;
+
+   OutputImage output;
+   uint8_t *row = malloc((size_t)width * 3);
+   if(!row || openOutputImage(&output, path, format, width, height) != 0) {
+      free(row);
+      free(radiance);
+      return fail(ctx, row ? RC_ERROR_OUTPUT : RC_ERROR_MEMORY, "cannot create %s", path);
+   }
+
+   // The whole image in one pass, a row at a time
+   start = monotonicSeconds();
+   for(int imgY = 0; imgY < height; imgY++) {
+      toneMapPixels(&ctx->toneMap, radiance + (size_t)imgY * width * 3, row, width, 0, imgY);
+      storeOutputPixels(&output, 0, imgY, row, width);
+   }
+   ctx->stats.renderSeconds = monotonicSeconds() - start;
+
+   start = monotonicSeconds();
+   int closeStatus = closeOutputImage(&output);
+   ctx->stats.writeSeconds = monotonicSeconds() - start;
+
+   free(row);
+   free(radiance);
+   if(closeStatus != 0) return fail(ctx, RC_ERROR_OUTPUT, "cannot write %s", path);
+   return RC_OK;
+}
@@ -0,0 +1,105 @@
+#ifndef RCLIB_H
+#define RCLIB_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+Library interface to the ray caster. Nothing in it touches process wide state or
+exits: every call reports an RC_* status and leaves a description of the last
+failure in its context.
+
+- An rc_context holds render settings and the last error; use one per thread
+- An rc_scene is read only once loaded, so any number of threads may render it at
+  the same time, each through its own context; only rc_scene_set_frame() and
+  rc_render_sequence() move its keyframed objects
+- An rc_pool holds render threads that contexts from any thread may share, instead
+  of each render starting threads of its own
+*/
+
+// Status codes
+#define RC_OK 0
+#define RC_ERROR_ARGUMENT 1   // A parameter is out of range
+#define RC_ERROR_INPUT 2      // The scene file can't be read, doesn't parse or has no camera
+#define RC_ERROR_OUTPUT 3     // The output file can't be written
+#define RC_ERROR_MEMORY 4
+
+// rc_scene_load() flags
+#define RC_LOAD_CACHE 1       // Map a matching compiled cache next to the scene file instead of parsing it
+
+typedef struct rc_context rc_context;
+typedef struct rc_scene rc_scene;
+typedef struct rc_pool rc_pool;
+
+// Caller owned RGB image, 3 bytes per pixel with row 0 at the top
+typedef struct rc_framebuffer {
+   uint8_t *pixels;
+   int width;
+   int height;
+   size_t stride;   // Bytes from one row to the next, 0 when rows are packed
+} rc_framebuffer;
+
+/*
+What the last scene load and the last render through a context did, from
+rc_context_stats(). Counts are summed over the render threads. The hot path counters
+are left at zero, and counted is false, when the library was built with -DNO_STATS.
+*/
+typedef struct rc_stats {
+   long long primaryRays;
+   long long shadowRays;
+   bool counted;
+   long long shadowOccluded;
+   long long shadowCacheHits;   // Shadow rays answered by the last occluder of their light
+   long long lightsCulled;      // Lights skipped at shaded points they can't reach, see rc_scene_set_light_epsilon()
+   long long sphereTests;
+   long long planeTests;
+   long long bvhNodes;
+   long long tiles;
+   long long aaPixels;          // Pixels resampled by anti-aliasing
+   long long pixelsTraced;      // Pixels a progressive render traced, 0 for other renders
+   int gbuffer;                 // GBUFFER_* flags from gbuffer.h saying how the G-buffer was used, 0 without one
+   int numThreads;
+   double loadSeconds;      // Reading and parsing the scene file, or mapping its cache
+   double compileSeconds;   // Building the compiled scene and its animation
+   double renderSeconds;    // Tracing and shading
+   double storeSeconds;     // Part of renderSeconds spent storing finished tiles, summed over threads
+   double writeSeconds;     // Flushing or waiting on the output file(s) after the pixels were done
+} rc_stats;
+
+rc_context *rc_context_create(void);
+void rc_context_free(rc_context *ctx);
+int rc_context_set_threads(rc_context *ctx, int numThreads);
+int rc_context_set_simd(rc_context *ctx, int simdMode);
+int rc_context_set_aa(rc_context *ctx, int samples, float threshold);
+int rc_context_set_gbuffer(rc_context *ctx, const char *path);
+int rc_context_set_batch_shadows(rc_context *ctx, bool enabled);
+int rc_context_set_pool(rc_context *ctx, rc_pool *pool);
+int rc_context_set_tonemap(rc_context *ctx, int op, float exposure, float gamma, bool dither);
+const char *rc_error_message(rc_context *ctx);
+void rc_context_stats(rc_context *ctx, rc_stats *stats);
+void rc_stats_print(rc_stats *stats, FILE *out, bool json);
+
+int rc_scene_load(rc_context *ctx, const char *path, int flags, rc_scene **scene);
+int rc_scene_load_memory(rc_context *ctx, const char *data, size_t size, const char *name, rc_scene **scene);
+int rc_scene_write_cache(rc_context *ctx, rc_scene *scene);
+bool rc_scene_from_cache(rc_scene *scene);
+int rc_scene_num_objects(rc_scene *scene);
+float rc_scene_last_frame(rc_scene *scene);
+int rc_scene_set_frame(rc_context *ctx, rc_scene *scene, float frame);
+int rc_scene_set_light_epsilon(rc_context *ctx, rc_scene *scene, float epsilon);
+void rc_scene_print(rc_scene *scene, FILE *out);
+void rc_scene_free(rc_scene *scene);
+
+rc_pool *rc_pool_create(int numThreads);
+void rc_pool_free(rc_pool *pool);
+
+int rc_render(rc_context *ctx, rc_scene *scene, rc_framebuffer *framebuffer);
+int rc_render_rows(rc_context *ctx, rc_scene *scene, int width, int height, int y0, int y1, rc_framebuffer *framebuffer);
+int rc_render_file(rc_context *ctx, rc_scene *scene, int width, int height, const char *path, int format, int bandRows);
+int rc_render_sequence(rc_context *ctx, rc_scene *scene, int width, int height, const char *pattern, int format, int numFrames);
+int rc_render_progressive(rc_context *ctx, rc_scene *scene, int width, int height, const char *path, int format, int budgetMs, const char *snapshotPattern);
+int rc_tonemap_file(rc_context *ctx, const char *pfmPath, const char *path, int format);
+
+#endif
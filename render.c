@@ -0,0 +1,823 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <math.h>
+#include "v3math.h"
+#include "raycast.h"
+#include "scene.h"
+#include "output.h"
+#include "packet.h"
+#include "stats.h"
+#include "gbuffer.h"
+#include "render.h"
+
+// Edge length of the region of first samples a tile traces, which with anti-aliasing
+// includes a one pixel ring of its neighbours' pixels
+#define TILE_REGION (TILE_SIZE + 2)
+
+
+/*
+Tiles are dealt out to the workers up front in contiguous runs. A worker pops from the
+tail of its own queue and, once that runs dry, steals from the head of another worker's
+queue, so the threads that drew the cheap background tiles end up helping with the
+expensive tiles covering the objects.
+*/
+typedef struct TileQueue {
+   pthread_mutex_t lock;
+   int *tiles;
+   int head;   // Thieves take from here
+   int tail;   // The owning worker pops from here
+} TileQueue;
+
+typedef struct Worker {
+   RenderJob *job;
+   TileQueue *queues;
+   int numWorkers;
+   int id;
+   ShadowCache shadowCache;
+   RenderStats stats;
+   pthread_t thread;
+} Worker;
+
+/*
+A job being rendered on a RenderPool. Its tiles are handed out in order, one at a
+time, to whichever thread asks next; the thread that submitted it renders them too,
+and waits until the last one is finished.
+*/
+typedef struct PoolJob {
+   RenderJob *job;
+   long id;              // Tells the threads when to reset their shadow caches
+   int numTiles;
+   int nextTile;         // Next tile to hand out
+   int tilesLeft;        // Tiles not finished yet
+   bool failed;          // A thread had no memory for a shadow cache and skipped tiles
+   pthread_cond_t finished;
+   struct PoolJob *next;
+} PoolJob;
+
+/*
+Render threads that live as long as the pool, shared by every job submitted to it.
+Jobs with tiles left to hand out wait in a list, and each thread takes a tile from
+the first and moves it to the back, so jobs submitted while a large one renders
+share the threads with it instead of waiting for it.
+*/
+struct RenderPool {
+   pthread_mutex_t lock;
+   pthread_cond_t work;   // Signalled when a job is submitted or the pool is stopping
+   PoolJob *first;
+   PoolJob *last;
+   long nextId;
+   bool stopping;
+   int numThreads;
+   pthread_t *threads;
+};
+
+
+float clamp(float v) {
+  if (v > 1) return 1;
+  if (v < 0) return 0;
+  return v;
+}
+
+int defaultThreadCount(void) {
+   long count = sysconf(_SC_NPROCESSORS_ONLN);
+   if(count < 1) return 1;
+   return (int)count;
+}
+
+// Unit normal of primitive closestObj at point R0 on its surface
+void surfaceNormal(CompiledScene *scene, float *R0, int closestObj, float *normal) {
+   if(closestObj >= scene->numSpheres) {
+      int planeInd = closestObj - scene->numSpheres;
+      normal[0] = scene->planeNX[planeInd];
+      normal[1] = scene->planeNY[planeInd]; // Plane normal, already unit length
+      normal[2] = scene->planeNZ[planeInd];
+   }
+   else {
+      normal[0] = R0[0] - scene->sphereX[closestObj];
+      normal[1] = R0[1] - scene->sphereY[closestObj]; // Sphere normal
+      normal[2] = R0[2] - scene->sphereZ[closestObj];
+      v3_normalize(normal, normal);
+   }
+}
+
+// Direction of the primary ray through the center of pixel (imgX, imgY)
+// Image rows run top to bottom while the view plane's y axis points up
+// The view plane sits one unit in front of the camera, wherever the camera is
+// (subX, subY) is where in the pixel the ray passes, from its top left corner; (0.5, 0.5) is the center
+static void primaryRay(RenderJob *job, int imgX, int imgY, double subX, double subY, float *directionVector) {
+
+   float pixelWidth = job->camWidth / job->imgWidth;
+   float pixelHeight = job->camHeight / job->imgHeight;
+   int planeY = job->imgHeight - 1 - imgY;
+
+   float rayOrigin[3] = {0, 0, 0};
+   float p[3];
+
+   p[0] = 0 - (job->camWidth / 2) + pixelWidth * (imgX + subX);
+   p[1] = 0 - (job->camHeight / 2) + pixelHeight * (planeY + (1 - subY));
+   p[2] = -1;
+
+   // Calculating Direction Vector
+   v3_subtract(directionVector, p, rayOrigin);
+   v3_normalize(directionVector, directionVector);
+}
+
+// Colors a point the way shadeSample() does; closestT is 0 when its ray hit nothing
+static void shadePoint(RenderJob *job, float *point, float *normal, float closestT, int hitObject, ShadowCache *cache, RenderStats *stats, float *color) {
+
+   float tempColor[3] = {0, 0, 0};
+
+   // Plane or Sphere found
+   if(closestT > 0) {
+      // Calculating new color after illuminating with light
+      illuminate(job->scene, tempColor, point, normal, job->camPosition, hitObject, cache, stats);
+   }
+
+   // The tone map may need what is above 1, otherwise samples are clamped before anti-aliasing averages them
+   if(job->hdr) {
+      memcpy(color, tempColor, sizeof(tempColor));
+      return;
+   }
+   color[0] = clamp(tempColor[0]);
+   color[1] = clamp(tempColor[1]);
+   color[2] = clamp(tempColor[2]);
+}
+
+// Colors a sample from the closest hit of its primary ray, each channel clamped to [0, 1] unless job->hdr
+// When record isn't NULL the hit is stored there as well, for later renders to shade again; with
+// job->batchShadows shading is then left to illuminateBatch() once the whole tile is recorded
+static void shadeSample(RenderJob *job, float *directionVector, float closestT, int hitObject, ShadowCache *cache, RenderStats *stats, float *color, GBufferSample *record) {
+
+   float *rayOrigin = job->camPosition;
+   float intersectCoords[3] = {0, 0, 0};
+   float normal[3] = {0, 0, 0};
+
+   if(closestT > 0) {
+      intersectCoords[0] = rayOrigin[0] + (directionVector[0] * closestT);
+      intersectCoords[1] = rayOrigin[1] + (directionVector[1] * closestT);
+      intersectCoords[2] = rayOrigin[2] + (directionVector[2] * closestT);
+
+      // The normal and material only depend on the hit, not on the light
+      surfaceNormal(job->scene, intersectCoords, hitObject, normal);
+   }
+
+   if(record) {
+      record->hitObject = hitObject;
+      record->t = closestT > 0 ? closestT : 0;
+      memcpy(record->point, intersectCoords, sizeof(intersectCoords));
+      memcpy(record->normal, normal, sizeof(normal));
+      if(job->batchShadows) return;
+   }
+
+   shadePoint(job, intersectCoords, normal, closestT, hitObject, cache, stats, color);
+}
+
+// Shoots one primary ray through (imgX + subX, imgY + subY) and shades it into color, recording the hit in record if given
+// Returns the primitive the ray hit, or -1
+static int traceSample(RenderJob *job, int imgX, int imgY, double subX, double subY, ShadowCache *cache, RenderStats *stats, float *color, GBufferSample *record) {
+
+   float *rayOrigin = job->camPosition;
+   float directionVector[3];
+
+   primaryRay(job, imgX, imgY, subX, subY, directionVector);
+
+   // Finding which intersection point is closest to camera
+   int hitObject;
+   float closestT = shoot(job->scene, rayOrigin, directionVector, NO_PRIMITIVE, &hitObject, stats);
+   stats->count[STAT_PRIMARY_RAYS] += 1;
+
+   shadeSample(job, directionVector, closestT, hitObject, cache, stats, color, record);
+   return hitObject;
+}
+
+// Shoots the primary ray through the center of pixel (imgX, imgY) and stores its tone mapped color in rgb
+void renderPixel(RenderJob *job, int imgX, int imgY, ShadowCache *cache, RenderStats *stats, uint8_t *rgb) {
+   float color[3];
+   traceSample(job, imgX, imgY, 0.5, 0.5, cache, stats, color, NULL);
+   toneMapPixels(&job->toneMap, color, rgb, 1, imgX, imgY);
+}
+
+// Traces every step'th pixel of every step'th row of [x0, x1) x [y0, y1), starting at (x0, y0), in packets of
+// job->simdMode's block shape into colors and hits, and into records unless it is NULL, stride entries per row of samples
+// Lanes falling outside the range repeat a pixel inside it and are not written back
+static void tracePackets(RenderJob *job, int x0, int y0, int x1, int y1, int step, ShadowCache *cache, RenderStats *stats, float (*colors)[3], int *hits, GBufferSample *records, int stride) {
+
+   int width = simdPacketWidth(job->simdMode);
+   int packetWidth, packetHeight;
+   simdPacketShape(job->simdMode, &packetWidth, &packetHeight);
+
+   float *rayOrigin = job->camPosition;
+   float dirX[MAX_PACKET_WIDTH], dirY[MAX_PACKET_WIDTH], dirZ[MAX_PACKET_WIDTH];
+   float closestT[MAX_PACKET_WIDTH];
+   int hitObject[MAX_PACKET_WIDTH];
+
+   // The last sample of each row and column, repeated by lanes past the edge
+   int lastX = x0 + (x1 - 1 - x0) / step * step;
+   int lastY = y0 + (y1 - 1 - y0) / step * step;
+
+   for(int blockY = y0; blockY < y1; blockY += packetHeight * step) {
+      for(int blockX = x0; blockX < x1; blockX += packetWidth * step) {
+
+         for(int lane = 0; lane < width; lane++) {
+            int imgX = blockX + lane % packetWidth * step;
+            int imgY = blockY + lane / packetWidth * step;
+            float directionVector[3];
+            primaryRay(job, imgX < x1 ? imgX : lastX, imgY < y1 ? imgY : lastY, 0.5, 0.5, directionVector);
+            dirX[lane] = directionVector[0];
+            dirY[lane] = directionVector[1];
+            dirZ[lane] = directionVector[2];
+         }
+
+         tracePrimaryPacket(job->simdMode, job->scene, rayOrigin, dirX, dirY, dirZ, closestT, hitObject, stats);
+         stats->count[STAT_PRIMARY_RAYS] += width;
+
+         for(int lane = 0; lane < width; lane++) {
+            int imgX = blockX + lane % packetWidth * step;
+            int imgY = blockY + lane / packetWidth * step;
+            if(imgX >= x1 || imgY >= y1) continue;
+
+            float directionVector[3] = {dirX[lane], dirY[lane], dirZ[lane]};
+            int index = (imgY - y0) / step * stride + (imgX - x0) / step;
+            shadeSample(job, directionVector, closestT[lane], hitObject[lane], cache, stats, colors[index], records ? &records[index] : NULL);
+            hits[index] = hitObject[lane];
+         }
+      }
+   }
+}
+
+// One sample through the center of the same pixels tracePackets() covers, stored the same way
+static void traceRegion(RenderJob *job, int x0, int y0, int x1, int y1, int step, ShadowCache *cache, RenderStats *stats, float (*colors)[3], int *hits, GBufferSample *records, int stride) {
+
+   if(job->simdMode != SIMD_SCALAR) {
+      tracePackets(job, x0, y0, x1, y1, step, cache, stats, colors, hits, records, stride);
+      return;
+   }
+
+   for(int imgY = y0; imgY < y1; imgY += step) {
+      for(int imgX = x0; imgX < x1; imgX += step) {
+         int index = (imgY - y0) / step * stride + (imgX - x0) / step;
+         hits[index] = traceSample(job, imgX, imgY, 0.5, 0.5, cache, stats, colors[index], records ? &records[index] : NULL);
+      }
+   }
+}
+
+// Shades the first samples of [x0, x1) x [y0, y1) from the hits a G-buffer recorded, stored as traceRegion() does
+// Recorded points are bit for bit the ones tracing finds, so the colors come out the same
+// With job->batchShadows the hits are only copied into records, for illuminateBatch() to shade
+static void replayRegion(RenderJob *job, int x0, int y0, int x1, int y1, ShadowCache *cache, RenderStats *stats, float (*colors)[3], int *hits, GBufferSample *records, int stride) {
+
+   GBuffer *gbuffer = job->gbuffer;
+
+   for(int imgY = y0; imgY < y1; imgY++) {
+      GBufferSample *row = &gbuffer->samples[(size_t)imgY * gbuffer->width];
+      for(int imgX = x0; imgX < x1; imgX++) {
+         GBufferSample *sample = &row[imgX];
+         int index = (imgY - y0) * stride + imgX - x0;
+         if(job->batchShadows) records[index] = *sample;
+         else shadePoint(job, sample->point, sample->normal, sample->t, sample->hitObject, cache, stats, colors[index]);
+         hits[index] = sample->hitObject;
+      }
+   }
+}
+
+// Whether two neighbouring first samples see different primitives or colors further apart than threshold
+static bool samplesDiffer(float *a, float *b, int hitA, int hitB, float threshold) {
+   if(hitA != hitB) return true;
+   for(int channel = 0; channel < 3; channel++) {
+      if(fabsf(a[channel] - b[channel]) > threshold) return true;
+   }
+   return false;
+}
+
+// Hash of a pixel and sample number, so the jitter is the same whichever thread renders the pixel
+static uint32_t sampleHash(int imgX, int imgY, int sample) {
+   uint32_t h = (uint32_t)imgX * 0x8da6b343u ^ (uint32_t)imgY * 0xd8163841u ^ (uint32_t)sample * 0xcb1ab31fu;
+   h ^= h >> 16;
+   h *= 0x7feb352du;
+   h ^= h >> 15;
+   h *= 0x846ca68bu;
+   h ^= h >> 16;
+   return h;
+}
+
+// Replaces the color of pixel (imgX, imgY) with the mean of job->aaGrid x job->aaGrid jittered stratified samples
+static void refinePixel(RenderJob *job, int imgX, int imgY, ShadowCache *cache, RenderStats *stats, float *color) {
+
+   int grid = job->aaGrid;
+   float sum[3] = {0, 0, 0};
+
+   for(int cellY = 0; cellY < grid; cellY++) {
+      for(int cellX = 0; cellX < grid; cellX++) {
+         uint32_t jitter = sampleHash(imgX, imgY, cellY * grid + cellX);
+         double subX = (cellX + (jitter & 0xffff) / 65536.0) / grid;
+         double subY = (cellY + (jitter >> 16) / 65536.0) / grid;
+
+         float sample[3];
+         traceSample(job, imgX, imgY, subX, subY, cache, stats, sample, NULL);
+         sum[0] += sample[0];
+         sum[1] += sample[1];
+         sum[2] += sample[2];
+      }
+   }
+
+   color[0] = sum[0] / (grid * grid);
+   color[1] = sum[1] / (grid * grid);
+   color[2] = sum[2] / (grid * grid);
+}
+
+// Traces the pixels of the tile on the progressive level's lattice that no coarser level traced
+// The first level is one lattice of its step, traced in one pass
+// Below the first level those are the three offsets (step, 0), (0, step) and (step, step) of the coarser
+// level's lattice, each a lattice of twice the step, so they are traced in packets like a whole tile
+// Tile corners are multiples of TILE_SIZE, so they lie on every level's lattice
+static void traceLatticeTile(RenderJob *job, int x0, int y0, int x1, int y1, ShadowCache *cache, RenderStats *stats) {
+
+   ProgressiveImage *progressive = job->progressive;
+   int step = progressive->step;
+   bool first = step == PROGRESSIVE_FIRST_STEP;
+   int spacing = first ? step : 2 * step;
+
+   float colors[TILE_SIZE * TILE_SIZE][3];
+   int hits[TILE_SIZE * TILE_SIZE];
+
+   for(int offset = first ? 0 : 1; offset < (first ? 1 : 4); offset++) {
+
+      // Stopping between offsets keeps the overshoot to a quarter of a tile's samples per thread
+      if(progressive->deadline > 0 && monotonicSeconds() > progressive->deadline) return;
+
+      int sx0 = x0 + (offset & 1) * step;
+      int sy0 = y0 + (offset >> 1) * step;
+      if(sx0 >= x1 || sy0 >= y1) continue;
+
+      traceRegion(job, sx0, sy0, x1, y1, spacing, cache, stats, colors, hits, NULL, TILE_SIZE);
+
+      for(int imgY = sy0; imgY < y1; imgY += spacing) {
+         for(int imgX = sx0; imgX < x1; imgX += spacing) {
+            size_t pixel = (size_t)imgY * job->imgWidth + imgX;
+            toneMapPixels(&job->toneMap, colors[(imgY - sy0) / spacing * TILE_SIZE + (imgX - sx0) / spacing], &progressive->samples[pixel * 3],
+                          1, imgX, imgY);
+            progressive->traced[pixel] = 1;
+         }
+      }
+   }
+}
+
+// Draws row imgY of a progressive render into rgb, each pixel taking the traced sample nearest to it
+// on the finest lattice that has one; the first level is always complete, so one is always found
+void fillProgressiveRow(RenderJob *job, int imgY, uint8_t *rgb) {
+
+   ProgressiveImage *progressive = job->progressive;
+   int width = job->imgWidth;
+
+   for(int imgX = 0; imgX < width; imgX++) {
+
+      size_t source = (size_t)imgY * width + imgX;
+
+      for(int step = 1; step <= PROGRESSIVE_FIRST_STEP; step *= 2) {
+
+         // Nearest lattice point, or the one at the block's corner when that isn't traced or is off the image
+         int nearX = (imgX + step / 2) / step * step;
+         int nearY = (imgY + step / 2) / step * step;
+         if(nearX < width && nearY < job->imgHeight && progressive->traced[(size_t)nearY * width + nearX]) {
+            source = (size_t)nearY * width + nearX;
+            break;
+         }
+
+         size_t corner = (size_t)(imgY / step * step) * width + imgX / step * step;
+         if(progressive->traced[corner]) {
+            source = corner;
+            break;
+         }
+      }
+
+      rgb[imgX * 3] = progressive->samples[source * 3];
+      rgb[imgX * 3 + 1] = progressive->samples[source * 3 + 1];
+      rgb[imgX * 3 + 2] = progressive->samples[source * 3 + 2];
+   }
+}
+
+// Tiles are numbered row by row starting at the top of the band
+static void renderTile(RenderJob *job, int tile, ShadowCache *cache, RenderStats *stats) {
+
+   int tilesX = (job->imgWidth + TILE_SIZE - 1) / TILE_SIZE;
+   int x0 = (tile % tilesX) * TILE_SIZE;
+   int y0 = job->bandY0 + (tile / tilesX) * TILE_SIZE;
+   int x1 = x0 + TILE_SIZE < job->imgWidth ? x0 + TILE_SIZE : job->imgWidth;
+   int y1 = y0 + TILE_SIZE < job->bandY1 ? y0 + TILE_SIZE : job->bandY1;
+
+   // Progressive levels keep their samples until the level is done
+   if(job->progressive) {
+      traceLatticeTile(job, x0, y0, x1, y1, cache, stats);
+      STAT_ADD(stats, STAT_TILES, 1);
+      return;
+   }
+
+   // First samples of the tile, and with anti-aliasing of the pixels bordering it as well,
+   // so deciding which pixels to refine never depends on another tile
+   float colors[TILE_REGION * TILE_REGION][3];
+   int hits[TILE_REGION * TILE_REGION];
+   int rx0 = x0, ry0 = y0, rx1 = x1, ry1 = y1;
+
+   if(job->aaGrid > 1) {
+      rx0 = x0 > 0 ? x0 - 1 : 0;
+      ry0 = y0 > 0 ? y0 - 1 : 0;
+      rx1 = x1 < job->imgWidth ? x1 + 1 : x1;
+      ry1 = y1 < job->imgHeight ? y1 + 1 : y1;
+   }
+
+   // A G-buffer either stands in for the primary rays or records them; the ring of neighbouring
+   // pixels is left for the tiles it belongs to, so no sample is written by two threads
+   // Batched shading records the hits the same way, then shades them all at once
+   GBuffer *gbuffer = job->gbuffer;
+   GBufferSample records[TILE_REGION * TILE_REGION];
+   if(gbuffer && gbuffer->replay) {
+      replayRegion(job, rx0, ry0, rx1, ry1, cache, stats, colors, hits, records, TILE_REGION);
+   }
+   else if(gbuffer) {
+      traceRegion(job, rx0, ry0, rx1, ry1, 1, cache, stats, colors, hits, records, TILE_REGION);
+      for(int imgY = y0; imgY < y1; imgY++) {
+         memcpy(&gbuffer->samples[(size_t)imgY * gbuffer->width + x0], &records[(imgY - ry0) * TILE_REGION + x0 - rx0],
+                sizeof(GBufferSample) * (x1 - x0));
+      }
+   }
+   else {
+      traceRegion(job, rx0, ry0, rx1, ry1, 1, cache, stats, colors, hits, job->batchShadows ? records : NULL, TILE_REGION);
+   }
+
+   if(job->batchShadows) {
+      illuminateBatch(job->scene, records, colors, rx1 - rx0, ry1 - ry0, TILE_REGION, job->camPosition, cache, stats);
+      for(int row = 0; row < ry1 - ry0 && !job->hdr; row++) {
+         for(int index = row * TILE_REGION; index < row * TILE_REGION + rx1 - rx0; index++) {
+            colors[index][0] = clamp(colors[index][0]);
+            colors[index][1] = clamp(colors[index][1]);
+            colors[index][2] = clamp(colors[index][2]);
+         }
+      }
+   }
+
+   // Final colors of the tile's rows, TILE_SIZE pixels apart
+   float tileColors[TILE_SIZE * TILE_SIZE][3];
+
+   for(int imgY = y0; imgY < y1; imgY++) {
+      for(int imgX = x0; imgX < x1; imgX++) {
+
+         int index = (imgY - ry0) * TILE_REGION + imgX - rx0;
+         float *color = colors[index];
+
+         // Supersample pixels on an edge between primitives or across a sharp change in shading
+         if(job->aaGrid > 1) {
+            bool edge = (imgX > rx0 && samplesDiffer(color, colors[index - 1], hits[index], hits[index - 1], job->aaThreshold)) ||
+                        (imgX + 1 < rx1 && samplesDiffer(color, colors[index + 1], hits[index], hits[index + 1], job->aaThreshold)) ||
+                        (imgY > ry0 && samplesDiffer(color, colors[index - TILE_REGION], hits[index], hits[index - TILE_REGION], job->aaThreshold)) ||
+                        (imgY + 1 < ry1 && samplesDiffer(color, colors[index + TILE_REGION], hits[index], hits[index + TILE_REGION], job->aaThreshold));
+            if(edge) {
+               refinePixel(job, imgX, imgY, cache, stats, tileColors[(imgY - y0) * TILE_SIZE + imgX - x0]);
+               STAT_ADD(stats, STAT_AA_PIXELS, 1);
+               continue;
+            }
+         }
+
+         memcpy(tileColors[(imgY - y0) * TILE_SIZE + imgX - x0], color, sizeof(float) * 3);
+      }
+   }
+
+   // Finished rows go straight to their place in the output file, as radiance or tone mapped a row at a time
+#if STATS_ENABLED
+   double storeStart = monotonicSeconds();
+#endif
+   uint8_t rowBytes[TILE_SIZE * 3];
+   for(int imgY = y0; imgY < y1; imgY++) {
+      float *row = tileColors[(imgY - y0) * TILE_SIZE];
+      if(job->output->format == FORMAT_PFM) {
+         storeOutputRadiance(job->output, x0, imgY, row, x1 - x0);
+         continue;
+      }
+      toneMapPixels(&job->toneMap, row, rowBytes, x1 - x0, x0, imgY);
+      storeOutputPixels(job->output, x0, imgY, rowBytes, x1 - x0);
+   }
+#if STATS_ENABLED
+   stats->storeSeconds += monotonicSeconds() - storeStart;
+#endif
+   STAT_ADD(stats, STAT_TILES, 1);
+}
+
+void addRenderStats(RenderStats *total, RenderStats *stats) {
+   for(int counter = 0; counter < NUM_STATS; counter++) {
+      total->count[counter] += stats->count[counter];
+   }
+   total->storeSeconds += stats->storeSeconds;
+}
+
+static bool popTile(TileQueue *queue, int *tile) {
+
+   bool found = false;
+
+   pthread_mutex_lock(&queue->lock);
+   if(queue->tail > queue->head) {
+      *tile = queue->tiles[--queue->tail];
+      found = true;
+   }
+   pthread_mutex_unlock(&queue->lock);
+
+   return found;
+}
+
+static bool stealTile(TileQueue *queue, int *tile) {
+
+   bool found = false;
+
+   pthread_mutex_lock(&queue->lock);
+   if(queue->tail > queue->head) {
+      *tile = queue->tiles[queue->head++];
+      found = true;
+   }
+   pthread_mutex_unlock(&queue->lock);
+
+   return found;
+}
+
+static void *workerMain(void *arg) {
+
+   Worker *worker = arg;
+   int tile;
+
+   for(;;) {
+      if(popTile(&worker->queues[worker->id], &tile)) {
+         renderTile(worker->job, tile, &worker->shadowCache, &worker->stats);
+         continue;
+      }
+
+      // Own queue is empty, try every other worker once before giving up
+      // No tiles are ever added after start up, so one empty sweep means we are done
+      bool stolen = false;
+      for(int i = 1; i < worker->numWorkers && !stolen; i++) {
+         int victim = (worker->id + i) % worker->numWorkers;
+         stolen = stealTile(&worker->queues[victim], &tile);
+      }
+      if(!stolen) break;
+
+      renderTile(worker->job, tile, &worker->shadowCache, &worker->stats);
+   }
+
+   return NULL;
+}
+
+// Takes the next tile of the first job in pool's list, or of own when it is set, and moves the job to the back
+// of the list, or off it once every tile is handed out; called with the lock held
+static PoolJob *takePoolTile(RenderPool *pool, PoolJob *own, int *tile) {
+
+   PoolJob *poolJob = own ? own : pool->first;
+   if(!poolJob || poolJob->nextTile == poolJob->numTiles) return NULL;
+
+   *tile = poolJob->nextTile++;
+
+   // Unlink it, then put it back at the end when it still has tiles
+   PoolJob **link = &pool->first;
+   while(*link != poolJob) link = &(*link)->next;
+   *link = poolJob->next;
+   if(pool->last == poolJob) {
+      pool->last = NULL;
+      for(PoolJob *other = pool->first; other; other = other->next) pool->last = other;
+   }
+   poolJob->next = NULL;
+   if(poolJob->nextTile < poolJob->numTiles) {
+      if(pool->last) pool->last->next = poolJob;
+      else pool->first = poolJob;
+      pool->last = poolJob;
+   }
+
+   return poolJob;
+}
+
+// Renders tile of poolJob with a shadow cache for its scene, then counts it as finished; called without the lock
+static void renderPoolTile(RenderPool *pool, PoolJob *poolJob, int tile, ShadowCache *cache, long *cacheJob) {
+
+   RenderStats stats;
+
+   // Occluders and gathered lights belong to one scene
+   if(*cacheJob != poolJob->id) {
+      if(*cacheJob >= 0) freeShadowCache(cache);
+      *cacheJob = initShadowCache(cache, poolJob->job->scene) == 0 ? poolJob->id : -1;
+   }
+
+   memset(&stats, 0, sizeof(stats));
+   if(*cacheJob >= 0) renderTile(poolJob->job, tile, cache, &stats);
+
+   pthread_mutex_lock(&pool->lock);
+   if(*cacheJob < 0) poolJob->failed = true;
+   addRenderStats(&poolJob->job->stats, &stats);
+   if(--poolJob->tilesLeft == 0) pthread_cond_signal(&poolJob->finished);
+   pthread_mutex_unlock(&pool->lock);
+}
+
+static void *poolThreadMain(void *arg) {
+
+   RenderPool *pool = arg;
+   ShadowCache cache;
+   long cacheJob = -1;
+   int tile;
+
+   pthread_mutex_lock(&pool->lock);
+   for(;;) {
+      PoolJob *poolJob = takePoolTile(pool, NULL, &tile);
+      if(!poolJob) {
+         if(pool->stopping) break;
+         pthread_cond_wait(&pool->work, &pool->lock);
+         continue;
+      }
+      pthread_mutex_unlock(&pool->lock);
+      renderPoolTile(pool, poolJob, tile, &cache, &cacheJob);
+      pthread_mutex_lock(&pool->lock);
+   }
+   pthread_mutex_unlock(&pool->lock);
+
+   if(cacheJob >= 0) freeShadowCache(&cache);
+   return NULL;
+}
+
+// Renders job's tiles on the pool's threads and the calling thread, returning once they are all done
+// Returns 0 on success and -1 when a thread was out of memory and some tiles were left out
+static int renderOnPool(RenderJob *job, int numTiles) {
+
+   RenderPool *pool = job->pool;
+   PoolJob poolJob;
+   ShadowCache cache;
+   long cacheJob = -1;
+   int tile;
+
+   // A job without tiles would sit at the front of the list with nothing to hand out
+   if(numTiles == 0) return 0;
+
+   poolJob.job = job;
+   poolJob.numTiles = numTiles;
+   poolJob.nextTile = 0;
+   poolJob.tilesLeft = numTiles;
+   poolJob.failed = false;
+   poolJob.next = NULL;
+   pthread_cond_init(&poolJob.finished, NULL);
+
+   pthread_mutex_lock(&pool->lock);
+   poolJob.id = pool->nextId++;
+   if(pool->last) pool->last->next = &poolJob;
+   else pool->first = &poolJob;
+   pool->last = &poolJob;
+   pthread_cond_broadcast(&pool->work);
+
+   // The caller only works on its own job, so it is never held up by a larger one
+   while(takePoolTile(pool, &poolJob, &tile)) {
+      pthread_mutex_unlock(&pool->lock);
+      renderPoolTile(pool, &poolJob, tile, &cache, &cacheJob);
+      pthread_mutex_lock(&pool->lock);
+   }
+   while(poolJob.tilesLeft > 0) pthread_cond_wait(&poolJob.finished, &pool->lock);
+   pthread_mutex_unlock(&pool->lock);
+
+   pthread_cond_destroy(&poolJob.finished);
+   if(cacheJob >= 0) freeShadowCache(&cache);
+
+   return poolJob.failed ? -1 : 0;
+}
+
+// Renders rows [job->bandY0, job->bandY1) into job->output, splitting them into tiles across job->numThreads threads,
+// or across the threads of job->pool when it has one
+// The output does not depend on the thread count: every pixel is computed the same way
+// Returns 0 on success and -1 when out of memory, in which case some or all of the tiles are missing
+int renderImage(RenderJob *job) {
+
+   int tilesX = (job->imgWidth + TILE_SIZE - 1) / TILE_SIZE;
+   int tilesY = (job->bandY1 - job->bandY0 + TILE_SIZE - 1) / TILE_SIZE;
+   int numTiles = tilesX * tilesY;
+   int numWorkers = job->numThreads;
+
+   if(numWorkers > numTiles) numWorkers = numTiles;
+
+   if(job->pool) {
+      return renderOnPool(job, numTiles);
+   }
+
+   // Serial path
+   if(numWorkers <= 1) {
+      ShadowCache shadowCache;
+      if(initShadowCache(&shadowCache, job->scene) != 0) return -1;
+      for(int tile = 0; tile < numTiles; tile++) {
+         renderTile(job, tile, &shadowCache, &job->stats);
+      }
+      freeShadowCache(&shadowCache);
+      return 0;
+   }
+
+   int *tiles = malloc(sizeof(int) * numTiles);
+   TileQueue *queues = malloc(sizeof(TileQueue) * numWorkers);
+   Worker *workers = malloc(sizeof(Worker) * numWorkers);
+
+   // Every worker's shadow cache is set up before any thread starts, so running out of memory stops nothing
+   int numCaches = 0;
+   if(tiles && queues && workers) {
+      while(numCaches < numWorkers && initShadowCache(&workers[numCaches].shadowCache, job->scene) == 0) numCaches++;
+   }
+   if(numCaches < numWorkers) {
+      for(int i = 0; i < numCaches; i++) freeShadowCache(&workers[i].shadowCache);
+      free(workers);
+      free(queues);
+      free(tiles);
+      return -1;
+   }
+
+   for(int tile = 0; tile < numTiles; tile++) {
+      tiles[tile] = tile;
+   }
+
+   for(int i = 0; i < numWorkers; i++) {
+      pthread_mutex_init(&queues[i].lock, NULL);
+      queues[i].tiles = tiles;
+      queues[i].head = (int)((long)numTiles * i / numWorkers);
+      queues[i].tail = (int)((long)numTiles * (i + 1) / numWorkers);
+
+      workers[i].job = job;
+      workers[i].queues = queues;
+      workers[i].numWorkers = numWorkers;
+      workers[i].id = i;
+      memset(&workers[i].stats, 0, sizeof(RenderStats));
+   }
+
+   // The calling thread works as worker 0; the queues of workers that couldn't be started are stolen from
+   int numStarted = 1;
+   while(numStarted < numWorkers && pthread_create(&workers[numStarted].thread, NULL, workerMain, &workers[numStarted]) == 0) {
+      numStarted++;
+   }
+   workerMain(&workers[0]);
+   for(int i = 1; i < numStarted; i++) {
+      pthread_join(workers[i].thread, NULL);
+   }
+
+   for(int i = 0; i < numWorkers; i++) {
+      pthread_mutex_destroy(&queues[i].lock);
+      freeShadowCache(&workers[i].shadowCache);
+      addRenderStats(&job->stats, &workers[i].stats);
+   }
+   free(workers);
+   free(queues);
+   free(tiles);
+
+   return 0;
+}
+
+// Starts numThreads render threads, 0 or more, for jobs to share through their pool field; each job's
+// own thread renders too. Returns NULL when no thread could be started
+RenderPool *createRenderPool(int numThreads) {
+
+   RenderPool *pool = malloc(sizeof(RenderPool));
+   if(!pool) return NULL;
+
+   pool->threads = malloc(sizeof(pthread_t) * (numThreads > 0 ? numThreads : 1));
+   if(!pool->threads) {
+      free(pool);
+      return NULL;
+   }
+   pthread_mutex_init(&pool->lock, NULL);
+   pthread_cond_init(&pool->work, NULL);
+   pool->first = NULL;
+   pool->last = NULL;
+   pool->nextId = 0;
+   pool->stopping = false;
+   pool->numThreads = 0;
+
+   for(int i = 0; i < numThreads; i++) {
+      if(pthread_create(&pool->threads[pool->numThreads], NULL, poolThreadMain, pool) != 0) break;
+      pool->numThreads += 1;
+   }
+   if(pool->numThreads < numThreads) {
+      freeRenderPool(pool);
+      return NULL;
+   }
+
+   return pool;
+}
+
+int renderPoolThreads(RenderPool *pool) {
+   return pool->numThreads;
+}
+
+// Stops the pool's threads once the jobs submitted to it are done
+void freeRenderPool(RenderPool *pool) {
+
+   if(!pool) return;
+
+   pthread_mutex_lock(&pool->lock);
+   pool->stopping = true;
+   pthread_cond_broadcast(&pool->work);
+   pthread_mutex_unlock(&pool->lock);
+
+   for(int i = 0; i < pool->numThreads; i++) {
+      pthread_join(pool->threads[i], NULL);
+   }
+   pthread_cond_destroy(&pool->work);
+   pthread_mutex_destroy(&pool->lock);
+   free(pool->threads);
+   free(pool);
+}
@@ -0,0 +1,85 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdint.h>
+#include "raycast.h"
+#include "stats.h"
+#include "tonemap.h"
+
+// Edge length in pixels of the square tiles handed out to the render threads
+#define TILE_SIZE 32
+
+// Adaptive anti-aliasing: edge pixels get up to AA_MAX_GRID x AA_MAX_GRID samples
+#define AA_MAX_GRID 8
+// Progressive renders trace every PROGRESSIVE_FIRST_STEP'th pixel of every PROGRESSIVE_FIRST_STEP'th row
+// first (1/64 of the image), then halve the spacing each level down to every pixel
+#define PROGRESSIVE_FIRST_STEP 8
+#define PROGRESSIVE_LEVELS 4
+
+// Default largest per channel difference, on a 0 to 1 scale, between neighbouring pixels that isn't an edge
+#define AA_DEFAULT_THRESHOLD 0.1f
+
+/*
+Samples of a progressive render. Each level traces the pixels on a lattice of the
+given step that no coarser level traced, and once deadline has passed no more rows
+are started; every pixel is then drawn from the nearest sample traced so far.
+*/
+typedef struct ProgressiveImage {
+   uint8_t *samples;   // imgWidth x imgHeight packed RGB, set where traced is
+   uint8_t *traced;    // One per pixel
+   int step;           // Lattice spacing of the level being rendered
+   double deadline;    // monotonicSeconds() after which tracing stops, 0 for none
+} ProgressiveImage;
+
+/*
+Everything the render loop needs to know about one frame. renderImage() renders the
+rows from bandY0 up to but not including bandY1, storing pixels into output as each
+tile finishes; rows run top to bottom as they appear in the PPM file.
+
+Every pixel gets one sample through its center. With a G-buffer, those samples are
+either shaded from the hits it holds without tracing any primary rays, or traced and
+recorded into it. With batchShadows, those first samples are shaded a tile at a time
+by illuminateBatch() rather than one by one, giving the same colors. With
+anti-aliasing, a pixel whose first sample sees a different primitive than one of its
+four neighbours', or a color more than aaThreshold away in any channel, is redrawn
+as the mean of aaGrid x aaGrid jittered samples, one per cell of the pixel. The
+jitter is hashed from the pixel, so the image still does not depend on the thread
+count or the tiling. A tile's final colors are stored as radiance into a PFM output,
+or else quantized a row at a time by toneMap.
+*/
+typedef struct RenderPool RenderPool;
+
+typedef struct RenderJob {
+   struct CompiledScene *scene;   // Only read, so one scene can be shared by concurrent jobs
+   int imgWidth;
+   int imgHeight;
+   float camWidth;
+   float camHeight;
+   float camPosition[3];          // Where every primary ray starts
+   int bandY0;
+   int bandY1;
+   int numThreads;
+   RenderPool *pool;   // Threads shared with other jobs to render on instead of starting numThreads, NULL for none
+   int simdMode;       // Resolved SIMD_* mode used for primary rays
+   int aaGrid;         // Edge pixels are resampled on an aaGrid x aaGrid grid, 1 turns anti-aliasing off
+   float aaThreshold;
+   struct OutputImage *output;
+   ProgressiveImage *progressive;   // NULL except while rendering a progressive level
+   struct GBuffer *gbuffer;         // Primary hits to shade from or to record, NULL for neither
+   bool batchShadows;               // Trace each tile's shadow rays light by light in direction sorted batches
+   ToneMap toneMap;                 // Turns each finished row of a tile into bytes, unless output is a PFM file
+   bool hdr;                        // Samples keep channels above 1, for the tone map or a PFM file
+   RenderStats stats;  // Added to by every renderImage() call
+} RenderJob;
+
+float clamp(float v);
+int defaultThreadCount(void);
+void renderPixel(RenderJob *job, int imgX, int imgY, ShadowCache *cache, RenderStats *stats, uint8_t *rgb);
+void addRenderStats(RenderStats *total, RenderStats *stats);
+int renderImage(RenderJob *job);
+RenderPool *createRenderPool(int numThreads);
+int renderPoolThreads(RenderPool *pool);
+void freeRenderPool(RenderPool *pool);
+void fillProgressiveRow(RenderJob *job, int imgY, uint8_t *rgb);
+
+#endif
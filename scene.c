@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/mman.h>
+#include "v3math.h"
+#include "raycast.h"
+#include "arena.h"
+#include "bvh.h"
+#include "scene.h"
+
+// Chunk table entries reserved up front
+#define SCENE_MIN_CHUNKS 16
+
+
+static void copyMaterial(Material *material, Object *obj) {
+   for(int i = 0; i < 3; i++) {
+      material->diffuseColor[i] = obj->diffuseColor[i];
+      material->specularColor[i] = obj->specularColor[i];
+   }
+   material->shininess = obj->shininess;
+}
+
+// Scales a to unit length in place, leaving a zero vector alone
+static void normalizeSafe(float *a) {
+   if(v3_length(a) > 0) v3_normalize(a, a);
+}
+
+static void prepareLight(Light *light, Object *obj) {
+   for(int i = 0; i < 3; i++) {
+      light->position[i] = obj->position[i];
+      light->color[i] = obj->color[i];
+      light->spotDirection[i] = obj->spotDirection[i];
+   }
+   normalizeSafe(light->spotDirection);
+   light->radialA0 = obj->radialA0;
+   light->radialA1 = obj->radialA1;
+   light->radialA2 = obj->radialA2;
+   light->cosTheta = cos(obj->theta);
+   light->angularA0 = obj->angularA0;
+}
+
+// Lists every object of store and its attributes
+void displayObjects(FILE *out, SceneStore *store) {
+
+   Object *obj = NULL;
+
+   for(int i = 0; i < store->numObjects; i++) {
+
+      obj = sceneObject(store, i);
+
+      // Camera
+      if(obj->kind == 1) {
+         fprintf(out, "%d) CAMERA:\n", i + 1);
+         fprintf(out, "   Position: [%f, %f, %f]\n", obj->position[0], obj->position[1], obj->position[2]);
+         fprintf(out, "   Width: %f\n   Height: %f\n\n", obj->width, obj->height);
+      }
+      // Sphere
+      else if(obj->kind == 2) {
+         fprintf(out, "%d) SPHERE:\n", i + 1);
+         fprintf(out, "   Position: [%f, %f, %f]\n", obj->position[0], obj->position[1], obj->position[2]);
+         fprintf(out, "   Diffuse Color: [%f, %f, %f]\n", obj->diffuseColor[0], obj->diffuseColor[1], obj->diffuseColor[2]);
+         fprintf(out, "   Specular Color: [%f, %f, %f]\n", obj->specularColor[0], obj->specularColor[1], obj->specularColor[2]);
+         fprintf(out, "   Shininess: %f\n", obj->shininess);
+         fprintf(out, "   Radius: %f\n\n", obj->radius);
+      }
+      // Plane
+      else if(obj->kind == 3) {
+         fprintf(out, "%d) PLANE:\n", i + 1);
+         fprintf(out, "   Position: [%f, %f, %f]\n", obj->position[0], obj->position[1], obj->position[2]);
+         fprintf(out, "   Diffuse Color: [%f, %f, %f]\n", obj->diffuseColor[0], obj->diffuseColor[1], obj->diffuseColor[2]);
+         fprintf(out, "   Specular Color: [%f, %f, %f]\n", obj->specularColor[0], obj->specularColor[1], obj->specularColor[2]);
+         fprintf(out, "   Shininess: %f\n", obj->shininess);
+         fprintf(out, "   Normal: [%f, %f, %f]\n\n", obj->normal[0], obj->normal[1], obj->normal[2]);
+      }
+      // Light
+      else if(obj->kind == 4) {
+         fprintf(out, "%d) LIGHT:\n", i + 1);
+         fprintf(out, "   Position: [%f, %f, %f]\n", obj->position[0], obj->position[1], obj->position[2]);
+         fprintf(out, "   Color: [%f, %f, %f]\n", obj->color[0], obj->color[1], obj->color[2]);
+         fprintf(out, "   Direction: [%f, %f, %f]\n", obj->direction[0], obj->direction[1], obj->direction[2]);
+         fprintf(out, "   Spot Direction: [%f, %f, %f]\n", obj->spotDirection[0], obj->spotDirection[1], obj->spotDirection[2]);
+         fprintf(out, "   Radial-a0: %f\n", obj->radialA0);
+         fprintf(out, "   Radial-a1: %f\n", obj->radialA1);
+         fprintf(out, "   Radial-a2: %f\n", obj->radialA2);
+         fprintf(out, "   Angular-a0: %f\n", obj->angularA0);
+         fprintf(out, "   Theta: %f\n\n", obj->theta);
+      }
+      // Keyframe
+      else if(obj->kind == KEYFRAME) {
+         fprintf(out, "%d) KEYFRAME:\n", i + 1);
+         fprintf(out, "   Object: %d\n", (int)obj->target);
+         fprintf(out, "   Frame: %f\n", obj->frame);
+         fprintf(out, "   Position: [%f, %f, %f]\n\n", obj->position[0], obj->position[1], obj->position[2]);
+      }
+   }
+}
+
+// capacityHint is the number of objects expected; the arena is sized to hold that many in one block
+// Returns 0 on success and -1 when out of memory; either way releaseSceneStore() frees what there is
+int initSceneStore(SceneStore *store, size_t capacityHint) {
+
+   size_t hintChunks = (capacityHint + SCENE_CHUNK_OBJECTS - 1) / SCENE_CHUNK_OBJECTS;
+   if(hintChunks < 1) hintChunks = 1;
+
+   store->chunkCapacity = hintChunks > SCENE_MIN_CHUNKS ? (int)hintChunks : SCENE_MIN_CHUNKS;
+   store->numChunks = 0;
+   store->numObjects = 0;
+   store->chunks = NULL;
+   if(initArena(&store->arena, hintChunks * SCENE_CHUNK_OBJECTS * sizeof(Object) + store->chunkCapacity * sizeof(Object *)) != 0) {
+      return -1;
+   }
+   store->chunks = arenaAlloc(&store->arena, store->chunkCapacity * sizeof(Object *));
+
+   return store->chunks ? 0 : -1;
+}
+
+// Lets store read numObjects objects that already sit contiguously in memory, such as a mapped scene cache
+// Only the chunk table is allocated; the objects are not copied, so the store must not be added to
+// Returns 0 on success and -1 when out of memory
+int initMappedSceneStore(SceneStore *store, Object *objects, int numObjects) {
+
+   int numChunks = (numObjects + SCENE_CHUNK_OBJECTS - 1) / SCENE_CHUNK_OBJECTS;
+
+   store->chunkCapacity = numChunks > SCENE_MIN_CHUNKS ? numChunks : SCENE_MIN_CHUNKS;
+   store->numChunks = 0;
+   store->numObjects = 0;
+   store->chunks = NULL;
+   if(initArena(&store->arena, store->chunkCapacity * sizeof(Object *)) != 0) return -1;
+   store->chunks = arenaAlloc(&store->arena, store->chunkCapacity * sizeof(Object *));
+   if(!store->chunks) return -1;
+
+   for(int chunk = 0; chunk < numChunks; chunk++) {
+      store->chunks[chunk] = objects + (size_t)chunk * SCENE_CHUNK_OBJECTS;
+   }
+   store->numChunks = numChunks;
+   store->numObjects = numObjects;
+
+   return 0;
+}
+
+// Appends a zeroed object and returns it, or NULL when out of memory
+Object *addSceneObject(SceneStore *store) {
+
+   if(store->numObjects == store->numChunks * SCENE_CHUNK_OBJECTS) {
+
+      // The chunk table is the only thing that ever gets copied, the objects stay put
+      if(store->numChunks == store->chunkCapacity) {
+         Object **chunks = arenaAlloc(&store->arena, 2 * store->chunkCapacity * sizeof(Object *));
+         if(!chunks) return NULL;
+         memcpy(chunks, store->chunks, store->numChunks * sizeof(Object *));
+         store->chunks = chunks;
+         store->chunkCapacity *= 2;
+      }
+
+      Object *chunk = arenaAlloc(&store->arena, SCENE_CHUNK_OBJECTS * sizeof(Object));
+      if(!chunk) return NULL;
+      store->chunks[store->numChunks++] = chunk;
+   }
+
+   Object *obj = sceneObject(store, store->numObjects++);
+   memset(obj, 0, sizeof(Object));
+
+   return obj;
+}
+
+void releaseSceneStore(SceneStore *store) {
+   arenaRelease(&store->arena);
+   store->chunks = NULL;
+   store->numChunks = 0;
+   store->chunkCapacity = 0;
+   store->numObjects = 0;
+}
+
+// Flattens the spheres, planes and lights of store into scene, building the BVH on the way
+// Everything the render loop would otherwise recompute per ray (unit normals, plane offsets,
+// squared radii, spot cone cosines) is worked out here once
+// Returns 0 on success and -1 when out of memory, leaving what was allocated to freeCompiledScene()
+int compileScene(CompiledScene *scene, SceneStore *store) {
+
+   int numObjects = store->numObjects;
+   int numSpheres = 0;
+   int numPlanes = 0;
+   int numLights = 0;
+
+   for(int objIndex = 0; objIndex < numObjects; objIndex++) {
+      int kind = sceneObject(store, objIndex)->kind;
+      if(kind == SPHERE) numSpheres += 1;
+      else if(kind == PLANE) numPlanes += 1;
+      else if(kind == LIGHT) numLights += 1;
+   }
+
+   scene->numSpheres = numSpheres;
+   scene->numPlanes = numPlanes;
+   scene->numPrims = numSpheres + numPlanes;
+   scene->numLights = numLights;
+   scene->cacheMap = NULL;
+   scene->cacheMapSize = 0;
+   memset(&scene->lightTree, 0, sizeof(LightTree));
+   memset(&scene->bvh, 0, sizeof(BVH));
+
+   scene->sphereX = malloc(sizeof(float) * (numSpheres + 1));
+   scene->sphereY = malloc(sizeof(float) * (numSpheres + 1));
+   scene->sphereZ = malloc(sizeof(float) * (numSpheres + 1));
+   scene->sphereRadius2 = malloc(sizeof(float) * (numSpheres + 1));
+   scene->planeNX = malloc(sizeof(float) * (numPlanes + 1));
+   scene->planeNY = malloc(sizeof(float) * (numPlanes + 1));
+   scene->planeNZ = malloc(sizeof(float) * (numPlanes + 1));
+   scene->planeOffset = malloc(sizeof(float) * (numPlanes + 1));
+   scene->materials = malloc(sizeof(Material) * (scene->numPrims + 1));
+   scene->primObject = malloc(sizeof(int) * (scene->numPrims + 1));
+   scene->lights = malloc(sizeof(Light) * (numLights + 1));
+
+   // Gather the spheres in file order so the BVH can reorder them
+   int *sphereObjects = malloc(sizeof(int) * (numSpheres + 1));
+   float (*centers)[3] = malloc(sizeof(float[3]) * (numSpheres + 1));
+   float *radii = malloc(sizeof(float) * (numSpheres + 1));
+   if(!scene->sphereX || !scene->sphereY || !scene->sphereZ || !scene->sphereRadius2 || !scene->planeNX || !scene->planeNY || \
+      !scene->planeNZ || !scene->planeOffset || !scene->materials || !scene->primObject || !scene->lights || \
+      !sphereObjects || !centers || !radii) {
+      free(sphereObjects);
+      free(centers);
+      free(radii);
+      return -1;
+   }
+
+   int sphereInd = 0;
+   int planeInd = 0;
+   int lightInd = 0;
+
+   for(int objIndex = 0; objIndex < numObjects; objIndex++) {
+
+      Object *obj = sceneObject(store, objIndex);
+
+      if(obj->kind == SPHERE) {
+         sphereObjects[sphereInd] = objIndex;
+         centers[sphereInd][0] = obj->position[0];
+         centers[sphereInd][1] = obj->position[1];
+         centers[sphereInd][2] = obj->position[2];
+         radii[sphereInd] = obj->radius;
+         sphereInd += 1;
+      }
+      else if(obj->kind == PLANE) {
+         int prim = numSpheres + planeInd;
+         float normal[3] = {obj->normal[0], obj->normal[1], obj->normal[2]};
+         normalizeSafe(normal);
+         scene->planeNX[planeInd] = normal[0];
+         scene->planeNY[planeInd] = normal[1];
+         scene->planeNZ[planeInd] = normal[2];
+         scene->planeOffset[planeInd] = normal[0] * obj->position[0] + \
+                                        normal[1] * obj->position[1] + \
+                                        normal[2] * obj->position[2];
+         copyMaterial(&scene->materials[prim], obj);
+         scene->primObject[prim] = objIndex;
+         planeInd += 1;
+      }
+      else if(obj->kind == LIGHT) {
+         prepareLight(&scene->lights[lightInd], obj);
+         lightInd += 1;
+      }
+   }
+
+   if(buildBVH(&scene->bvh, centers, radii, numSpheres) != 0) {
+      free(sphereObjects);
+      free(centers);
+      free(radii);
+      return -1;
+   }
+
+   // Lay the spheres out in leaf order, a leaf then covers a contiguous run of primitive ids
+   for(int prim = 0; prim < numSpheres; prim++) {
+      int source = scene->bvh.primIndices[prim];
+      Object *obj = sceneObject(store, sphereObjects[source]);
+      scene->sphereX[prim] = centers[source][0];
+      scene->sphereY[prim] = centers[source][1];
+      scene->sphereZ[prim] = centers[source][2];
+      scene->sphereRadius2[prim] = radii[source] * radii[source];
+      copyMaterial(&scene->materials[prim], obj);
+      scene->primObject[prim] = sphereObjects[source];
+   }
+
+   free(sphereObjects);
+   free(centers);
+   free(radii);
+
+   selectShadeKernel(scene);
+
+   return 0;
+}
+
+void freeCompiledScene(CompiledScene *scene) {
+
+   freeLightTree(&scene->lightTree);
+
+   // Everything else lives in the one mapping
+   if(scene->cacheMap) {
+      munmap(scene->cacheMap, scene->cacheMapSize);
+      scene->cacheMap = NULL;
+      return;
+   }
+
+   free(scene->sphereX);
+   free(scene->sphereY);
+   free(scene->sphereZ);
+   free(scene->sphereRadius2);
+   free(scene->planeNX);
+   free(scene->planeNY);
+   free(scene->planeNZ);
+   free(scene->planeOffset);
+   free(scene->materials);
+   free(scene->primObject);
+   free(scene->lights);
+   freeBVH(&scene->bvh);
+}
@@ -0,0 +1,106 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "raycast.h"
+#include "arena.h"
+#include "bvh.h"
+#include "lighttree.h"
+#include "shade.h"
+
+// Objects per storage chunk, a power of two so a lookup is a shift and a mask
+#define SCENE_CHUNK_SHIFT 12
+#define SCENE_CHUNK_OBJECTS (1 << SCENE_CHUNK_SHIFT)
+// Rough length of one scene file line, used to guess the object count from the file size
+#define SCENE_BYTES_PER_OBJECT 80
+
+/*
+Growable storage for the parsed objects. Objects live in fixed size chunks carved
+out of an arena, so they never move once added, there is no cap on their number,
+and releaseSceneStore() frees all of them at once.
+*/
+typedef struct SceneStore {
+   Arena arena;
+   Object **chunks;
+   int numChunks;
+   int chunkCapacity;
+   int numObjects;
+} SceneStore;
+
+typedef struct Material {
+   float diffuseColor[3];
+   float specularColor[3];
+   float shininess;   // Highlight exponent, 0 when the surface has no highlights
+} Material;
+
+/*
+Everything illuminate() needs from a light, worked out once by compileScene() so the
+shading loop walks a dense array of lights instead of every object in the scene.
+*/
+typedef struct Light {
+   float position[3];
+   float color[3];
+   float radialA0;
+   float radialA1;
+   float radialA2;
+   float cosTheta;           // Cosine of the spot cone's half angle theta
+   float angularA0;
+   float spotDirection[3];   // Unit length, or zero when none was given
+} Light;
+
+/*
+Structure-of-arrays copy of the scene's geometry, built once after parsing so the
+intersection loops can stream through plain float arrays instead of branching on
+Object.kind. Primitives are numbered spheres first, in BVH leaf order, followed by
+the planes; shoot() reports hits as these primitive ids and materials[] is indexed
+by them as well.
+*/
+typedef struct CompiledScene {
+   int numSpheres;
+   float *sphereX;
+   float *sphereY;
+   float *sphereZ;
+   float *sphereRadius2;
+
+   // Plane i holds the points p with dot(normal, p) == planeOffset[i]; normals are unit length
+   int numPlanes;
+   float *planeNX;
+   float *planeNY;
+   float *planeNZ;
+   float *planeOffset;
+
+   int numPrims;
+   Material *materials;
+   int *primObject;   // Scene store index of the object each primitive was compiled from
+
+   int numLights;
+   Light *lights;     // In file order
+   LightTree lightTree;   // Empty until a light epsilon is set; never part of a scene cache
+
+   BVH bvh;
+
+   // Shading specialized for the kinds of primitives and materials above, see selectShadeKernel()
+   ShadeKernel shadeKernel;
+   ShadeBatchKernel shadeBatchKernel;
+   int shadeVariant;
+   float reflectance;   // Most a surface gives back of a channel of the light reaching it
+
+   // Set when the arrays above point into a mapped scene cache rather than the heap
+   void *cacheMap;
+   size_t cacheMapSize;
+} CompiledScene;
+
+void displayObjects(FILE *out, SceneStore *store);
+int initSceneStore(SceneStore *store, size_t capacityHint);
+int initMappedSceneStore(SceneStore *store, Object *objects, int numObjects);
+Object *addSceneObject(SceneStore *store);
+void releaseSceneStore(SceneStore *store);
+int compileScene(CompiledScene *scene, SceneStore *store);
+void freeCompiledScene(CompiledScene *scene);
+
+static inline Object *sceneObject(SceneStore *store, int index) {
+   return &store->chunks[index >> SCENE_CHUNK_SHIFT][index & (SCENE_CHUNK_OBJECTS - 1)];
+}
+
+#endif
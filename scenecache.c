@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "raycast.h"
+#include "bvh.h"
+#include "scene.h"
+#include "scenecache.h"
+
+static const char cacheMagic[8] = "RCSCENE";
+
+
+// 64 bit hash of size bytes, eight at a time; not cryptographic, only meant to notice edits and corruption
+uint64_t hashBytes(const uint8_t *data, size_t size) {
+
+   uint64_t hash = 0x84222325cbf29ce4ULL ^ size;
+   size_t i = 0;
+
+   for(; i + 8 <= size; i += 8) {
+      uint64_t word;
+      memcpy(&word, data + i, 8);
+      hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+      hash ^= hash >> 32;
+   }
+
+   uint64_t tail = 0;
+   memcpy(&tail, data + i, size - i);
+   hash = (hash ^ tail) * 0x9e3779b97f4a7c15ULL;
+   hash ^= hash >> 29;
+   hash *= 0xbf58476d1ce4e5b9ULL;
+   hash ^= hash >> 32;
+
+   return hash;
+}
+
+static size_t alignUp(size_t offset) {
+   return (offset + SCENE_CACHE_ALIGN - 1) & ~(size_t)(SCENE_CACHE_ALIGN - 1);
+}
+
+// Fills in the section sizes for scene and lays them out after the header; returns the file size
+static size_t layoutCache(SceneCacheHeader *header, size_t *sectionSize) {
+
+   int numPrims = header->numSpheres + header->numPlanes;
+
+   sectionSize[CACHE_OBJECTS] = sizeof(Object) * header->numObjects;
+   sectionSize[CACHE_SPHERE_X] = sizeof(float) * header->numSpheres;
+   sectionSize[CACHE_SPHERE_Y] = sizeof(float) * header->numSpheres;
+   sectionSize[CACHE_SPHERE_Z] = sizeof(float) * header->numSpheres;
+   sectionSize[CACHE_SPHERE_RADIUS2] = sizeof(float) * header->numSpheres;
+   sectionSize[CACHE_PLANE_NX] = sizeof(float) * header->numPlanes;
+   sectionSize[CACHE_PLANE_NY] = sizeof(float) * header->numPlanes;
+   sectionSize[CACHE_PLANE_NZ] = sizeof(float) * header->numPlanes;
+   sectionSize[CACHE_PLANE_OFFSET] = sizeof(float) * header->numPlanes;
+   sectionSize[CACHE_MATERIALS] = sizeof(Material) * numPrims;
+   sectionSize[CACHE_PRIM_OBJECT] = sizeof(int) * numPrims;
+   sectionSize[CACHE_BVH_NODES] = sizeof(BVHNode) * header->numNodes;
+   sectionSize[CACHE_BVH_PRIMS] = sizeof(int) * header->numSpheres;
+   sectionSize[CACHE_LIGHTS] = sizeof(Light) * header->numLights;
+
+   size_t offset = alignUp(sizeof(SceneCacheHeader));
+   for(int section = 0; section < CACHE_SECTIONS; section++) {
+      header->sectionOffset[section] = offset;
+      offset = alignUp(offset + sectionSize[section]);
+   }
+
+   return offset;
+}
+
+// Hashes the contents of the scene file at path; returns 0 on success and -1 if it can't be read
+int hashSceneFile(const char *path, uint64_t *hash, uint64_t *size) {
+
+   int fd = open(path, O_RDONLY);
+   if(fd < 0) return -1;
+
+   struct stat fileStat;
+   if(fstat(fd, &fileStat) != 0) {
+      close(fd);
+      return -1;
+   }
+
+   *size = fileStat.st_size;
+   if(*size == 0) {
+      close(fd);
+      *hash = hashBytes(NULL, 0);
+      return 0;
+   }
+
+   uint8_t *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if(data == MAP_FAILED) return -1;
+   madvise(data, *size, MADV_SEQUENTIAL);
+
+   *hash = hashBytes(data, *size);
+   munmap(data, *size);
+
+   return 0;
+}
+
+// Writes store and its compiled form scene to path, tagged with the hash and size of the scene file they came from
+// Returns 0 on success and -1 if the file can't be written
+int writeSceneCache(const char *path, SceneStore *store, CompiledScene *scene, uint64_t sourceHash, uint64_t sourceSize) {
+
+   SceneCacheHeader header;
+   size_t sectionSize[CACHE_SECTIONS];
+
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, cacheMagic, sizeof(header.magic));
+   header.version = SCENE_CACHE_VERSION;
+   header.objectSize = sizeof(Object);
+   header.sourceSize = sourceSize;
+   header.sourceHash = sourceHash;
+   header.numObjects = store->numObjects;
+   header.numSpheres = scene->numSpheres;
+   header.numPlanes = scene->numPlanes;
+   header.numNodes = scene->bvh.numNodes;
+   header.numLights = scene->numLights;
+   header.fileSize = layoutCache(&header, sectionSize);
+
+   int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if(fd < 0) return -1;
+
+   if(ftruncate(fd, header.fileSize) != 0) {
+      close(fd);
+      return -1;
+   }
+
+   uint8_t *map = mmap(NULL, header.fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if(map == MAP_FAILED) return -1;
+
+   // Objects go over a chunk at a time
+   Object *objects = (Object *)(map + header.sectionOffset[CACHE_OBJECTS]);
+   for(int chunk = 0; chunk < store->numChunks; chunk++) {
+      int first = chunk * SCENE_CHUNK_OBJECTS;
+      int count = store->numObjects - first < SCENE_CHUNK_OBJECTS ? store->numObjects - first : SCENE_CHUNK_OBJECTS;
+      memcpy(objects + first, store->chunks[chunk], sizeof(Object) * count);
+   }
+
+   const void *arrays[CACHE_SECTIONS] = {
+      [CACHE_SPHERE_X] = scene->sphereX,
+      [CACHE_SPHERE_Y] = scene->sphereY,
+      [CACHE_SPHERE_Z] = scene->sphereZ,
+      [CACHE_SPHERE_RADIUS2] = scene->sphereRadius2,
+      [CACHE_PLANE_NX] = scene->planeNX,
+      [CACHE_PLANE_NY] = scene->planeNY,
+      [CACHE_PLANE_NZ] = scene->planeNZ,
+      [CACHE_PLANE_OFFSET] = scene->planeOffset,
+      [CACHE_MATERIALS] = scene->materials,
+      [CACHE_PRIM_OBJECT] = scene->primObject,
+      [CACHE_BVH_NODES] = scene->bvh.nodes,
+      [CACHE_BVH_PRIMS] = scene->bvh.primIndices,
+      [CACHE_LIGHTS] = scene->lights,
+   };
+   for(int section = CACHE_OBJECTS + 1; section < CACHE_SECTIONS; section++) {
+      if(sectionSize[section] > 0) memcpy(map + header.sectionOffset[section], arrays[section], sectionSize[section]);
+   }
+
+   size_t headerSize = header.sectionOffset[0];
+   header.checksum = hashBytes(map + headerSize, header.fileSize - headerSize);
+   memcpy(map, &header, sizeof(header));
+
+   int status = msync(map, header.fileSize, MS_SYNC);
+   munmap(map, header.fileSize);
+
+   return status == 0 ? 0 : -1;
+}
+
+// Maps the cache at path into store and scene if it was compiled from a scene file with the given hash and size
+// Nothing is copied: the scene's arrays and the store's objects point into the mapping, which freeCompiledScene() unmaps
+// Returns 0 on success and -1 if there is no usable cache, leaving store and scene untouched
+int loadSceneCache(const char *path, uint64_t sourceHash, uint64_t sourceSize, SceneStore *store, CompiledScene *scene) {
+
+   int fd = open(path, O_RDONLY);
+   if(fd < 0) return -1;
+
+   SceneCacheHeader header;
+   struct stat fileStat;
+   if(fstat(fd, &fileStat) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+      close(fd);
+      return -1;
+   }
+
+   // Cheap checks first so a stale cache costs one read
+   if(memcmp(header.magic, cacheMagic, sizeof(header.magic)) != 0 || header.version != SCENE_CACHE_VERSION || \
+      header.objectSize != sizeof(Object) || header.sourceHash != sourceHash || header.sourceSize != sourceSize || \
+      header.fileSize != (uint64_t)fileStat.st_size) {
+      close(fd);
+      return -1;
+   }
+
+   SceneCacheHeader expected = header;
+   size_t sectionSize[CACHE_SECTIONS];
+   if(layoutCache(&expected, sectionSize) != header.fileSize || \
+      memcmp(expected.sectionOffset, header.sectionOffset, sizeof(header.sectionOffset)) != 0) {
+      close(fd);
+      return -1;
+   }
+
+   // Private and writable so animation can move things around; pages are only copied once written to
+   uint8_t *map = mmap(NULL, header.fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if(map == MAP_FAILED) return -1;
+
+   size_t headerSize = header.sectionOffset[0];
+   if(hashBytes(map + headerSize, header.fileSize - headerSize) != header.checksum) {
+      munmap(map, header.fileSize);
+      return -1;
+   }
+
+   if(initMappedSceneStore(store, (Object *)(map + header.sectionOffset[CACHE_OBJECTS]), header.numObjects) != 0) {
+      releaseSceneStore(store);
+      munmap(map, header.fileSize);
+      return -1;
+   }
+
+   scene->numSpheres = header.numSpheres;
+   scene->numPlanes = header.numPlanes;
+   scene->numPrims = header.numSpheres + header.numPlanes;
+   scene->sphereX = (float *)(map + header.sectionOffset[CACHE_SPHERE_X]);
+   scene->sphereY = (float *)(map + header.sectionOffset[CACHE_SPHERE_Y]);
+   scene->sphereZ = (float *)(map + header.sectionOffset[CACHE_SPHERE_Z]);
+   scene->sphereRadius2 = (float *)(map + header.sectionOffset[CACHE_SPHERE_RADIUS2]);
+   scene->planeNX = (float *)(map + header.sectionOffset[CACHE_PLANE_NX]);
+   scene->planeNY = (float *)(map + header.sectionOffset[CACHE_PLANE_NY]);
+   scene->planeNZ = (float *)(map + header.sectionOffset[CACHE_PLANE_NZ]);
+   scene->planeOffset = (float *)(map + header.sectionOffset[CACHE_PLANE_OFFSET]);
+   scene->materials = (Material *)(map + header.sectionOffset[CACHE_MATERIALS]);
+   scene->primObject = (int *)(map + header.sectionOffset[CACHE_PRIM_OBJECT]);
+   scene->bvh.nodes = (BVHNode *)(map + header.sectionOffset[CACHE_BVH_NODES]);
+   scene->bvh.numNodes = header.numNodes;
+   scene->bvh.primIndices = (int *)(map + header.sectionOffset[CACHE_BVH_PRIMS]);
+   scene->bvh.numPrims = header.numSpheres;
+   scene->numLights = header.numLights;
+   scene->lights = (Light *)(map + header.sectionOffset[CACHE_LIGHTS]);
+   scene->cacheMap = map;
+   scene->cacheMapSize = header.fileSize;
+   memset(&scene->lightTree, 0, sizeof(LightTree));
+   selectShadeKernel(scene);
+
+   return 0;
+}
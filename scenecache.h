@@ -0,0 +1,62 @@
+#ifndef SCENECACHE_H
+#define SCENECACHE_H
+
+#include <stdint.h>
+#include "scene.h"
+
+// Appended to a scene file's path to name its cache
+#define SCENE_CACHE_SUFFIX ".cache"
+// Bumped whenever the layout of the file or of anything stored in it changes
+#define SCENE_CACHE_VERSION 4
+// Sections start on cache line boundaries
+#define SCENE_CACHE_ALIGN 64
+
+// Arrays stored in a cache, in file order
+enum {
+   CACHE_OBJECTS,
+   CACHE_SPHERE_X,
+   CACHE_SPHERE_Y,
+   CACHE_SPHERE_Z,
+   CACHE_SPHERE_RADIUS2,
+   CACHE_PLANE_NX,
+   CACHE_PLANE_NY,
+   CACHE_PLANE_NZ,
+   CACHE_PLANE_OFFSET,
+   CACHE_MATERIALS,
+   CACHE_PRIM_OBJECT,
+   CACHE_BVH_NODES,
+   CACHE_BVH_PRIMS,
+   CACHE_LIGHTS,
+   CACHE_SECTIONS
+};
+
+/*
+Start of a compiled scene file. The sections hold the scene store's objects (camera
+and lights included) followed by every array of the CompiledScene, the BVH and the
+lights among them, exactly as they sit in memory; loading maps the file and points
+the scene at them. The layout is the host's native one, objectSize guards against a
+changed Object. sourceHash identifies the scene file the cache was compiled from and
+checksum covers everything after the header.
+*/
+typedef struct SceneCacheHeader {
+   char magic[8];
+   uint32_t version;
+   uint32_t objectSize;
+   uint64_t sourceSize;
+   uint64_t sourceHash;
+   uint64_t fileSize;
+   uint64_t checksum;
+   int32_t numObjects;
+   int32_t numSpheres;
+   int32_t numPlanes;
+   int32_t numNodes;
+   int32_t numLights;
+   uint64_t sectionOffset[CACHE_SECTIONS];
+} SceneCacheHeader;
+
+uint64_t hashBytes(const uint8_t *data, size_t size);
+int hashSceneFile(const char *path, uint64_t *hash, uint64_t *size);
+int writeSceneCache(const char *path, SceneStore *store, CompiledScene *scene, uint64_t sourceHash, uint64_t sourceSize);
+int loadSceneCache(const char *path, uint64_t sourceHash, uint64_t sourceSize, SceneStore *store, CompiledScene *scene);
+
+#endif
@@ -0,0 +1,513 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "output.h"
+#include "stats.h"
+#include "scenecache.h"
+#include "rclib.h"
+#include "message.h"
+#include "server.h"
+
+// Message types
+#define MSG_JOB 1
+#define MSG_RESULT 2
+#define MSG_ERROR 3
+
+// Words before the scene and output path in JOB, and before the image in RESULT
+#define JOB_WORDS 9
+#define RESULT_WORDS 5
+
+// Room for a P6 header of any image size
+#define P6_HEADER_CAPACITY 32
+
+/*
+A compiled scene in the server's cache. Scenes are matched by the hash and size of
+their text and the light epsilon they were culled with, which changes the compiled
+scene; one in use by a job is never evicted.
+*/
+typedef struct CachedScene {
+   uint64_t hash;
+   size_t size;
+   float lightEpsilon;
+   rc_scene *scene;
+   int users;                // Jobs rendering it
+   unsigned long lastUsed;   // Value of the server's clock when last handed out
+} CachedScene;
+
+typedef struct Server {
+   ServerConfig *config;
+   rc_pool *pool;
+   pthread_mutex_t lock;     // Guards everything below
+   pthread_cond_t idle;      // Signalled when a client leaves
+   CachedScene **scenes;
+   int numScenes;
+   unsigned long clock;
+   int clientFds[SERVER_MAX_CLIENTS];   // -1 where no client is
+   int numClients;
+} Server;
+
+typedef struct Client {
+   Server *server;
+   int slot;
+   int fd;
+} Client;
+
+static volatile sig_atomic_t stopRequested;
+
+
+static void requestStop(int signal) {
+   (void)signal;
+   stopRequested = 1;
+}
+
+// Evicts the least recently used scenes no job is rendering until the cache is back within its size;
+// called with the lock held
+static void trimSceneCache(Server *server) {
+
+   while(server->numScenes > server->config->cacheScenes) {
+      int oldest = -1;
+      for(int sceneInd = 0; sceneInd < server->numScenes; sceneInd++) {
+         CachedScene *entry = server->scenes[sceneInd];
+         if(entry->users == 0 && (oldest < 0 || entry->lastUsed < server->scenes[oldest]->lastUsed)) oldest = sceneInd;
+      }
+      if(oldest < 0) return;
+
+      rc_scene_free(server->scenes[oldest]->scene);
+      free(server->scenes[oldest]);
+      server->scenes[oldest] = server->scenes[--server->numScenes];
+   }
+}
+
+// Finds the scene whose text is size bytes at data in the cache, or loads it and adds it; name stands in for
+// its file in errors. The scene is the caller's to render until releaseScene(). Returns NULL when the scene
+// doesn't load, with the reason in reason
+static CachedScene *acquireScene(Server *server, rc_context *ctx, const char *data, size_t size, const char *name,
+                                 float lightEpsilon, bool *cached, char *reason, size_t reasonSize) {
+
+   uint64_t hash = hashBytes((const uint8_t *)data, size);
+   CachedScene *found = NULL;
+
+   pthread_mutex_lock(&server->lock);
+   for(int sceneInd = 0; sceneInd < server->numScenes && !found; sceneInd++) {
+      CachedScene *entry = server->scenes[sceneInd];
+      if(entry->hash == hash && entry->size == size && entry->lightEpsilon == lightEpsilon) found = entry;
+   }
+   if(found) {
+      found->users += 1;
+      found->lastUsed = ++server->clock;
+   }
+   pthread_mutex_unlock(&server->lock);
+
+   *cached = found != NULL;
+   if(found) return found;
+
+   // Loading happens outside the lock, so other clients' jobs go on meanwhile
+   rc_scene *scene;
+   if(rc_scene_load_memory(ctx, data, size, name, &scene) != RC_OK) {
+      snprintf(reason, reasonSize, "%s", rc_error_message(ctx));
+      return NULL;
+   }
+   if(rc_scene_set_light_epsilon(ctx, scene, lightEpsilon) != RC_OK) {
+      snprintf(reason, reasonSize, "%s", rc_error_message(ctx));
+      rc_scene_free(scene);
+      return NULL;
+   }
+
+   CachedScene *loaded = malloc(sizeof(CachedScene));
+   CachedScene **grown = NULL;
+
+   pthread_mutex_lock(&server->lock);
+   // Another client may have loaded the same scene meanwhile
+   for(int sceneInd = 0; sceneInd < server->numScenes && !found; sceneInd++) {
+      CachedScene *entry = server->scenes[sceneInd];
+      if(entry->hash == hash && entry->size == size && entry->lightEpsilon == lightEpsilon) found = entry;
+   }
+   if(!found && loaded) grown = realloc(server->scenes, sizeof(CachedScene *) * (server->numScenes + 1));
+   if(found) {
+      found->users += 1;
+      found->lastUsed = ++server->clock;
+   }
+   else if(grown) {
+      *loaded = (CachedScene){hash, size, lightEpsilon, scene, 1, ++server->clock};
+      server->scenes = grown;
+      server->scenes[server->numScenes++] = loaded;
+      trimSceneCache(server);
+   }
+   pthread_mutex_unlock(&server->lock);
+
+   if(found || !grown) {
+      rc_scene_free(scene);
+      free(loaded);
+   }
+   if(!found && !grown) {
+      snprintf(reason, reasonSize, "out of memory caching %s", name);
+      return NULL;
+   }
+   return found ? found : loaded;
+}
+
+static void releaseScene(Server *server, CachedScene *entry) {
+   pthread_mutex_lock(&server->lock);
+   entry->users -= 1;
+   trimSceneCache(server);
+   pthread_mutex_unlock(&server->lock);
+}
+
+// Sends the reason a job failed back to the client and logs it
+static int rejectJob(int fd, const char *name, const char *reason) {
+   fprintf(stderr, "%s: %s\n", name, reason);
+   return sendMessage(fd, MSG_ERROR, NULL, 0, reason, strlen(reason));
+}
+
+// Copies length bytes at data into a new NUL terminated string
+static char *copyString(const uint8_t *data, size_t length) {
+   char *copy = malloc(length + 1);
+   if(!copy) return NULL;
+   memcpy(copy, data, length);
+   copy[length] = '\0';
+   return copy;
+}
+
+// Renders the JOB in msg and sends the client its RESULT, or an ERROR when the job can't be done
+// Returns -1 when the connection can't go on
+static int handleJob(Server *server, rc_context *ctx, int fd, Message *msg) {
+
+   double start = monotonicSeconds();
+   char reason[256];
+
+   if(msg->type != MSG_JOB || msg->length < JOB_WORDS * sizeof(uint32_t)) return -1;
+   if(messageWord(msg, 0) != SERVER_PROTOCOL_VERSION) {
+      rejectJob(fd, "client", "unsupported protocol version");
+      return -1;
+   }
+
+   int width = messageWord(msg, 1);
+   int height = messageWord(msg, 2);
+   int format = messageWord(msg, 3);
+   int aaSamples = messageWord(msg, 4);
+   float aaThreshold = bitsFloat(messageWord(msg, 5));
+   float lightEpsilon = bitsFloat(messageWord(msg, 6));
+   uint32_t flags = messageWord(msg, 7);
+   uint32_t sceneLength = messageWord(msg, 8);
+   bool returnImage = (flags & SERVE_RETURN_IMAGE) != 0;
+
+   size_t bodySize = msg->length - JOB_WORDS * sizeof(uint32_t);
+   if(sceneLength > bodySize) return -1;
+   const uint8_t *sceneData = msg->data + JOB_WORDS * sizeof(uint32_t);
+   char *outputPath = copyString(sceneData + sceneLength, bodySize - sceneLength);
+   char *scenePath = (flags & SERVE_INLINE_SCENE) ? NULL : copyString(sceneData, sceneLength);
+   if(!outputPath || (!(flags & SERVE_INLINE_SCENE) && !scenePath)) {
+      free(outputPath);
+      free(scenePath);
+      return rejectJob(fd, "client", "out of memory");
+   }
+   const char *name = scenePath ? scenePath : "inline scene";
+
+   // Checked here so a bad job fails before its scene is loaded
+   size_t imageBytes = (size_t)(width > 0 ? width : 0) * (height > 0 ? height : 0) * 3;
+   int status = -1;
+   if(width < 1 || height < 1) {
+      snprintf(reason, sizeof(reason), "image size %dx%d is too small", width, height);
+   }
+   else if(returnImage && imageBytes > MAX_MESSAGE - RESULT_WORDS * sizeof(uint32_t) - P6_HEADER_CAPACITY) {
+      snprintf(reason, sizeof(reason), "a %dx%d image is too large to send back", width, height);
+   }
+   else if(!returnImage && (outputPath[0] == '\0' || (format != FORMAT_P6 && format != FORMAT_P3))) {
+      snprintf(reason, sizeof(reason), "the image needs an output path and format or to be sent back");
+   }
+   else if(rc_context_set_aa(ctx, aaSamples, aaThreshold) != RC_OK) {
+      snprintf(reason, sizeof(reason), "%s", rc_error_message(ctx));
+   }
+   else {
+      status = 0;
+   }
+   if(status != 0) {
+      free(outputPath);
+      free(scenePath);
+      return rejectJob(fd, name, reason);
+   }
+   rc_context_set_batch_shadows(ctx, (flags & SERVE_BATCH_SHADOWS) != 0);
+
+   // A path is read in full either way: its text is what the cache is keyed by
+   char *sceneText = NULL;
+   size_t sceneSize = sceneLength;
+   if(scenePath && readWholeFile(scenePath, &sceneText, &sceneSize) != 0) {
+      snprintf(reason, sizeof(reason), "cannot read %s", scenePath);
+      free(outputPath);
+      free(scenePath);
+      return rejectJob(fd, name, reason);
+   }
+
+   bool cached;
+   CachedScene *entry = acquireScene(server, ctx, sceneText ? sceneText : (const char *)sceneData, sceneSize, name, lightEpsilon, &cached,
+                                      reason, sizeof(reason));
+   free(sceneText);
+   double loadSeconds = monotonicSeconds() - start;
+
+   uint8_t *image = NULL;
+   size_t headerSize = 0;
+   if(!entry) {
+      // reason is already set
+   }
+   else if(returnImage) {
+      image = malloc(P6_HEADER_CAPACITY + imageBytes);
+      if(!image) {
+         status = RC_ERROR_MEMORY;
+         snprintf(reason, sizeof(reason), "out of memory for a %dx%d image", width, height);
+      }
+      else {
+         headerSize = snprintf((char *)image, P6_HEADER_CAPACITY, "P6\n%d %d\n255\n", width, height);
+         rc_framebuffer framebuffer = {image + headerSize, width, height, 0};
+         status = rc_render(ctx, entry->scene, &framebuffer);
+         if(status != RC_OK) snprintf(reason, sizeof(reason), "%s", rc_error_message(ctx));
+      }
+   }
+   else {
+      status = rc_render_file(ctx, entry->scene, width, height, outputPath, format, 0);
+      if(status != RC_OK) snprintf(reason, sizeof(reason), "%s", rc_error_message(ctx));
+   }
+   if(entry) releaseScene(server, entry);
+
+   int result;
+   if(!entry || status != RC_OK) {
+      result = rejectJob(fd, name, reason);
+   }
+   else {
+      rc_stats stats;
+      rc_context_stats(ctx, &stats);
+      double seconds = monotonicSeconds() - start;
+      uint32_t words[RESULT_WORDS] = {cached ? SERVE_SCENE_CACHED : 0, floatBits(loadSeconds), floatBits(stats.renderSeconds),
+                                      floatBits(stats.writeSeconds), floatBits(seconds)};
+      result = sendMessage(fd, MSG_RESULT, words, RESULT_WORDS, image, image ? headerSize + imageBytes : 0);
+      printf("%s %dx%d -> %s: %s, load %.2f ms, render %.2f ms, write %.2f ms, total %.2f ms\n", name, width, height,
+             returnImage ? "client" : outputPath, cached ? "cached" : "loaded", loadSeconds * 1000, stats.renderSeconds * 1000,
+             stats.writeSeconds * 1000, seconds * 1000);
+      fflush(stdout);
+   }
+
+   free(image);
+   free(outputPath);
+   free(scenePath);
+   return result;
+}
+
+// Serves one client's jobs until it disconnects or the server stops
+static void *clientMain(void *arg) {
+
+   Client *client = arg;
+   Server *server = client->server;
+   Message msg = {0, 0, NULL, 0};
+
+   // Each client renders through its own context, on the threads every client shares
+   rc_context *ctx = rc_context_create();
+   if(ctx) {
+      rc_context_set_simd(ctx, server->config->simdMode);
+      rc_context_set_pool(ctx, server->pool);
+      while(receiveMessage(client->fd, &msg) == 0 && handleJob(server, ctx, client->fd, &msg) == 0);
+   }
+
+   rc_context_free(ctx);
+   free(msg.data);
+
+   pthread_mutex_lock(&server->lock);
+   close(client->fd);
+   server->clientFds[client->slot] = -1;
+   server->numClients -= 1;
+   pthread_cond_signal(&server->idle);
+   pthread_mutex_unlock(&server->lock);
+
+   free(client);
+   return NULL;
+}
+
+// Starts a thread serving the client connected on fd, or turns it away when the server is full
+static void admitClient(Server *server, int fd) {
+
+   int on = 1;
+   setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+   pthread_mutex_lock(&server->lock);
+   int slot = 0;
+   while(slot < SERVER_MAX_CLIENTS && server->clientFds[slot] >= 0) slot++;
+
+   Client *client = slot < SERVER_MAX_CLIENTS ? malloc(sizeof(Client)) : NULL;
+   pthread_t thread;
+   pthread_attr_t attr;
+   pthread_attr_init(&attr);
+   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+   if(client) {
+      *client = (Client){server, slot, fd};
+      server->clientFds[slot] = fd;
+      server->numClients += 1;
+      if(pthread_create(&thread, &attr, clientMain, client) != 0) {
+         server->clientFds[slot] = -1;
+         server->numClients -= 1;
+         free(client);
+         client = NULL;
+      }
+   }
+   pthread_attr_destroy(&attr);
+   pthread_mutex_unlock(&server->lock);
+
+   if(!client) {
+      const char *reason = "the server has too many clients";
+      sendMessage(fd, MSG_ERROR, NULL, 0, reason, strlen(reason));
+      close(fd);
+   }
+}
+
+/*
+Serves render jobs on config->address until the process gets SIGINT or SIGTERM,
+then lets the jobs being rendered finish and returns 0. Returns -1 with the reason
+in error when the server can't start.
+*/
+int runServer(ServerConfig *config, char *error, size_t errorSize) {
+
+   Server server;
+   server.config = config;
+   server.scenes = NULL;
+   server.numScenes = 0;
+   server.clock = 0;
+   server.numClients = 0;
+   for(int slot = 0; slot < SERVER_MAX_CLIENTS; slot++) server.clientFds[slot] = -1;
+
+   // The thread of each job renders too
+   server.pool = rc_pool_create(config->numThreads - 1);
+   if(!server.pool) return setError(error, errorSize, "cannot start %d render threads", config->numThreads - 1);
+
+   int listenFd = openSocket(config->address, true, error, errorSize);
+   if(listenFd < 0) {
+      rc_pool_free(server.pool);
+      return -1;
+   }
+
+   pthread_mutex_init(&server.lock, NULL);
+   pthread_cond_init(&server.idle, NULL);
+
+   // Without SA_RESTART, so a signal wakes up poll()
+   struct sigaction stop, oldInt, oldTerm;
+   memset(&stop, 0, sizeof(stop));
+   stop.sa_handler = requestStop;
+   sigemptyset(&stop.sa_mask);
+   stopRequested = 0;
+   sigaction(SIGINT, &stop, &oldInt);
+   sigaction(SIGTERM, &stop, &oldTerm);
+
+   int status = 0;
+   while(!stopRequested) {
+      struct pollfd listening = {listenFd, POLLIN, 0};
+      int ready = poll(&listening, 1, 1000);
+      if(ready < 0 && errno != EINTR) {
+         status = setError(error, errorSize, "poll failed: %s", strerror(errno));
+         break;
+      }
+      if(ready <= 0) continue;
+
+      int fd = accept(listenFd, NULL, NULL);
+      if(fd >= 0) admitClient(&server, fd);
+   }
+
+   // Clients waiting for their next job are woken up; those rendering one send its result first
+   pthread_mutex_lock(&server.lock);
+   for(int slot = 0; slot < SERVER_MAX_CLIENTS; slot++) {
+      if(server.clientFds[slot] >= 0) shutdown(server.clientFds[slot], SHUT_RD);
+   }
+   while(server.numClients > 0) pthread_cond_wait(&server.idle, &server.lock);
+   pthread_mutex_unlock(&server.lock);
+
+   sigaction(SIGINT, &oldInt, NULL);
+   sigaction(SIGTERM, &oldTerm, NULL);
+   close(listenFd);
+   if(strncmp(config->address, "unix:", 5) == 0) unlink(config->address + 5);
+
+   for(int sceneInd = 0; sceneInd < server.numScenes; sceneInd++) {
+      rc_scene_free(server.scenes[sceneInd]->scene);
+      free(server.scenes[sceneInd]);
+   }
+   free(server.scenes);
+   rc_pool_free(server.pool);
+   pthread_cond_destroy(&server.idle);
+   pthread_mutex_destroy(&server.lock);
+
+   return status;
+}
+
+/*
+Sends job to the server at address and waits for it to be rendered, filling in the
+timings and, when the image was to be sent back, job->image. Returns 0, or -1 with
+the reason in job->error.
+*/
+int submitJob(const char *address, ServeJob *job) {
+
+   double start = monotonicSeconds();
+
+   job->image = NULL;
+   job->imageSize = 0;
+   job->error[0] = '\0';
+
+   size_t outputLength = job->outputPath ? strlen(job->outputPath) : 0;
+   if(job->sceneSize + outputLength > MAX_MESSAGE - JOB_WORDS * sizeof(uint32_t)) {
+      return setError(job->error, sizeof(job->error), "the scene is too large to send");
+   }
+
+   // The scene and output path go out as the one body after the words
+   uint8_t *body = malloc(job->sceneSize + outputLength + 1);
+   if(!body) return setError(job->error, sizeof(job->error), "out of memory");
+   memcpy(body, job->scene, job->sceneSize);
+   if(outputLength > 0) memcpy(body + job->sceneSize, job->outputPath, outputLength);
+
+   int fd = openSocket(address, false, job->error, sizeof(job->error));
+   if(fd < 0) {
+      free(body);
+      return -1;
+   }
+
+   uint32_t flags = (job->inlineScene ? SERVE_INLINE_SCENE : 0) | (job->outputPath ? 0 : SERVE_RETURN_IMAGE) | \
+                    (job->batchShadows ? SERVE_BATCH_SHADOWS : 0);
+   uint32_t words[JOB_WORDS] = {SERVER_PROTOCOL_VERSION, job->width, job->height, job->format, job->aaSamples,
+                                floatBits(job->aaThreshold), floatBits(job->lightEpsilon), flags, job->sceneSize};
+   Message msg = {0, 0, NULL, 0};
+   int status = 0;
+
+   if(sendMessage(fd, MSG_JOB, words, JOB_WORDS, body, job->sceneSize + outputLength) != 0 || receiveMessage(fd, &msg) != 0) {
+      status = setError(job->error, sizeof(job->error), "lost the server at %s", address);
+   }
+   else if(msg.type == MSG_ERROR) {
+      status = setError(job->error, sizeof(job->error), "%.*s", (int)(msg.length < 255 ? msg.length : 255), (char *)msg.data);
+   }
+   else if(msg.type != MSG_RESULT || msg.length < RESULT_WORDS * sizeof(uint32_t)) {
+      status = setError(job->error, sizeof(job->error), "unexpected message %u from %s", msg.type, address);
+   }
+   else {
+      job->sceneCached = (messageWord(&msg, 0) & SERVE_SCENE_CACHED) != 0;
+      job->loadSeconds = bitsFloat(messageWord(&msg, 1));
+      job->renderSeconds = bitsFloat(messageWord(&msg, 2));
+      job->writeSeconds = bitsFloat(messageWord(&msg, 3));
+      job->serverSeconds = bitsFloat(messageWord(&msg, 4));
+
+      // The message buffer becomes the image
+      job->imageSize = msg.length - RESULT_WORDS * sizeof(uint32_t);
+      if(job->imageSize > 0) {
+         memmove(msg.data, msg.data + RESULT_WORDS * sizeof(uint32_t), job->imageSize);
+         job->image = msg.data;
+         msg.data = NULL;
+      }
+   }
+
+   free(msg.data);
+   free(body);
+   close(fd);
+
+   job->seconds = monotonicSeconds() - start;
+   return status;
+}
@@ -0,0 +1,75 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+A long running render server. It listens on a unix socket, or TCP, and renders the
+jobs clients send it: a scene file path or the scene's text, an image size and
+render settings, and either a path to write the image to or a request for the
+image itself. Scenes are kept parsed and compiled in a cache keyed by a hash of
+their text, so rendering a scene again costs only reading and hashing its file, and
+every job renders on one pool of threads shared by all clients. A client may send
+any number of jobs over one connection, one after the other.
+
+Messages are framed as in message.h:
+- JOB       client: protocol version, width, height, output format (FORMAT_P6 or
+                    FORMAT_P3, ignored when the image is returned), AA samples, AA
+                    threshold and light epsilon as float bits, SERVE_* flags, length
+                    of the scene text or path, then the scene and the output path
+- RESULT    server: SERVE_SCENE_CACHED when the scene came from the cache, then the
+                    seconds spent loading the scene, rendering, writing the file and
+                    on the whole job as float bits, then the image as a P6 file when
+                    it was asked for
+- ERROR     server: why the job failed; the connection stays open
+*/
+#define SERVER_PROTOCOL_VERSION 1
+#define SERVER_DEFAULT_SCENES 8    // Scenes kept in the cache
+#define SERVER_MAX_CLIENTS 64      // Connections served at once; more are turned away
+
+// JOB flags
+#define SERVE_INLINE_SCENE 1     // The scene is the file's text rather than its path
+#define SERVE_RETURN_IMAGE 2     // Send the image back rather than writing it to the output path
+#define SERVE_BATCH_SHADOWS 4
+// RESULT flags
+#define SERVE_SCENE_CACHED 1
+
+// How the server runs
+typedef struct ServerConfig {
+   const char *address;
+   int numThreads;     // Render threads shared by every job
+   int simdMode;       // SIMD_* mode for primary rays
+   int cacheScenes;    // Compiled scenes kept around
+} ServerConfig;
+
+// A job for submitJob(), with the server's answer filled in
+typedef struct ServeJob {
+   const char *scene;      // Path as the server sees it, or the scene text with inlineScene
+   size_t sceneSize;
+   bool inlineScene;
+   const char *outputPath; // Where the server writes the image, NULL to have it sent back
+   int format;             // FORMAT_P6 or FORMAT_P3, for outputPath
+   int width;
+   int height;
+   int aaSamples;
+   float aaThreshold;
+   float lightEpsilon;
+   bool batchShadows;
+   // Results
+   uint8_t *image;         // P6 file sent back without outputPath, for the caller to free
+   size_t imageSize;
+   bool sceneCached;
+   double loadSeconds;
+   double renderSeconds;
+   double writeSeconds;
+   double serverSeconds;   // Whole job in the server
+   double seconds;         // Round trip, connecting included
+   char error[256];
+} ServeJob;
+
+int runServer(ServerConfig *config, char *error, size_t errorSize);
+int submitJob(const char *address, ServeJob *job);
+
+#endif
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "v3math.h"
+#include "raycast.h"
+#include "scene.h"
+#include "lighttree.h"
+#include "stats.h"
+#include "gbuffer.h"
+#include "shade.h"
+
+
+// base to the power exponent > 0 by repeated squaring
+static inline float powInteger(float base, int exponent) {
+   float result = 1;
+   while(exponent > 0) {
+      if(exponent & 1) result *= base;
+      base *= base;
+      exponent >>= 1;
+   }
+   return result;
+}
+
+// realloc() that hands back array as it was, clearing *grown, when it fails
+static void *growArray(void *array, size_t size, bool *grown) {
+   void *larger = realloc(array, size);
+   if(larger) return larger;
+   *grown = false;
+   return array;
+}
+
+// Readies cache's batch scratch space for count samples; returns NULL when it can't be had
+static ShadowBatch *prepareShadowBatch(ShadowCache *cache, int count) {
+
+   ShadowBatch *batch = cache->batch;
+   if(!batch) {
+      batch = calloc(1, sizeof(ShadowBatch));
+      if(!batch) return NULL;
+      batch->lightHits = malloc(sizeof(int) * (cache->numLights + 1));
+      if(!batch->lightHits) {
+         free(batch);
+         return NULL;
+      }
+      cache->batch = batch;
+   }
+
+   if(count > batch->capacity) {
+      // Arrays that did grow are kept, the capacity only moves once all of them have
+      bool grown = true;
+      batch->hitSamples = growArray(batch->hitSamples, sizeof(int) * count, &grown);
+      batch->views = growArray(batch->views, sizeof(float[3]) * count, &grown);
+      batch->hitLights = growArray(batch->hitLights, sizeof(int) * (count + 1), &grown);
+      batch->rays = growArray(batch->rays, sizeof(ShadowRay) * count, &grown);
+      batch->order = growArray(batch->order, sizeof(int) * count, &grown);
+      batch->occluded = growArray(batch->occluded, sizeof(bool) * count, &grown);
+      if(!grown) return NULL;
+      batch->capacity = count;
+   }
+
+   return batch;
+}
+
+void freeShadowBatch(ShadowBatch *batch) {
+   if(!batch) return;
+   free(batch->hitSamples);
+   free(batch->views);
+   free(batch->hitLights);
+   free(batch->lightHits);
+   free(batch->gathered);
+   free(batch->lightLists);
+   free(batch->rays);
+   free(batch->order);
+   free(batch->occluded);
+   free(batch);
+}
+
+// Blackens every sample of a width x height block and lists the ones that hit something, returning how many did
+static int listHits(ShadowBatch *batch, GBufferSample *samples, float (*colors)[3], int width, int height, int stride) {
+
+   int numHits = 0;
+
+   for(int y = 0; y < height; y++) {
+      for(int x = 0; x < width; x++) {
+         int sampleInd = y * stride + x;
+         colors[sampleInd][0] = 0;
+         colors[sampleInd][1] = 0;
+         colors[sampleInd][2] = 0;
+         if(samples[sampleInd].t > 0) batch->hitSamples[numHits++] = sampleInd;
+      }
+   }
+
+   return numHits;
+}
+
+// With a light epsilon, gathers the lights reaching each hit and regroups them into the hits each light
+// reaches, in hit order; returns false, leaving every light to every hit, without one
+static bool groupHitsByLight(CompiledScene *scene, ShadowBatch *batch, GBufferSample *samples, int numHits, RenderStats *stats) {
+
+   if(!(scene->lightTree.epsilon > 0)) return false;
+
+   int numLights = scene->numLights;
+   int total = 0;
+
+   for(int hit = 0; hit < numHits; hit++) {
+
+      // Room for this hit to gather every light
+      if(total + numLights > batch->listCapacity) {
+         // Out of memory every light goes to every hit, which only adds the light culling would have dropped
+         int capacity = 2 * batch->listCapacity > total + numLights ? 2 * batch->listCapacity : total + numLights;
+         bool grown = true;
+         batch->gathered = growArray(batch->gathered, sizeof(int) * capacity, &grown);
+         batch->lightLists = growArray(batch->lightLists, sizeof(int) * capacity, &grown);
+         if(!grown) return false;
+         batch->listCapacity = capacity;
+      }
+
+      batch->hitLights[hit] = total;
+      int numGathered = gatherLights(&scene->lightTree, samples[batch->hitSamples[hit]].point, &batch->gathered[total]);
+      STAT_ADD(stats, STAT_LIGHTS_CULLED, numLights - numGathered);
+      total += numGathered;
+   }
+   batch->hitLights[numHits] = total;
+
+   // Counting sort by light, which keeps each light's hits in order
+   memset(batch->lightHits, 0, sizeof(int) * (numLights + 1));
+   for(int entry = 0; entry < total; entry++) {
+      batch->lightHits[batch->gathered[entry] + 1] += 1;
+   }
+   for(int light = 0; light < numLights; light++) {
+      batch->lightHits[light + 1] += batch->lightHits[light];
+   }
+   for(int hit = 0; hit < numHits; hit++) {
+      for(int entry = batch->hitLights[hit]; entry < batch->hitLights[hit + 1]; entry++) {
+         int light = batch->gathered[entry];
+         batch->lightLists[batch->lightHits[light]++] = hit;
+      }
+   }
+   // Filling moved every start up to the next light's
+   for(int light = numLights; light > 0; light--) {
+      batch->lightHits[light] = batch->lightHits[light - 1];
+   }
+   batch->lightHits[0] = 0;
+
+   return true;
+}
+
+// Bin of a unit direction on a SHADOW_DIRECTION_BINS cubed grid over [-1, 1] on each axis
+static inline int directionBin(float *direction) {
+   int bin = 0;
+   for(int axis = 0; axis < 3; axis++) {
+      int cell = (int)((direction[axis] + 1) * (SHADOW_DIRECTION_BINS / 2.0f));
+      if(cell < 0) cell = 0;
+      if(cell >= SHADOW_DIRECTION_BINS) cell = SHADOW_DIRECTION_BINS - 1;
+      bin = bin * SHADOW_DIRECTION_BINS + cell;
+   }
+   return bin;
+}
+
+// Builds the shadow ray toward light from each of numRays hits, members[i] or hit i when members is NULL,
+// then traces them SHADOW_BATCH at a time in direction order, setting batch->occluded for each
+static void castShadowRays(CompiledScene *scene, ShadowBatch *batch, GBufferSample *samples, Light *light, int *members, int numRays, int *occluder, RenderStats *stats) {
+
+   int binStart[SHADOW_DIRECTION_BINS * SHADOW_DIRECTION_BINS * SHADOW_DIRECTION_BINS + 1] = {0};
+
+   for(int rayInd = 0; rayInd < numRays; rayInd++) {
+      GBufferSample *sample = &samples[batch->hitSamples[members ? members[rayInd] : rayInd]];
+      ShadowRay *ray = &batch->rays[rayInd];
+
+      // Calculate new direction vector, exactly as a single point's shading does
+      v3_subtract(ray->direction, light->position, sample->point);
+      ray->maxT = v3_normalize_length(ray->direction, ray->direction);
+      memcpy(ray->origin, sample->point, sizeof(ray->origin));
+      ray->exclude = sample->hitObject;
+
+      binStart[directionBin(ray->direction) + 1] += 1;
+   }
+
+   // Counting sort into direction bins, so each traced batch heads roughly the same way
+   for(int bin = 0; bin < SHADOW_DIRECTION_BINS * SHADOW_DIRECTION_BINS * SHADOW_DIRECTION_BINS; bin++) {
+      binStart[bin + 1] += binStart[bin];
+   }
+   for(int rayInd = 0; rayInd < numRays; rayInd++) {
+      batch->order[binStart[directionBin(batch->rays[rayInd].direction)]++] = rayInd;
+   }
+
+   for(int first = 0; first < numRays; first += SHADOW_BATCH) {
+      int count = numRays - first < SHADOW_BATCH ? numRays - first : SHADOW_BATCH;
+      occludedBatch(scene, batch->rays, &batch->order[first], count, occluder, batch->occluded, stats);
+   }
+}
+
+#define SHADE_KERNEL shadeSpheres
+#define SHADE_HAS_SPHERES 1
+#define SHADE_HAS_PLANES 0
+#define SHADE_HIGHLIGHTS HIGHLIGHTS_NONE
+#include "shade_kernel.h"
+#undef SHADE_KERNEL
+#undef SHADE_HIGHLIGHTS
+
+#define SHADE_KERNEL shadeSpheresIntegerHighlights
+#define SHADE_HIGHLIGHTS HIGHLIGHTS_INTEGER
+#include "shade_kernel.h"
+#undef SHADE_KERNEL
+#undef SHADE_HIGHLIGHTS
+
+#define SHADE_KERNEL shadeSpheresHighlights
+#define SHADE_HIGHLIGHTS HIGHLIGHTS_GENERAL
+#include "shade_kernel.h"
+#undef SHADE_KERNEL
+#undef SHADE_HIGHLIGHTS
+#undef SHADE_HAS_SPHERES
+#undef SHADE_HAS_PLANES
+
+#define SHADE_KERNEL shadePlanes
+#define SHADE_HAS_SPHERES 0
+#define SHADE_HAS_PLANES 1
+#define SHADE_HIGHLIGHTS HIGHLIGHTS_NONE
+#include "shade_kernel.h"
+#undef SHADE_KERNEL
+#undef SHADE_HIGHLIGHTS
+
+#define SHADE_KERNEL shadePlanesIntegerHighlights
+#define SHADE_HIGHLIGHTS HIGHLIGHTS_INTEGER
+#include "shade_kernel.h"
+#undef SHADE_KERNEL
+#undef SHADE_HIGHLIGHTS
+
+#define SHADE_KERNEL shadePlanesHighlights
+#define SHADE_HIGHLIGHTS HIGHLIGHTS_GENERAL
+#include "shade_kernel.h"
+#undef SHADE_KERNEL
+#undef SHADE_HIGHLIGHTS
+#undef SHADE_HAS_SPHERES
+#undef SHADE_HAS_PLANES
+
+#define SHADE_KERNEL shadeMixed
+#define SHADE_HAS_SPHERES 1
+#define SHADE_HAS_PLANES 1
+#define SHADE_HIGHLIGHTS HIGHLIGHTS_NONE
+#include "shade_kernel.h"
+#undef SHADE_KERNEL
+#undef SHADE_HIGHLIGHTS
+
+#define SHADE_KERNEL shadeMixedIntegerHighlights
+#define SHADE_HIGHLIGHTS HIGHLIGHTS_INTEGER
+#include "shade_kernel.h"
+#undef SHADE_KERNEL
+#undef SHADE_HIGHLIGHTS
+
+#define SHADE_KERNEL shadeMixedHighlights
+#define SHADE_HIGHLIGHTS HIGHLIGHTS_GENERAL
+#include "shade_kernel.h"
+#undef SHADE_KERNEL
+#undef SHADE_HIGHLIGHTS
+#undef SHADE_HAS_SPHERES
+#undef SHADE_HAS_PLANES
+
+
+static const ShadeKernel shadeKernels[SHADE_GEOMETRIES][HIGHLIGHT_KINDS] = {
+   [SHADE_SPHERES] = {shadeSpheres, shadeSpheresIntegerHighlights, shadeSpheresHighlights},
+   [SHADE_PLANES] = {shadePlanes, shadePlanesIntegerHighlights, shadePlanesHighlights},
+   [SHADE_MIXED] = {shadeMixed, shadeMixedIntegerHighlights, shadeMixedHighlights},
+};
+
+static const ShadeBatchKernel shadeBatchKernels[SHADE_GEOMETRIES][HIGHLIGHT_KINDS] = {
+   [SHADE_SPHERES] = {shadeSpheresBatch, shadeSpheresIntegerHighlightsBatch, shadeSpheresHighlightsBatch},
+   [SHADE_PLANES] = {shadePlanesBatch, shadePlanesIntegerHighlightsBatch, shadePlanesHighlightsBatch},
+   [SHADE_MIXED] = {shadeMixedBatch, shadeMixedIntegerHighlightsBatch, shadeMixedHighlightsBatch},
+};
+
+static const char *variantNames[SHADE_GEOMETRIES * HIGHLIGHT_KINDS] = {
+   "spheres, no highlights", "spheres, whole number highlights", "spheres, highlights",
+   "planes, no highlights", "planes, whole number highlights", "planes, highlights",
+   "spheres and planes, no highlights", "spheres and planes, whole number highlights", "spheres and planes, highlights",
+};
+
+// Picks the shading kernel for the scene's primitives and materials, and the reflectance the light tree bounds lights with
+// Has to run again whenever primitives of a new kind or materials with other highlights are added
+void selectShadeKernel(CompiledScene *scene) {
+
+   int geometry = SHADE_MIXED;
+   if(scene->numPlanes == 0) geometry = SHADE_SPHERES;
+   else if(scene->numSpheres == 0) geometry = SHADE_PLANES;
+
+   int highlights = HIGHLIGHTS_NONE;
+   float strongestHighlight = 0;
+   for(int prim = 0; prim < scene->numPrims; prim++) {
+      Material *material = &scene->materials[prim];
+      if(!(material->shininess > 0)) continue;
+
+      bool whole = material->shininess == floorf(material->shininess) && material->shininess <= MAX_INTEGER_SHININESS;
+      if(!whole) highlights = HIGHLIGHTS_GENERAL;
+      else if(highlights == HIGHLIGHTS_NONE) highlights = HIGHLIGHTS_INTEGER;
+
+      for(int channel = 0; channel < 3; channel++) {
+         if(fabsf(material->specularColor[channel]) > strongestHighlight) strongestHighlight = fabsf(material->specularColor[channel]);
+      }
+   }
+
+   scene->shadeKernel = shadeKernels[geometry][highlights];
+   scene->shadeBatchKernel = shadeBatchKernels[geometry][highlights];
+   scene->shadeVariant = geometry * HIGHLIGHT_KINDS + highlights;
+   // A highlight is at most the specular color, on top of a diffuse color of at most 1
+   scene->reflectance = 1 + strongestHighlight;
+}
+
+const char *shadeVariantName(int variant) {
+   if(variant < 0 || variant >= SHADE_GEOMETRIES * HIGHLIGHT_KINDS) return "unknown";
+   return variantNames[variant];
+}
+
+// Sums the light reaching point on primitive closestIndex through the kernel selectShadeKernel() picked for scene
+void illuminate(CompiledScene *scene, float *color, float *point, float *normal, float *eye, int closestIndex, ShadowCache *cache, RenderStats *stats) {
+   scene->shadeKernel(scene, color, point, normal, eye, closestIndex, cache, stats);
+}
+
+// Sums the light reaching every sample of a width x height block of G-buffer samples, stride per row, into colors
+// Gives the colors illuminate() would, black where a sample hit nothing, but traces the shadow rays light by light
+void illuminateBatch(CompiledScene *scene, GBufferSample *samples, float (*colors)[3], int width, int height, int stride, float *eye, ShadowCache *cache, RenderStats *stats) {
+   scene->shadeBatchKernel(scene, samples, colors, width, height, stride, eye, cache, stats);
+}
@@ -0,0 +1,61 @@
+#ifndef SHADE_H
+#define SHADE_H
+
+#include "raycast.h"
+
+struct CompiledScene;
+struct RenderStats;
+struct GBufferSample;
+
+/*
+illuminate() and illuminateBatch() come in one variant per kind of scene, generated from shade_kernel.h, so
+its per light loop carries neither tests for a kind of primitive the scene doesn't
+have nor highlight math the materials don't need. selectShadeKernel() picks the
+variant once a scene has been compiled or loaded, from:
+- its geometry: spheres only (scenes with nothing to hit included), planes only, or both
+- its highlights: none, whole number shininess throughout, or any shininess
+*/
+#define SHADE_SPHERES 0
+#define SHADE_PLANES 1
+#define SHADE_MIXED 2
+#define SHADE_GEOMETRIES 3
+
+#define HIGHLIGHTS_NONE 0
+#define HIGHLIGHTS_INTEGER 1
+#define HIGHLIGHTS_GENERAL 2
+#define HIGHLIGHT_KINDS 3
+
+// Largest whole number shininess raised by repeated multiplication rather than powf()
+#define MAX_INTEGER_SHININESS 1024
+
+// Batched shadow rays to a light are sorted by direction into this many bins along each axis
+#define SHADOW_DIRECTION_BINS 4
+
+typedef void (*ShadeKernel)(struct CompiledScene *scene, float *color, float *point, float *normal, float *eye, int prim, ShadowCache *cache, struct RenderStats *stats);
+typedef void (*ShadeBatchKernel)(struct CompiledScene *scene, struct GBufferSample *samples, float (*colors)[3], int width, int height, int stride, float *eye, ShadowCache *cache, struct RenderStats *stats);
+
+/*
+What illuminateBatch() keeps between tiles, grown as tiles or light lists need more.
+The hits of a tile are listed once, then regrouped by light: each light's shadow
+rays are built, binned by direction and traced SHADOW_BATCH at a time, and what
+gets through is added to the colors of the samples they came from.
+*/
+typedef struct ShadowBatch {
+   int capacity;            // Samples the arrays below have room for
+   int *hitSamples;         // Sample index of each hit in the tile, row by row
+   float (*views)[3];       // Unit vector from the eye to each hit
+   int *hitLights;          // capacity + 1 offsets into gathered, with a light epsilon
+   int *lightHits;          // numLights + 1 offsets into lightLists
+   int *gathered;           // Lights reaching each hit, then hits each light reaches
+   int *lightLists;
+   int listCapacity;        // Entries gathered and lightLists have room for
+   ShadowRay *rays;         // Toward the light being shaded, one per hit it reaches
+   int *order;              // Indices of rays sorted by direction bin
+   bool *occluded;
+} ShadowBatch;
+
+void selectShadeKernel(struct CompiledScene *scene);
+const char *shadeVariantName(int variant);
+void freeShadowBatch(ShadowBatch *batch);
+
+#endif
@@ -0,0 +1,242 @@
+/*
+Shading kernel template, included once per scene variant by shade.c. The includer defines:
+- SHADE_KERNEL: name of the generated function, which shades one point; SHADE_KERNEL##Batch
+  shades a tile's worth of G-buffer samples at once
+- SHADE_HAS_SPHERES, SHADE_HAS_PLANES: 1 when the scene has primitives of that kind
+- SHADE_HIGHLIGHTS: HIGHLIGHTS_NONE, HIGHLIGHTS_INTEGER or HIGHLIGHTS_GENERAL
+
+Every variant adds up the lights in the same order with the same operations, leaving
+out only what can't contribute in its scenes, so any variant able to shade a scene
+gives the same colors and counts as the most general one.
+*/
+
+#define SHADE_CAT_(a, b) a##b
+#define SHADE_CAT(a, b) SHADE_CAT_(a, b)
+#define SHADE_OCCLUDED SHADE_CAT(SHADE_KERNEL, Occluded)
+#define SHADE_LIGHT SHADE_CAT(SHADE_KERNEL, Light)
+#define SHADE_BATCH SHADE_CAT(SHADE_KERNEL, Batch)
+
+// Returns whether anything other than currentObject lies on the ray with 0 < t < maxT
+// *occluder is tested before anything else and receives the blocking primitive, so a per light
+// slot carried from pixel to pixel usually answers the query with a single intersection test
+static bool SHADE_OCCLUDED(CompiledScene *scene, float *origin, float *dirVector, float maxT, int currentObject, int *occluder, RenderStats *stats) {
+
+   if(*occluder >= 0 && *occluder != currentObject) {
+#if SHADE_HAS_SPHERES && SHADE_HAS_PLANES
+      bool sphere = *occluder < scene->numSpheres;
+      float t = sphere ? getSphereIntersection(scene, origin, dirVector, *occluder) : \
+                         getPlaneIntersection(scene, origin, dirVector, *occluder - scene->numSpheres);
+      STAT_ADD(stats, sphere ? STAT_SPHERE_TESTS : STAT_PLANE_TESTS, 1);
+#elif SHADE_HAS_SPHERES
+      float t = getSphereIntersection(scene, origin, dirVector, *occluder);
+      STAT_ADD(stats, STAT_SPHERE_TESTS, 1);
+#else
+      // Without spheres a plane's primitive id is its index
+      float t = getPlaneIntersection(scene, origin, dirVector, *occluder);
+      STAT_ADD(stats, STAT_PLANE_TESTS, 1);
+#endif
+      if(t > 0 && t < maxT) {
+         STAT_ADD(stats, STAT_SHADOW_CACHE_HITS, 1);
+         return true;
+      }
+   }
+
+#if SHADE_HAS_PLANES
+   int planeTests = 0;
+   for(int planeInd = 0; planeInd < scene->numPlanes; planeInd++) {
+      int prim = scene->numSpheres + planeInd;
+      if(prim == currentObject) continue;
+
+      planeTests++;
+      float t = getPlaneIntersection(scene, origin, dirVector, planeInd);
+      if(t > 0 && t < maxT) {
+         STAT_ADD(stats, STAT_PLANE_TESTS, planeTests);
+         *occluder = prim;
+         return true;
+      }
+   }
+   STAT_ADD(stats, STAT_PLANE_TESTS, planeTests);
+#endif
+
+#if SHADE_HAS_SPHERES
+   int sphereInd = occludedBySpheres(scene, origin, dirVector, maxT, currentObject, stats);
+   if(sphereInd >= 0) {
+      *occluder = sphereInd;
+      return true;
+   }
+#endif
+
+   return false;
+}
+
+// Adds what light, unblocked lightDistance away along unit vector L from a point with the given normal,
+// gives back toward the viewer looking along view to illuminationColor
+static inline void SHADE_LIGHT(Material *material, Light *light, float *normal, float *view, float *L, float lightDistance, float *illuminationColor) {
+
+   // Calculate diffuse color
+   float nDotL = v3_dot_product(normal, L);
+
+   float diffuse[3] = {0, 0, 0};
+
+   if(nDotL > 0) {
+      diffuse[0] = (material->diffuseColor[0] * light->color[0] * nDotL);
+      diffuse[1] = (material->diffuseColor[1] * light->color[1] * nDotL);
+      diffuse[2] = (material->diffuseColor[2] * light->color[2] * nDotL);
+   }
+
+   // Calculate radial attenuation
+   float radatt = 1 / (light->radialA0 + \
+                      (light->radialA1 * lightDistance) + \
+                      (pow(light->radialA2 * lightDistance, 2)));
+
+#if SHADE_HIGHLIGHTS != HIGHLIGHTS_NONE
+   // Calculate specular color
+   float specular[3] = {0, 0, 0};
+
+   // Highlights peak where the view lines up with the light's mirror direction
+   if(material->shininess > 0 && nDotL > 0) {
+      float R[3];
+      v3_reflect(R, L, normal);
+      float vDotr = v3_dot_product(view, R);
+      if(vDotr > 0) {
+#if SHADE_HIGHLIGHTS == HIGHLIGHTS_INTEGER
+         float highlight = powInteger(vDotr, (int)material->shininess);
+#else
+         float highlight = powf(vDotr, material->shininess);
+#endif
+         specular[0] = (material->specularColor[0] * light->color[0] * highlight);
+         specular[1] = (material->specularColor[1] * light->color[1] * highlight);
+         specular[2] = (material->specularColor[2] * light->color[2] * highlight);
+      }
+   }
+
+   // Calculate return color by combining diffuse and specular color
+   illuminationColor[0] += radatt * (diffuse[0] + specular[0]);
+   illuminationColor[1] += radatt * (diffuse[1] + specular[1]);
+   illuminationColor[2] += radatt * (diffuse[2] + specular[2]);
+#else
+   (void)view;
+   illuminationColor[0] += radatt * (diffuse[0]);
+   illuminationColor[1] += radatt * (diffuse[1]);
+   illuminationColor[2] += radatt * (diffuse[2]);
+#endif
+}
+
+// Sums the light reaching point R0 on primitive closestObj, whose surface there has the given normal,
+// from every light that isn't blocked, as seen from eye; with a light tree, lights whose influence
+// doesn't reach R0 are skipped
+static void SHADE_KERNEL(CompiledScene *scene, float *color, float *R0, float *normal, float *eye, int closestObj, ShadowCache *cache, RenderStats *stats) {
+
+   float illuminationColor[3] = {0, 0, 0};
+
+   Material *material = &scene->materials[closestObj];
+
+   float view[3] = {0, 0, 0};
+#if SHADE_HIGHLIGHTS != HIGHLIGHTS_NONE
+   v3_subtract(view, R0, eye);
+   v3_normalize(view, view);
+#else
+   (void)eye;
+#endif
+
+   // Without culling every light is visited, in the same order the gathered lists keep
+   int *gathered = NULL;
+   int numGathered = scene->numLights;
+   if(scene->lightTree.epsilon > 0) {
+      gathered = cache->gathered;
+      numGathered = gatherLights(&scene->lightTree, R0, gathered);
+      STAT_ADD(stats, STAT_LIGHTS_CULLED, scene->numLights - numGathered);
+   }
+   stats->count[STAT_SHADOW_RAYS] += numGathered;
+
+   // For each light: create light vector L, test to see if objects are in shadow or not -> determines pixel color
+   for(int gatheredInd = 0; gatheredInd < numGathered; gatheredInd += 1) {
+
+      int lightNum = gathered ? gathered[gatheredInd] : gatheredInd;
+      Light *light = &scene->lights[lightNum];
+
+      // Calculate new direction vector
+      float L[3];
+      v3_subtract(L, light->position, R0);
+      float lightDistance = v3_normalize_length(L, L);
+
+      // Check if intersection point is lit
+      // anything between the point and the light puts it in the shadow
+      if(SHADE_OCCLUDED(scene, R0, L, lightDistance, closestObj, &cache->lastOccluder[lightNum], stats)) {
+         STAT_ADD(stats, STAT_SHADOW_OCCLUDED, 1);
+         continue;
+      }
+
+      SHADE_LIGHT(material, light, normal, view, L, lightDistance, illuminationColor);
+   }
+
+   color[0] = illuminationColor[0];
+   color[1] = illuminationColor[1];
+   color[2] = illuminationColor[2];
+}
+
+// Sums the light reaching every sample of a width x height block, stride samples per row, into colors,
+// adding the lights up in the same order as SHADE_KERNEL so each color comes out the same; samples that
+// hit nothing get black. Rather than tracing each point's shadow rays as it is shaded, every light's rays
+// from the whole block are traced together, in direction order
+static void SHADE_BATCH(CompiledScene *scene, GBufferSample *samples, float (*colors)[3], int width, int height, int stride, float *eye, ShadowCache *cache, RenderStats *stats) {
+
+   // Without room for the batch each sample is shaded on its own, which gives the same colors
+   ShadowBatch *batch = prepareShadowBatch(cache, width * height);
+   if(!batch) {
+      for(int y = 0; y < height; y++) {
+         for(int x = 0; x < width; x++) {
+            GBufferSample *sample = &samples[y * stride + x];
+            float *color = colors[y * stride + x];
+            color[0] = 0;
+            color[1] = 0;
+            color[2] = 0;
+            if(sample->t > 0) SHADE_KERNEL(scene, color, sample->point, sample->normal, eye, sample->hitObject, cache, stats);
+         }
+      }
+      return;
+   }
+
+   int numHits = listHits(batch, samples, colors, width, height, stride);
+
+#if SHADE_HIGHLIGHTS != HIGHLIGHTS_NONE
+   for(int hit = 0; hit < numHits; hit++) {
+      float *view = batch->views[hit];
+      v3_subtract(view, samples[batch->hitSamples[hit]].point, eye);
+      v3_normalize(view, view);
+   }
+#else
+   (void)eye;
+#endif
+
+   bool culled = groupHitsByLight(scene, batch, samples, numHits, stats);
+
+   for(int lightNum = 0; lightNum < scene->numLights; lightNum++) {
+
+      Light *light = &scene->lights[lightNum];
+      int *members = culled ? &batch->lightLists[batch->lightHits[lightNum]] : NULL;
+      int numRays = culled ? batch->lightHits[lightNum + 1] - batch->lightHits[lightNum] : numHits;
+      stats->count[STAT_SHADOW_RAYS] += numRays;
+
+      castShadowRays(scene, batch, samples, light, members, numRays, &cache->lastOccluder[lightNum], stats);
+
+      for(int rayInd = 0; rayInd < numRays; rayInd++) {
+         if(batch->occluded[rayInd]) {
+            STAT_ADD(stats, STAT_SHADOW_OCCLUDED, 1);
+            continue;
+         }
+
+         int hit = members ? members[rayInd] : rayInd;
+         int sampleInd = batch->hitSamples[hit];
+         GBufferSample *sample = &samples[sampleInd];
+         ShadowRay *ray = &batch->rays[rayInd];
+         SHADE_LIGHT(&scene->materials[sample->hitObject], light, sample->normal, batch->views[hit], ray->direction, ray->maxT, colors[sampleInd]);
+      }
+   }
+}
+
+#undef SHADE_BATCH
+#undef SHADE_LIGHT
+#undef SHADE_OCCLUDED
+#undef SHADE_CAT
+#undef SHADE_CAT_
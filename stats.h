@@ -0,0 +1,50 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <time.h>
+
+/*
+Hot path counters. Every render thread counts into its own RenderStats, passed down
+the trace calls next to its ShadowCache, and renderImage() adds them up once the
+threads finish, so counting never touches memory shared between threads. Loops keep
+their counts in locals and add them once per call.
+
+Building with -DNO_STATS (make STATS=0) compiles STAT_ADD() out. Primary and shadow
+rays are counted once per pixel or shaded point rather than in the intersection loops,
+so they are kept either way.
+*/
+enum {
+   STAT_PRIMARY_RAYS,      // Including packet lanes that fall outside the image
+   STAT_SHADOW_RAYS,
+   STAT_SHADOW_OCCLUDED,   // Shadow rays that found something before the light
+   STAT_SHADOW_CACHE_HITS, // Shadow rays answered by the primitive cached for their light
+   STAT_LIGHTS_CULLED,     // Lights left out at a shaded point because their influence doesn't reach it
+   STAT_SPHERE_TESTS,      // Ray-sphere tests, one per packet lane
+   STAT_PLANE_TESTS,       // Ray-plane tests, one per packet lane
+   STAT_BVH_NODES,         // BVH nodes whose bounds were tested, once per packet
+   STAT_TILES,
+   STAT_AA_PIXELS,         // Pixels anti-aliasing resampled
+   NUM_STATS
+};
+
+typedef struct RenderStats {
+   long long count[NUM_STATS];
+   double storeSeconds;    // Spent storing finished tiles into the output, summed over threads
+} RenderStats;
+
+// Phase timers read this monotonic clock
+static inline double monotonicSeconds(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#ifdef NO_STATS
+#define STATS_ENABLED 0
+#define STAT_ADD(stats, counter, n) ((void)0)
+#else
+#define STATS_ENABLED 1
+#define STAT_ADD(stats, counter, n) ((stats)->count[counter] += (n))
+#endif
+
+#endif
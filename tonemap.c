@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "raycast.h"
+#include "packet.h"
+#include "tonemap.h"
+
+// What the kernels need of a ToneMap, worked out once per call
+typedef struct ToneParams {
+   int op;
+   float scale;      // 2^exposure
+   float invGamma;
+   bool dither;
+} ToneParams;
+
+#define TONEMAP_WIDTH 1
+#define TONEMAP_KERNEL toneMapScalar
+#include "tonemap_kernel.h"
+#undef TONEMAP_WIDTH
+#undef TONEMAP_KERNEL
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TONEMAP_X86 1
+
+#define TONEMAP_WIDTH 4
+#define TONEMAP_TARGET "sse2"
+#define TONEMAP_KERNEL toneMapSSE
+#include "tonemap_kernel.h"
+#undef TONEMAP_WIDTH
+#undef TONEMAP_TARGET
+#undef TONEMAP_KERNEL
+
+#define TONEMAP_WIDTH 8
+#define TONEMAP_TARGET "avx2"
+#define TONEMAP_KERNEL toneMapAVX2
+#include "tonemap_kernel.h"
+#undef TONEMAP_WIDTH
+#undef TONEMAP_TARGET
+#undef TONEMAP_KERNEL
+
+#define TONEMAP_WIDTH 16
+#define TONEMAP_TARGET "avx512f"
+#define TONEMAP_KERNEL toneMapAVX512
+#include "tonemap_kernel.h"
+#undef TONEMAP_WIDTH
+#undef TONEMAP_TARGET
+#undef TONEMAP_KERNEL
+#endif
+
+
+static const char *toneMapOpNames[] = {"clamp", "reinhard", "aces"};
+
+// The defaults, which quantize the way the renderer always has
+void initToneMap(ToneMap *map, int simdMode) {
+   map->op = TONEMAP_CLAMP;
+   map->exposure = 0;
+   map->gamma = 1;
+   map->dither = false;
+   map->simdMode = simdMode;
+}
+
+// Returns the TONEMAP_* value for a --tonemap argument, or -1 when it is not recognised
+int parseToneMapOp(const char *name) {
+
+   for(int op = TONEMAP_CLAMP; op <= TONEMAP_ACES; op++) {
+      if(strcmp(name, toneMapOpNames[op]) == 0) return op;
+   }
+
+   return -1;
+}
+
+// Whether map makes use of radiance above 1, so samples must not be clamped before it runs
+// Clamping every sample first is what the plain clamp has always done, anti-aliasing included
+bool toneMapNeedsRadiance(ToneMap *map) {
+   return map->op != TONEMAP_CLAMP || map->exposure != 0;
+}
+
+// Quantizes count RGB triples of radiance at rgb, the pixels from (imgX, imgY) on, into out
+void toneMapPixels(ToneMap *map, const float *rgb, uint8_t *out, int count, int imgX, int imgY) {
+
+   ToneParams params = {map->op, exp2f(map->exposure), 1 / map->gamma, map->dither};
+   int numChannels = count * 3;
+   uint32_t firstChannel = (uint32_t)imgX * 3;
+
+#if TONEMAP_X86
+   if(map->simdMode == SIMD_AVX512) {
+      toneMapAVX512(&params, rgb, out, numChannels, firstChannel, imgY);
+      return;
+   }
+   if(map->simdMode == SIMD_AVX2) {
+      toneMapAVX2(&params, rgb, out, numChannels, firstChannel, imgY);
+      return;
+   }
+   if(map->simdMode == SIMD_SSE) {
+      toneMapSSE(&params, rgb, out, numChannels, firstChannel, imgY);
+      return;
+   }
+#endif
+   toneMapScalar(&params, rgb, out, numChannels, firstChannel, imgY);
+}
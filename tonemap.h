@@ -0,0 +1,37 @@
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Turning the radiance a render computes into 8 bit channels, one step for every
+channel of a row of pixels:
+- Scaled by 2^exposure
+- Compressed into [0, 1] by the operator, anything still outside it clamped
+- Raised to 1 / gamma
+- Multiplied by 255 and truncated; dithering first adds up to one step of noise,
+  hashed from the pixel and channel, so the image still doesn't depend on the
+  thread count or the tiling and smooth gradients don't band
+
+The defaults, clamp with exposure 0 and gamma 1 without dithering, give the bytes
+the renderer always wrote.
+*/
+#define TONEMAP_CLAMP 0
+#define TONEMAP_REINHARD 1   // c / (1 + c) per channel
+#define TONEMAP_ACES 2       // Narkowicz's fit of the ACES filmic curve
+
+typedef struct ToneMap {
+   int op;           // TONEMAP_*
+   float exposure;   // Stops; each one doubles the radiance
+   float gamma;
+   bool dither;
+   int simdMode;     // Resolved SIMD_* mode, which picks the kernel; every kernel gives the same bytes
+} ToneMap;
+
+void initToneMap(ToneMap *map, int simdMode);
+int parseToneMapOp(const char *name);
+bool toneMapNeedsRadiance(ToneMap *map);
+void toneMapPixels(ToneMap *map, const float *rgb, uint8_t *out, int count, int imgX, int imgY);
+
+#endif
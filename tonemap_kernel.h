@@ -0,0 +1,105 @@
+/*
+Tone mapping kernel template, included once per vector width by tonemap.c.
+The includer defines:
+- TONEMAP_WIDTH: channels per vector
+- TONEMAP_TARGET: target attribute string the kernel is compiled for, undefined for plain C
+- TONEMAP_KERNEL: name of the generated function
+
+A row's channels are processed as one flat run of floats, TONEMAP_WIDTH at a time.
+Every lane performs the same IEEE operations in the same order whatever the width,
+so all kernels turn a channel into the same byte.
+*/
+
+#define TONE_CAT_(a, b) a##b
+#define TONE_CAT(a, b) TONE_CAT_(a, b)
+#define ToneFloat TONE_CAT(ToneFloat, TONEMAP_WIDTH)
+#define ToneInt TONE_CAT(ToneInt, TONEMAP_WIDTH)
+#define ToneUint TONE_CAT(ToneUint, TONEMAP_WIDTH)
+
+typedef float ToneFloat __attribute__((vector_size(TONEMAP_WIDTH * 4)));
+typedef int32_t ToneInt __attribute__((vector_size(TONEMAP_WIDTH * 4)));
+typedef uint32_t ToneUint __attribute__((vector_size(TONEMAP_WIDTH * 4)));
+
+// Lane-wise mask ? a : b for float vectors
+#define TONE_SELECT(mask, a, b) ((ToneFloat)(((ToneInt)(a) & (mask)) | ((ToneInt)(b) & ~(mask))))
+
+#ifdef TONEMAP_TARGET
+__attribute__((target(TONEMAP_TARGET)))
+#endif
+static void TONEMAP_KERNEL(const ToneParams *params, const float *rgb, uint8_t *out, int numChannels, uint32_t firstChannel, uint32_t imgY) {
+
+   ToneFloat zero, one, maxByte, lanes;
+   for(int lane = 0; lane < TONEMAP_WIDTH; lane++) {
+      zero[lane] = 0;
+      one[lane] = 1;
+      maxByte[lane] = 255;
+      lanes[lane] = lane;
+   }
+
+   for(int start = 0; start < numChannels; start += TONEMAP_WIDTH) {
+
+      // The last vector of a row may be partly past its end
+      int count = numChannels - start < TONEMAP_WIDTH ? numChannels - start : TONEMAP_WIDTH;
+      ToneFloat v = zero;
+      memcpy(&v, rgb + start, count * sizeof(float));
+
+      v = v * params->scale;
+      if(params->op == TONEMAP_REINHARD) {
+         v = v / (one + v);
+      }
+      else if(params->op == TONEMAP_ACES) {
+         v = (v * (2.51f * v + 0.03f)) / (v * (2.43f * v + 0.59f) + 0.14f);
+      }
+
+      // NaNs fail both tests and end up 0
+      v = TONE_SELECT(v > one, one, v);
+      v = TONE_SELECT(v > zero, v, zero);
+
+      // v^(1 / gamma) as 2^(log2(v) / gamma), only for v in (0, 1]
+      if(params->invGamma != 1) {
+         ToneInt bits = (ToneInt)v;
+         ToneFloat exponent = __builtin_convertvector(((bits >> 23) & 0xff) - 127, ToneFloat);
+         ToneFloat mantissa = (ToneFloat)((bits & 0x007fffff) | 0x3f800000);
+
+         // log2 of the mantissa in [1, 2) from the series of atanh((m - 1) / (m + 1))
+         ToneFloat t = (mantissa - one) / (mantissa + one);
+         ToneFloat t2 = t * t;
+         ToneFloat series = t * (1 + t2 * (1.0f / 3 + t2 * (1.0f / 5 + t2 * (1.0f / 7 + t2 * (1.0f / 9)))));
+         ToneFloat y = (exponent + series * 2.88539008f) * params->invGamma;
+         y = TONE_SELECT(y < -126, zero - 126, y);
+
+         // Split y into a whole power of two and 2^f for f in [0, 1)
+         ToneInt whole = __builtin_convertvector(y, ToneInt);
+         whole = whole + (__builtin_convertvector(whole, ToneFloat) > y);
+         ToneFloat f = (y - __builtin_convertvector(whole, ToneFloat)) * 0.693147181f;
+         ToneFloat power = 1 + f * (1 + f * (1.0f / 2 + f * (1.0f / 6 + f * (1.0f / 24 + f * (1.0f / 120 + f * (1.0f / 720 + f * (1.0f / 5040)))))));
+         power = power * (ToneFloat)((whole + 127) << 23);
+
+         v = TONE_SELECT(v > zero, power, zero);
+      }
+
+      ToneFloat quantized = v * maxByte;
+      if(params->dither) {
+         ToneUint hash = __builtin_convertvector(lanes, ToneUint) + (firstChannel + start);
+         hash = (hash * 0x9e3779b1u) ^ (imgY * 0x85ebca77u);
+         hash ^= hash >> 16;
+         hash *= 0x7feb352du;
+         hash ^= hash >> 15;
+         hash *= 0x846ca68bu;
+         hash ^= hash >> 16;
+         quantized = quantized + __builtin_convertvector(hash >> 8, ToneFloat) * (1.0f / 16777216);
+         quantized = TONE_SELECT(quantized > maxByte, maxByte, quantized);
+      }
+
+      // Truncates, like the float to byte conversion it replaces
+      ToneInt bytes = __builtin_convertvector(quantized, ToneInt);
+      for(int lane = 0; lane < count; lane++) {
+         out[start + lane] = bytes[lane];
+      }
+   }
+}
+
+#undef TONE_SELECT
+#undef ToneFloat
+#undef ToneInt
+#undef ToneUint
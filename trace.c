@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include "raycast.h"
+#include "bvh.h"
+#include "scene.h"
+#include "stats.h"
+
+
+// Given an origin and a unit direction vector, find if any intersections occur with a plane
+float getPlaneIntersection(CompiledScene *scene, float *origin, float *directionVector, int planeInd) {
+
+   float nx = scene->planeNX[planeInd];
+   float ny = scene->planeNY[planeInd];
+   float nz = scene->planeNZ[planeInd];
+
+   float closestT = (scene->planeOffset[planeInd] - (nx * origin[0] + ny * origin[1] + nz * origin[2])) \
+                    / (nx * directionVector[0] + ny * directionVector[1] + nz * directionVector[2]);
+
+   // Intersection point behind origin (camera)
+   if (closestT < 0){
+      return -1;
+   }
+
+   return closestT;
+}
+
+// Given an origin and a unit direction vector, find if any intersections occur with a sphere
+float getSphereIntersection(CompiledScene *scene, float *origin, float *directionVector, int sphereInd) {
+
+   float ox = origin[0] - scene->sphereX[sphereInd];
+   float oy = origin[1] - scene->sphereY[sphereInd];
+   float oz = origin[2] - scene->sphereZ[sphereInd];
+
+   // With a unit direction vector A is 1
+   float b = 2 * (directionVector[0] * ox + directionVector[1] * oy + directionVector[2] * oz);
+   float c = ox * ox + oy * oy + oz * oz - scene->sphereRadius2[sphereInd];
+
+   float discriminant = b * b - 4 * c;
+   if(discriminant < 0) {
+      return -1;
+   }
+
+   // Calulating t values which are a magnitude, but this reduces down to a single float
+   float root = sqrtf(discriminant);
+   float t0 = (-b - root) / 2;
+   float t1 = (-b + root) / 2;
+
+   // t0 <= t1, so t0 is the closest unless it is behind the origin
+   if(t0 > 0) return t0;
+   if(t1 > 0) return t1;
+   return -1;
+}
+
+// Slab test; returns the entry distance or INFINITY when the ray misses the box before maxT
+static float intersectBounds(BVHNode *node, float *origin, float *invDir, float maxT) {
+
+   float tNear = 0;
+   float tFar = maxT;
+
+   for(int axis = 0; axis < 3; axis++) {
+      float t0 = (node->boundsMin[axis] - origin[axis]) * invDir[axis];
+      float t1 = (node->boundsMax[axis] - origin[axis]) * invDir[axis];
+      if(t0 > t1) {
+         float swap = t0;
+         t0 = t1;
+         t1 = swap;
+      }
+      // Written so a NaN from 0 * INFINITY leaves the interval untouched
+      tNear = t0 > tNear ? t0 : tNear;
+      tFar = t1 < tFar ? t1 : tFar;
+   }
+
+   if(tNear > tFar) return INFINITY;
+   return tNear;
+}
+
+// Closest hit search over the spheres in the BVH, skipping currentObject
+// closestT and hitObject are only updated when a closer sphere is found
+static void intersectBVH(CompiledScene *scene, float *origin, float *dirVector, int currentObject, float *closestT, int *hitObject, RenderStats *stats) {
+
+   BVH *bvh = &scene->bvh;
+   if(bvh->numPrims == 0) return;
+
+   float invDir[3] = {1 / dirVector[0], 1 / dirVector[1], 1 / dirVector[2]};
+   int stack[BVH_MAX_DEPTH * 2 + 2];
+   int stackSize = 0;
+   int nodeTests = 1;
+   int sphereTests = 0;
+
+   if(intersectBounds(&bvh->nodes[0], origin, invDir, *closestT) == INFINITY) {
+      STAT_ADD(stats, STAT_BVH_NODES, nodeTests);
+      return;
+   }
+   stack[stackSize++] = 0;
+
+   while(stackSize > 0) {
+
+      BVHNode *node = &bvh->nodes[stack[--stackSize]];
+
+      // Leaves cover a contiguous run of spheres
+      if(node->count > 0) {
+         sphereTests += node->count;
+         for(int sphereInd = node->start; sphereInd < node->start + node->count; sphereInd++) {
+            if(sphereInd == currentObject) continue;
+
+            float t = getSphereIntersection(scene, origin, dirVector, sphereInd);
+            if(t > 0 && t < *closestT) {
+               *closestT = t;
+               *hitObject = sphereInd;
+            }
+         }
+         continue;
+      }
+
+      // Visit the nearer child first so the farther one is more likely to be culled
+      nodeTests += 2;
+      float tLeft = intersectBounds(&bvh->nodes[node->start], origin, invDir, *closestT);
+      float tRight = intersectBounds(&bvh->nodes[node->start + 1], origin, invDir, *closestT);
+
+      if(tLeft <= tRight) {
+         if(tRight != INFINITY) stack[stackSize++] = node->start + 1;
+         if(tLeft != INFINITY) stack[stackSize++] = node->start;
+      }
+      else {
+         if(tLeft != INFINITY) stack[stackSize++] = node->start;
+         stack[stackSize++] = node->start + 1;
+      }
+   }
+
+   STAT_ADD(stats, STAT_BVH_NODES, nodeTests);
+   STAT_ADD(stats, STAT_SPHERE_TESTS, sphereTests);
+}
+
+// Shoots a ray from origin using dirVector, stores the primitive it hits into hitObject
+// Returns the t value of the closest intersection, or -1 when nothing is hit
+float shoot(CompiledScene *scene, float *origin, float *dirVector, int currentObject, int *hitObject, RenderStats *stats) {
+
+   float closestT = INFINITY;
+   *hitObject = -1;
+
+   intersectBVH(scene, origin, dirVector, currentObject, &closestT, hitObject, stats);
+   STAT_ADD(stats, STAT_PLANE_TESTS, scene->numPlanes);
+
+   // Planes are unbounded, so they are tested one by one
+   for(int planeInd = 0; planeInd < scene->numPlanes; planeInd++) {
+
+      // Skip current object
+      if(scene->numSpheres + planeInd == currentObject) {
+         continue;
+      }
+
+      float t = getPlaneIntersection(scene, origin, dirVector, planeInd);
+      if (t > 0 && t < closestT){
+         closestT = t;
+         *hitObject = scene->numSpheres + planeInd;
+      }
+   }
+
+   // No intersection found
+   if (closestT == INFINITY) return -1;
+
+   // intersection found, return the t value
+   return closestT;
+}
+
+// Any hit search over the BVH: stops at the first sphere other than currentObject with 0 < t < maxT
+// Returns that sphere, or -1 when the ray reaches maxT unblocked
+int occludedBySpheres(CompiledScene *scene, float *origin, float *dirVector, float maxT, int currentObject, RenderStats *stats) {
+
+   BVH *bvh = &scene->bvh;
+   if(bvh->numPrims == 0) return -1;
+
+   float invDir[3] = {1 / dirVector[0], 1 / dirVector[1], 1 / dirVector[2]};
+   int stack[BVH_MAX_DEPTH * 2 + 2];
+   int stackSize = 0;
+   int nodeTests = 0;
+   int sphereTests = 0;
+   int found = -1;
+
+   stack[stackSize++] = 0;
+
+   while(stackSize > 0 && found < 0) {
+
+      BVHNode *node = &bvh->nodes[stack[--stackSize]];
+
+      nodeTests += 1;
+      if(intersectBounds(node, origin, invDir, maxT) == INFINITY) continue;
+
+      if(node->count > 0) {
+         for(int sphereInd = node->start; sphereInd < node->start + node->count; sphereInd++) {
+            if(sphereInd == currentObject) continue;
+
+            sphereTests += 1;
+            float t = getSphereIntersection(scene, origin, dirVector, sphereInd);
+            if(t > 0 && t < maxT) {
+               found = sphereInd;
+               break;
+            }
+         }
+         continue;
+      }
+
+      // Order does not matter for an any hit query
+      stack[stackSize++] = node->start + 1;
+      stack[stackSize++] = node->start;
+   }
+
+   STAT_ADD(stats, STAT_BVH_NODES, nodeTests);
+   STAT_ADD(stats, STAT_SPHERE_TESTS, sphereTests);
+   return found;
+}
+
+// Primitive prim's intersection with a ray, whichever kind it is
+static float intersectPrimitive(CompiledScene *scene, float *origin, float *dirVector, int prim, RenderStats *stats) {
+   if(prim < scene->numSpheres) {
+      STAT_ADD(stats, STAT_SPHERE_TESTS, 1);
+      return getSphereIntersection(scene, origin, dirVector, prim);
+   }
+   STAT_ADD(stats, STAT_PLANE_TESTS, 1);
+   return getPlaneIntersection(scene, origin, dirVector, prim - scene->numSpheres);
+}
+
+// Any hit search for up to SHADOW_BATCH rays toward one light, rays[order[0]] to rays[order[count - 1]]
+// Sets occluded[] of each; *occluder is tried first, as for a single ray, and receives the last primitive found blocking
+// The BVH is walked once for the whole batch, each node carrying a bit per ray still inside its bounds, so rays
+// heading the same way share node and sphere loads instead of each fetching them on its own walk
+void occludedBatch(CompiledScene *scene, ShadowRay *rays, int *order, int count, int *occluder, bool *occluded, RenderStats *stats) {
+
+   uint32_t pending = 0;
+   int cacheHits = 0;
+
+   for(int lane = 0; lane < count; lane++) {
+      ShadowRay *ray = &rays[order[lane]];
+      occluded[order[lane]] = false;
+
+      if(*occluder >= 0 && *occluder != ray->exclude) {
+         float t = intersectPrimitive(scene, ray->origin, ray->direction, *occluder, stats);
+         if(t > 0 && t < ray->maxT) {
+            occluded[order[lane]] = true;
+            cacheHits += 1;
+            continue;
+         }
+      }
+      pending |= 1u << lane;
+   }
+   STAT_ADD(stats, STAT_SHADOW_CACHE_HITS, cacheHits);
+
+   // Planes are unbounded, so every ray tests every plane until one blocks it
+   int planeTests = 0;
+   for(uint32_t lanes = pending; lanes; lanes &= lanes - 1) {
+      int lane = __builtin_ctz(lanes);
+      ShadowRay *ray = &rays[order[lane]];
+      for(int planeInd = 0; planeInd < scene->numPlanes; planeInd++) {
+         int prim = scene->numSpheres + planeInd;
+         if(prim == ray->exclude) continue;
+
+         planeTests++;
+         float t = getPlaneIntersection(scene, ray->origin, ray->direction, planeInd);
+         if(t > 0 && t < ray->maxT) {
+            occluded[order[lane]] = true;
+            pending &= ~(1u << lane);
+            *occluder = prim;
+            break;
+         }
+      }
+   }
+   STAT_ADD(stats, STAT_PLANE_TESTS, planeTests);
+
+   BVH *bvh = &scene->bvh;
+   if(bvh->numPrims == 0 || !pending) return;
+
+   float invDir[SHADOW_BATCH][3];
+   for(uint32_t lanes = pending; lanes; lanes &= lanes - 1) {
+      int lane = __builtin_ctz(lanes);
+      float *direction = rays[order[lane]].direction;
+      invDir[lane][0] = 1 / direction[0];
+      invDir[lane][1] = 1 / direction[1];
+      invDir[lane][2] = 1 / direction[2];
+   }
+
+   int stack[BVH_MAX_DEPTH * 2 + 2];
+   uint32_t stackLanes[BVH_MAX_DEPTH * 2 + 2];
+   int stackSize = 0;
+   int nodeTests = 0;
+   int sphereTests = 0;
+
+   stack[stackSize] = 0;
+   stackLanes[stackSize++] = pending;
+
+   while(stackSize > 0 && pending) {
+
+      stackSize -= 1;
+      BVHNode *node = &bvh->nodes[stack[stackSize]];
+
+      // Rays blocked since the node was pushed drop out
+      uint32_t inside = 0;
+      for(uint32_t lanes = stackLanes[stackSize] & pending; lanes; lanes &= lanes - 1) {
+         int lane = __builtin_ctz(lanes);
+         ShadowRay *ray = &rays[order[lane]];
+         nodeTests += 1;
+         if(intersectBounds(node, ray->origin, invDir[lane], ray->maxT) != INFINITY) inside |= 1u << lane;
+      }
+      if(!inside) continue;
+
+      if(node->count > 0) {
+         for(int sphereInd = node->start; sphereInd < node->start + node->count && inside; sphereInd++) {
+            for(uint32_t lanes = inside; lanes; lanes &= lanes - 1) {
+               int lane = __builtin_ctz(lanes);
+               ShadowRay *ray = &rays[order[lane]];
+               if(sphereInd == ray->exclude) continue;
+
+               sphereTests += 1;
+               float t = getSphereIntersection(scene, ray->origin, ray->direction, sphereInd);
+               if(t > 0 && t < ray->maxT) {
+                  occluded[order[lane]] = true;
+                  inside &= ~(1u << lane);
+                  pending &= ~(1u << lane);
+                  *occluder = sphereInd;
+               }
+            }
+         }
+         continue;
+      }
+
+      // Order does not matter for an any hit query
+      stack[stackSize] = node->start + 1;
+      stackLanes[stackSize++] = inside;
+      stack[stackSize] = node->start;
+      stackLanes[stackSize++] = inside;
+   }
+
+   STAT_ADD(stats, STAT_BVH_NODES, nodeTests);
+   STAT_ADD(stats, STAT_SPHERE_TESTS, sphereTests);
+}
+
+// Sizes cache for the scene's lights with nothing cached yet
+// Returns 0 on success and -1 when out of memory, leaving nothing for freeShadowCache() to do
+int initShadowCache(ShadowCache *cache, CompiledScene *scene) {
+
+   cache->numLights = scene->numLights;
+
+   cache->lastOccluder = malloc(sizeof(int) * (cache->numLights + 1));
+   cache->gathered = malloc(sizeof(int) * (cache->numLights + 1));
+   cache->batch = NULL;
+   if(!cache->lastOccluder || !cache->gathered) {
+      freeShadowCache(cache);
+      return -1;
+   }
+
+   for(int light = 0; light < cache->numLights; light++) {
+      cache->lastOccluder[light] = -1;
+   }
+
+   return 0;
+}
+
+void freeShadowCache(ShadowCache *cache) {
+   free(cache->lastOccluder);
+   free(cache->gathered);
+   freeShadowBatch(cache->batch);
+   cache->lastOccluder = NULL;
+   cache->gathered = NULL;
+   cache->batch = NULL;
+   cache->numLights = 0;
+}
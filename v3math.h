@@ -1,21 +1,255 @@
 #ifndef V3MATH_H
 #define V3MATH_H
 
-#include "v3math.h"
-#include "raycast.h"
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
 
-void v3_add(float *dst, float *a, float *b);
-float v3_angle(float *a, float *b); // angle between a and b
-float v3_angle_quick(float *a, float *b); // angle between a and b; no cos-1
-void v3_cross_product(float *dst, float *a, float *b);
-float v3_dot_product(float *a, float *b);
-bool v3_equals(float *a, float *b, float tolerance);
-void v3_from_points(float *dst, float *head, float *tail);
-float v3_length(float *a);
-void v3_normalize(float *dst, float *a);
-void v3_reflect(float *dst, float *v, float *n);
-void v3_scale(float *dst, float s);
-void v3_subtract(float *dst, float *a, float *b);
+/*
+Header only vector math, static inline throughout so the shading loop's vector
+operations compile down to a few instructions instead of calls through float pointers.
+
+- v3_*: float[3] arrays, the way the scene and the render loop store vectors. Every
+  output may alias an input, and nothing but the output is written.
+- vec3 / vec4: vectors passed by value. Where SSE is available (every x86-64 build)
+  they are 16 byte GCC vector types, vec3 keeping its fourth lane at 0, so their
+  arithmetic maps onto single SSE instructions (VEX encoded ones under -mavx). With
+  -DV3MATH_SCALAR, or without SSE, they are plain arrays of floats. Both versions do
+  the same IEEE operations in the same order, so they agree bit for bit.
+
+Lengths are single precision, sqrtf() of the summed squares. The *_fast variants start
+from the hardware reciprocal square root estimate, good to about 12 bits, which one
+Newton step brings within a few ulps; they are for callers that can live with that.
+Without SSE there is no estimate to start from and they divide by sqrtf() instead.
+*/
+
+#if defined(__SSE__) && !defined(V3MATH_SCALAR)
+#define V3MATH_SIMD 1
+#include <xmmintrin.h>
+typedef float vec4 __attribute__((vector_size(16)));
+typedef vec4 vec3;
+#define V3_LANE(v, i) ((v)[i])
+#else
+#define V3MATH_SIMD 0
+typedef struct vec3 { float v[3]; } vec3;
+typedef struct vec4 { float v[4]; } vec4;
+#define V3_LANE(a, i) ((a).v[i])
+#endif
+
+// 1 / sqrt(x) from the hardware estimate refined by newtonSteps Newton-Raphson steps
+static inline float v3_rsqrt_fast(float x, int newtonSteps) {
+#if V3MATH_SIMD
+   float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+   for(int step = 0; step < newtonSteps; step++) {
+      y = y * (1.5f - 0.5f * x * y * y);
+   }
+   return y;
+#else
+   (void)newtonSteps;
+   return 1 / sqrtf(x);
+#endif
+}
+
+
+// float[3] operations
+
+static inline void v3_add(float *dst, float *a, float *b) {
+   dst[0] = a[0] + b[0];
+   dst[1] = a[1] + b[1];
+   dst[2] = a[2] + b[2];
+}
+
+static inline void v3_subtract(float *dst, float *a, float *b) {
+   dst[0] = a[0] - b[0];
+   dst[1] = a[1] - b[1];
+   dst[2] = a[2] - b[2];
+}
+
+// head to tail
+static inline void v3_from_points(float *dst, float *head, float *tail) {
+   v3_subtract(dst, tail, head);
+}
+
+static inline void v3_scale(float *dst, float s) {
+   dst[0] = dst[0] * s;
+   dst[1] = dst[1] * s;
+   dst[2] = dst[2] * s;
+}
+
+static inline float v3_dot_product(float *a, float *b) {
+   return (a[0] * b[0]) + (a[1] * b[1]) + (a[2] * b[2]);
+}
+
+static inline void v3_cross_product(float *dst, float *a, float *b) {
+   float x = (a[1] * b[2]) - (a[2] * b[1]);
+   float y = (a[2] * b[0]) - (a[0] * b[2]);
+   float z = (a[0] * b[1]) - (a[1] * b[0]);
+   dst[0] = x;
+   dst[1] = y;
+   dst[2] = z;
+}
+
+static inline float v3_length(float *a) {
+   return sqrtf(v3_dot_product(a, a));
+}
+
+// Scales a to unit length into dst and returns the length it had, for callers that need both
+static inline float v3_normalize_length(float *dst, float *a) {
+   float length = v3_length(a);
+   dst[0] = a[0] / length;
+   dst[1] = a[1] / length;
+   dst[2] = a[2] / length;
+   return length;
+}
+
+static inline void v3_normalize(float *dst, float *a) {
+   v3_normalize_length(dst, a);
+}
+
+// Unit length through v3_rsqrt_fast(), a few ulps off v3_normalize()
+static inline void v3_normalize_fast(float *dst, float *a, int newtonSteps) {
+   float inverse = v3_rsqrt_fast(v3_dot_product(a, a), newtonSteps);
+   dst[0] = a[0] * inverse;
+   dst[1] = a[1] * inverse;
+   dst[2] = a[2] * inverse;
+}
+
+// v mirrored about the plane with normal n, v - 2 (v . n) n; n must be unit length and is left alone
+static inline void v3_reflect(float *dst, float *v, float *n) {
+   float twice = 2 * v3_dot_product(v, n);
+   dst[0] = v[0] - n[0] * twice;
+   dst[1] = v[1] - n[1] * twice;
+   dst[2] = v[2] - n[2] * twice;
+}
+
+// Angle between a and b in degrees
+static inline float v3_angle(float *a, float *b) {
+   return acosf(v3_dot_product(a, b) / (v3_length(b) * v3_length(a))) * 180 / M_PI;
+}
+
+// Cosine of the angle between a and b scaled to degrees, skipping acos; only good for comparing small angles
+static inline float v3_angle_quick(float *a, float *b) {
+   return (v3_dot_product(a, b) / (v3_length(a) * v3_length(b))) * 180 / M_PI;
+}
+
+// Whether every coordinate of b is within tolerance of a's
+static inline bool v3_equals(float *a, float *b, float tolerance) {
+   for(int i = 0; i < 3; i++) {
+      if(b[i] < a[i] - tolerance || b[i] > a[i] + tolerance) return false;
+   }
+   return true;
+}
+
+
+// vec3 and vec4 values
+
+static inline vec3 vec3_make(float x, float y, float z) {
+#if V3MATH_SIMD
+   return (vec3){x, y, z, 0};
+#else
+   return (vec3){{x, y, z}};
+#endif
+}
+
+static inline vec4 vec4_make(float x, float y, float z, float w) {
+#if V3MATH_SIMD
+   return (vec4){x, y, z, w};
+#else
+   return (vec4){{x, y, z, w}};
+#endif
+}
+
+static inline vec3 vec3_load(const float *p) {
+   return vec3_make(p[0], p[1], p[2]);
+}
+
+static inline void vec3_store(float *p, vec3 a) {
+   p[0] = V3_LANE(a, 0);
+   p[1] = V3_LANE(a, 1);
+   p[2] = V3_LANE(a, 2);
+}
+
+static inline vec4 vec4_load(const float *p) {
+#if V3MATH_SIMD
+   vec4 a;
+   memcpy(&a, p, sizeof(a));
+   return a;
+#else
+   return vec4_make(p[0], p[1], p[2], p[3]);
+#endif
+}
+
+static inline void vec4_store(float *p, vec4 a) {
+   memcpy(p, &a, sizeof(float) * 4);
+}
+
+// Lane wise arithmetic; on the scalar side vec3 and vec4 need their own loops
+#if V3MATH_SIMD
+static inline vec3 vec3_add(vec3 a, vec3 b) { return a + b; }
+static inline vec3 vec3_sub(vec3 a, vec3 b) { return a - b; }
+static inline vec3 vec3_mul(vec3 a, vec3 b) { return a * b; }
+static inline vec3 vec3_scale(vec3 a, float s) { return a * (vec3){s, s, s, 0}; }
+static inline vec4 vec4_add(vec4 a, vec4 b) { return a + b; }
+static inline vec4 vec4_sub(vec4 a, vec4 b) { return a - b; }
+static inline vec4 vec4_mul(vec4 a, vec4 b) { return a * b; }
+static inline vec4 vec4_scale(vec4 a, float s) { return a * s; }
+#else
+#define V3MATH_LANEWISE(type, name, lanes, expr) \
+   static inline type name(type a, type b) { type r; for(int i = 0; i < lanes; i++) r.v[i] = expr; return r; }
+V3MATH_LANEWISE(vec3, vec3_add, 3, a.v[i] + b.v[i])
+V3MATH_LANEWISE(vec3, vec3_sub, 3, a.v[i] - b.v[i])
+V3MATH_LANEWISE(vec3, vec3_mul, 3, a.v[i] * b.v[i])
+V3MATH_LANEWISE(vec4, vec4_add, 4, a.v[i] + b.v[i])
+V3MATH_LANEWISE(vec4, vec4_sub, 4, a.v[i] - b.v[i])
+V3MATH_LANEWISE(vec4, vec4_mul, 4, a.v[i] * b.v[i])
+#undef V3MATH_LANEWISE
+static inline vec3 vec3_scale(vec3 a, float s) { return vec3_make(a.v[0] * s, a.v[1] * s, a.v[2] * s); }
+static inline vec4 vec4_scale(vec4 a, float s) { return vec4_make(a.v[0] * s, a.v[1] * s, a.v[2] * s, a.v[3] * s); }
+#endif
+
+// Products are summed x, y, z (then w) like v3_dot_product()
+static inline float vec3_dot(vec3 a, vec3 b) {
+   vec3 p = vec3_mul(a, b);
+   return (V3_LANE(p, 0) + V3_LANE(p, 1)) + V3_LANE(p, 2);
+}
+
+static inline float vec4_dot(vec4 a, vec4 b) {
+   vec4 p = vec4_mul(a, b);
+   return ((V3_LANE(p, 0) + V3_LANE(p, 1)) + V3_LANE(p, 2)) + V3_LANE(p, 3);
+}
+
+static inline vec3 vec3_cross(vec3 a, vec3 b) {
+   return vec3_make(V3_LANE(a, 1) * V3_LANE(b, 2) - V3_LANE(a, 2) * V3_LANE(b, 1),
+                    V3_LANE(a, 2) * V3_LANE(b, 0) - V3_LANE(a, 0) * V3_LANE(b, 2),
+                    V3_LANE(a, 0) * V3_LANE(b, 1) - V3_LANE(a, 1) * V3_LANE(b, 0));
+}
+
+static inline float vec3_length(vec3 a) {
+   return sqrtf(vec3_dot(a, a));
+}
+
+// a at unit length, storing the length it had in *length when that isn't NULL
+static inline vec3 vec3_normalize_length(vec3 a, float *length) {
+   float l = vec3_length(a);
+   if(length) *length = l;
+#if V3MATH_SIMD
+   return a / (vec3){l, l, l, 1};
+#else
+   return vec3_make(a.v[0] / l, a.v[1] / l, a.v[2] / l);
+#endif
+}
+
+static inline vec3 vec3_normalize(vec3 a) {
+   return vec3_normalize_length(a, NULL);
+}
+
+static inline vec3 vec3_normalize_fast(vec3 a, int newtonSteps) {
+   return vec3_scale(a, v3_rsqrt_fast(vec3_dot(a, a), newtonSteps));
+}
+
+// v - 2 (v . n) n for a unit normal n
+static inline vec3 vec3_reflect(vec3 v, vec3 n) {
+   return vec3_sub(v, vec3_scale(n, 2 * vec3_dot(v, n)));
+}
 
 #endif